@@ -0,0 +1,427 @@
+#include <llvm/IR/InstrTypes.h>
+
+#include <math.h>
+#include <stdint.h>
+
+#include "ASTFold.h"
+#include "grammar.hpp"
+
+using llvm::CastInst;
+using llvm::dyn_cast;
+using llvm::dyn_cast_or_null;
+using llvm::isa;
+
+namespace {
+
+// A literal with the width the code generator gives its type
+class Constant{
+public:
+    bool fp = false;
+    // a float, its double value is rounded to single precision
+    bool single = false;
+    double number = 0;
+    // an integer of bits width, sign extended
+    unsigned bits = 32;
+    int64_t integer = 0;
+
+    uint64_t unsignedValue() const{
+        return (uint64_t)integer & ((UINT64_C(1) << bits) - 1);
+    }
+
+    // the branch condition, != 0 (ordered for doubles)
+    bool truth() const{
+        return fp ? (number < 0 || number > 0) : integer != 0;
+    }
+};
+
+int64_t signExtend(uint64_t value, unsigned bits){
+    uint64_t sign = UINT64_C(1) << (bits - 1);
+    value &= (sign << 1) - 1;
+    return (int64_t)(value ^ sign) - (int64_t)sign;
+}
+
+bool isComparison(int op){
+    return op == TCLT || op == TCLE || op == TCGE || op == TCGT || op == TCEQ || op == TCNE;
+}
+
+// The operators of NBinaryOperator::codeGen on int, float and double,
+// false where it reports an error or the result is poison, those are left
+// to the code generator
+bool evaluateArithmetic(int op, const Constant& L, const Constant& R, Constant& result){
+    if( result.fp ){
+        double l = L.number;
+        double r = R.number;
+        switch( op ){
+            case TPLUS: result.number = l + r; break;
+            case TMINUS: result.number = l - r; break;
+            case TMUL: result.number = l * r; break;
+            case TDIV: result.number = l / r; break;
+            default: return false;
+        }
+        // the double result of float operands rounds like the float operation
+        if( result.single )
+            result.number = (float)result.number;
+        return true;
+    }
+    if( result.bits != 32 )
+        return false;
+
+    // i32 arithmetic wraps around
+    uint32_t l = L.integer;
+    uint32_t r = R.integer;
+    int32_t value;
+    switch( op ){
+        case TPLUS: value = (int32_t)(l + r); break;
+        case TMINUS: value = (int32_t)(l - r); break;
+        case TMUL: value = (int32_t)(l * r); break;
+        case TDIV:
+            if( r == 0 || (L.integer == INT32_MIN && R.integer == -1) )
+                return false;
+            value = (int32_t)(L.integer / R.integer);
+            break;
+        case TAND: value = (int32_t)(l & r); break;
+        case TOR: value = (int32_t)(l | r); break;
+        case TXOR: value = (int32_t)(l ^ r); break;
+        case TSHIFTL:
+            if( r >= 32 )
+                return false;
+            value = (int32_t)(l << r);
+            break;
+        case TSHIFTR:
+            if( r >= 32 )
+                return false;
+            value = L.integer < 0 ? ~(int32_t)(~l >> r) : (int32_t)(l >> r);
+            break;
+        default:
+            return false;
+    }
+    result.integer = value;
+    return true;
+}
+
+// Same predicates as NBinaryOperator::codeGen, < is unsigned for integers
+// and unordered for doubles. The result is an i1
+bool evaluateComparison(int op, const Constant& L, const Constant& R, Constant& result){
+    bool taken;
+    if( L.fp ){
+        double l = L.number;
+        double r = R.number;
+        switch( op ){
+            case TCLT: taken = !(l >= r); break;
+            case TCLE: taken = l <= r; break;
+            case TCGE: taken = l >= r; break;
+            case TCGT: taken = l > r; break;
+            case TCEQ: taken = l == r; break;
+            case TCNE: taken = l < r || l > r; break;
+            default: return false;
+        }
+    }else{
+        switch( op ){
+            case TCLT: taken = L.unsignedValue() < R.unsignedValue(); break;
+            case TCLE: taken = L.integer <= R.integer; break;
+            case TCGE: taken = L.integer >= R.integer; break;
+            case TCGT: taken = L.integer > R.integer; break;
+            case TCEQ: taken = L.integer == R.integer; break;
+            case TCNE: taken = L.integer != R.integer; break;
+            default: return false;
+        }
+    }
+    result.integer = taken ? -1 : 0;
+    return true;
+}
+
+// The scalar casts of TypeSystem::castOp, false where the result is poison
+bool evaluateCast(unsigned op, const Constant& from, Constant& result){
+    switch( op ){
+        case CastInst::SIToFP:
+            result.number = result.single ? (float)from.integer : (double)from.integer;
+            return true;
+        case CastInst::FPExt:
+            result.number = from.number;
+            return true;
+        case CastInst::FPTrunc:
+            result.number = (float)from.number;
+            return true;
+        case CastInst::FPToSI: {
+            double truncated = trunc(from.number);
+            double limit = ldexp(1.0, result.bits - 1);
+            if( !(truncated >= -limit && truncated < limit) )
+                return false;
+            result.integer = (int64_t)truncated;
+            return true;
+        }
+        case CastInst::ZExt:
+        case CastInst::Trunc:
+            result.integer = signExtend(from.unsignedValue(), result.bits);
+            return true;
+        case CastInst::SExt:
+            result.integer = from.integer;
+            return true;
+        default:
+            return false;
+    }
+}
+
+NExpression* makeLiteral(const Constant& value, NIdentifier* type){
+    NExpression* literal;
+    if( value.fp )
+        literal = new NDouble(value.number);
+    else
+        literal = new NInteger(value.unsignedValue());
+    literal->resolvedType = type;
+    return literal;
+}
+
+bool isLiteral(const NExpression* expr){
+    return isa<NInteger>(expr) || isa<NDouble>(expr);
+}
+
+// A variable known to hold a literal, the induction variable of a loop
+// right after its initial assignment
+class Binding{
+public:
+    Symbol name;
+    NExpression* value = nullptr;
+};
+
+// Statements that make an arm depend on its own scope: declarations are
+// local to it and a return only counts at the top of a function body
+bool needsScope(const NBlock& block){
+    for(auto statement: *block.statements){
+        if( isa<NVariableDeclaration>(statement) || isa<NArrayInitialization>(statement) ||
+            isa<NFunctionDeclaration>(statement) || isa<NStructDeclaration>(statement) ||
+            isa<NReturnStatement>(statement) )
+            return true;
+    }
+    return false;
+}
+
+class ConstantFolder{
+private:
+    Symbol boolName = Symbol("bool");
+    Symbol charName = Symbol("char");
+    Symbol intName = Symbol("int");
+    Symbol floatName = Symbol("float");
+    Symbol doubleName = Symbol("double");
+
+    bool shapeOf(const NIdentifier* type, Constant& result) const;
+    bool evaluate(NExpression* expr, const Binding* binding, Constant& result) const;
+    NExpression* fold(NExpression* expr);
+    void foldStatement(NStatement* statement, StatementList& result);
+
+public:
+    void foldBlock(NBlock* block);
+};
+
+// The width of a scalar type's literals, false for the other types
+bool ConstantFolder::shapeOf(const NIdentifier* type, Constant& result) const{
+    if( !type || type->isArray )
+        return false;
+    result.fp = type->name == floatName || type->name == doubleName;
+    result.single = type->name == floatName;
+    if( type->name == boolName )
+        result.bits = 1;
+    else if( type->name == charName )
+        result.bits = 8;
+    else if( type->name == intName || result.fp )
+        result.bits = 32;
+    else
+        return false;
+    return true;
+}
+
+// The value of expr if it is known at compile time, with binding's
+// variable holding its literal
+bool ConstantFolder::evaluate(NExpression* expr, const Binding* binding, Constant& result) const{
+    if( !expr || !shapeOf(expr->resolvedType, result) )
+        return false;
+
+    switch( expr->kind ){
+        case NodeKind::Integer:
+            result.integer = signExtend(llvm::cast<NInteger>(expr)->value, result.bits);
+            return !result.fp;
+        case NodeKind::Double:
+            result.number = llvm::cast<NDouble>(expr)->value;
+            return result.fp;
+        case NodeKind::Identifier:
+            return binding && llvm::cast<NIdentifier>(expr)->name == binding->name &&
+                   evaluate(binding->value, nullptr, result);
+        case NodeKind::Cast: {
+            auto cast = llvm::cast<NCast>(expr);
+            Constant operand;
+            return !cast->splat && evaluate(cast->expr, binding, operand) &&
+                   evaluateCast(cast->op, operand, result);
+        }
+        case NodeKind::BinaryOperator: {
+            auto binary = llvm::cast<NBinaryOperator>(expr);
+            Constant L, R;
+            if( !evaluate(binary->lchild, binding, L) || !evaluate(binary->rchild, binding, R) )
+                return false;
+            if( isComparison(binary->op) )
+                return evaluateComparison(binary->op, L, R, result);
+            return evaluateArithmetic(binary->op, L, R, result);
+        }
+        default:
+            return false;
+    }
+}
+
+NExpression* ConstantFolder::fold(NExpression* expr){
+    if( !expr )
+        return expr;
+
+    switch( expr->kind ){
+        case NodeKind::BinaryOperator: {
+            auto binary = llvm::cast<NBinaryOperator>(expr);
+            binary->lchild = fold(binary->lchild);
+            binary->rchild = fold(binary->rchild);
+            Constant value;
+            if( evaluate(binary, nullptr, value) )
+                return makeLiteral(value, binary->resolvedType);
+            return binary;
+        }
+        case NodeKind::Cast: {
+            auto cast = llvm::cast<NCast>(expr);
+            cast->expr = fold(cast->expr);
+            Constant value;
+            if( evaluate(cast, nullptr, value) )
+                return makeLiteral(value, cast->resolvedType);
+            return cast;
+        }
+        case NodeKind::Assignment: {
+            auto assignment = llvm::cast<NAssignment>(expr);
+            assignment->rchild = fold(assignment->rchild);
+            return assignment;
+        }
+        case NodeKind::MethodCall:
+            for(auto& argument: *llvm::cast<NMethodCall>(expr)->arguments){
+                argument = fold(argument);
+            }
+            return expr;
+        case NodeKind::ArrayIndex:
+            for(auto& subscript: *llvm::cast<NArrayIndex>(expr)->expressions){
+                subscript = fold(subscript);
+            }
+            return expr;
+        case NodeKind::ArrayAssignment: {
+            auto assignment = llvm::cast<NArrayAssignment>(expr);
+            fold(assignment->arrayInx);
+            assignment->expr = fold(assignment->expr);
+            return assignment;
+        }
+        case NodeKind::StructAssignment: {
+            auto assignment = llvm::cast<NStructAssignment>(expr);
+            assignment->expression = fold(assignment->expression);
+            return assignment;
+        }
+        case NodeKind::Block:
+            foldBlock(llvm::cast<NBlock>(expr));
+            return expr;
+        default:
+            return expr;
+    }
+}
+
+// Append what is left of statement to result
+void ConstantFolder::foldStatement(NStatement* statement, StatementList& result){
+    switch( statement->kind ){
+        case NodeKind::ExpressionStatement: {
+            auto expression = llvm::cast<NExpressionStatement>(statement);
+            expression->expr = fold(expression->expr);
+            // a bare literal does nothing
+            if( !isLiteral(expression->expr) )
+                result.push_back(expression);
+            return;
+        }
+        case NodeKind::VariableDeclaration: {
+            auto declaration = llvm::cast<NVariableDeclaration>(statement);
+            declaration->expr = fold(declaration->expr);
+            break;
+        }
+        case NodeKind::ArrayInitialization: {
+            auto initialization = llvm::cast<NArrayInitialization>(statement);
+            for(auto& expr: *initialization->expressionList){
+                expr = fold(expr);
+            }
+            break;
+        }
+        case NodeKind::FunctionDeclaration:
+            foldBlock(llvm::cast<NFunctionDeclaration>(statement)->block);
+            break;
+        case NodeKind::ReturnStatement: {
+            auto ret = llvm::cast<NReturnStatement>(statement);
+            ret->expr = fold(ret->expr);
+            break;
+        }
+        case NodeKind::IfStatement: {
+            auto ifStatement = llvm::cast<NIfStatement>(statement);
+            ifStatement->condition = fold(ifStatement->condition);
+            Constant condition;
+            if( !evaluate(ifStatement->condition, nullptr, condition) ){
+                foldBlock(ifStatement->tBlock);
+                foldBlock(ifStatement->fBlock);
+                break;
+            }
+            NBlock* arm = condition.truth() ? ifStatement->tBlock : ifStatement->fBlock;
+            if( !arm )
+                return;
+            foldBlock(arm);
+            if( !needsScope(*arm) ){
+                for(auto armStatement: *arm->statements){
+                    result.push_back(armStatement);
+                }
+                return;
+            }
+            // keep the arm in a block of its own
+            ifStatement->condition = new NInteger(1);
+            ifStatement->tBlock = arm;
+            ifStatement->fBlock = nullptr;
+            break;
+        }
+        case NodeKind::ForStatement: {
+            auto loop = llvm::cast<NForStatement>(statement);
+            loop->initial = fold(loop->initial);
+            loop->condition = fold(loop->condition);
+            loop->increase = fold(loop->increase);
+
+            // the first test sees the value of the initial assignment, the
+            // semantic analysis converted it to the variable's type
+            Binding binding;
+            Binding* first = nullptr;
+            auto initial = dyn_cast_or_null<NAssignment>(loop->initial);
+            if( initial && isLiteral(initial->rchild) ){
+                binding.name = initial->lchild->name;
+                binding.value = initial->rchild;
+                first = &binding;
+            }
+            Constant enters;
+            if( evaluate(loop->condition, first, enters) && !enters.truth() ){
+                if( loop->initial )
+                    result.push_back(new NExpressionStatement(loop->initial));
+                return;
+            }
+            foldBlock(loop->block);
+            break;
+        }
+        default:
+            break;
+    }
+    result.push_back(statement);
+}
+
+void ConstantFolder::foldBlock(NBlock* block){
+    if( !block )
+        return;
+    auto statements = new StatementList();
+    for(auto statement: *block->statements){
+        foldStatement(statement, *statements);
+    }
+    block->statements = statements;
+}
+
+}
+
+void foldConstants(NBlock& program){
+    ConstantFolder folder;
+    folder.foldBlock(&program);
+}
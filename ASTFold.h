@@ -0,0 +1,15 @@
+#ifndef ASTFOLD_H
+#define ASTFOLD_H
+
+#include "ASTNodes.h"
+
+// Simplify the analyzed program (Semantic.h) before the code generation:
+// arithmetic, comparisons and NCasts of literals are folded into literals,
+// if statements with a constant condition lose their dead arm and loops
+// that can't be entered are dropped.
+// Literals are evaluated at the width of their resolvedType the way the
+// code generator lowers them, so the generated code computes the same
+// values. Replacement nodes go to the current Arena.
+void foldConstants(NBlock& program);
+
+#endif //ASTFOLD_H
@@ -0,0 +1,186 @@
+#include <llvm/ADT/StringExtras.h>
+#include <string.h>
+
+#include "ASTHash.h"
+
+void ASTHasher::add(llvm::StringRef value){
+    add((uint64_t)value.size());
+    sha1.update(value);
+}
+
+void ASTHasher::add(uint64_t value){
+    sha1.update(llvm::StringRef((const char*)&value, sizeof(value)));
+}
+
+void ASTHasher::add(double value){
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    add(bits);
+}
+
+void ASTHasher::add(bool value){
+    add((uint64_t)value);
+}
+
+void ASTHasher::add(const Node* node){
+    if( node ){
+        node->hash(*this);
+    }else{
+        add(std::string("null"));
+    }
+}
+
+std::string ASTHasher::result(){
+    return llvm::toHex(sha1.result(), true);
+}
+
+void Node::hash(ASTHasher& hasher) const {
+    hasher.add(getTypeName());
+}
+
+void NDouble::hash(ASTHasher& hasher) const {
+    hasher.add(getTypeName());
+    hasher.add(value);
+    hasher.add(resolvedType);
+}
+
+void NInteger::hash(ASTHasher& hasher) const {
+    hasher.add(getTypeName());
+    hasher.add(value);
+    hasher.add(resolvedType);
+}
+
+void NIdentifier::hash(ASTHasher& hasher) const {
+    hasher.add(getTypeName());
+    hasher.add(name.str());
+    hasher.add(isType);
+    hasher.add(isArray);
+    hasher.add(arraySize);
+    if( isType )
+        hasher.typeNames.insert(name.str());
+}
+
+void NMethodCall::hash(ASTHasher& hasher) const {
+    hasher.add(getTypeName());
+    hasher.add(id);
+    hasher.add(arguments);
+    hasher.calledFunctions.insert(id->name.str());
+}
+
+void NBinaryOperator::hash(ASTHasher& hasher) const {
+    hasher.add(getTypeName());
+    hasher.add((uint64_t)op);
+    hasher.add(lchild);
+    hasher.add(rchild);
+}
+
+void NAssignment::hash(ASTHasher& hasher) const {
+    hasher.add(getTypeName());
+    hasher.add(lchild);
+    hasher.add(rchild);
+}
+
+void NBlock::hash(ASTHasher& hasher) const {
+    hasher.add(getTypeName());
+    hasher.add(statements);
+}
+
+void NExpressionStatement::hash(ASTHasher& hasher) const {
+    hasher.add(getTypeName());
+    hasher.add(expr);
+}
+
+void NVariableDeclaration::hash(ASTHasher& hasher) const {
+    hasher.add(getTypeName());
+    hasher.add(type);
+    hasher.add(id);
+    hasher.add(expr);
+}
+
+void NFunctionDeclaration::hash(ASTHasher& hasher) const {
+    hasher.add(getTypeName());
+    hasher.add(type);
+    hasher.add(id);
+    hasher.add(arguments);
+    hasher.add(block);
+    hasher.add(external);
+}
+
+void NStructDeclaration::hash(ASTHasher& hasher) const {
+    hasher.add(getTypeName());
+    hasher.add(id);
+    hasher.add(members);
+}
+
+void NReturnStatement::hash(ASTHasher& hasher) const {
+    hasher.add(getTypeName());
+    hasher.add(expr);
+}
+
+void NIfStatement::hash(ASTHasher& hasher) const {
+    hasher.add(getTypeName());
+    hasher.add(condition);
+    hasher.add(tBlock);
+    hasher.add(fBlock);
+}
+
+void NForStatement::hash(ASTHasher& hasher) const {
+    hasher.add(getTypeName());
+    hasher.add(initial);
+    hasher.add(condition);
+    hasher.add(increase);
+    hasher.add(block);
+    hasher.add(uint64_t(hints.vectorizeWidth));
+    hasher.add(uint64_t(hints.interleaveCount));
+    hasher.add(uint64_t(hints.unrollCount));
+    hasher.add(parallel);
+    if( reductions ){
+        for(auto& reduction: *reductions){
+            hasher.add(uint64_t(reduction.op));
+            hasher.add(reduction.variable);
+        }
+    }
+}
+
+void NStructMember::hash(ASTHasher& hasher) const {
+    hasher.add(getTypeName());
+    hasher.add(id);
+    hasher.add(member);
+}
+
+void NArrayIndex::hash(ASTHasher& hasher) const {
+    hasher.add(getTypeName());
+    hasher.add(arrayId);
+    hasher.add(expressions);
+}
+
+void NArrayAssignment::hash(ASTHasher& hasher) const {
+    hasher.add(getTypeName());
+    hasher.add(arrayInx);
+    hasher.add(expr);
+}
+
+void NArrayInitialization::hash(ASTHasher& hasher) const {
+    hasher.add(getTypeName());
+    hasher.add(declaration);
+    hasher.add(expressionList);
+}
+
+void NStructAssignment::hash(ASTHasher& hasher) const {
+    hasher.add(getTypeName());
+    hasher.add(structMember);
+    hasher.add(expression);
+}
+
+void NLiteral::hash(ASTHasher& hasher) const {
+    hasher.add(getTypeName());
+    hasher.add(value);
+}
+
+void NCast::hash(ASTHasher& hasher) const {
+    hasher.add(getTypeName());
+    hasher.add(resolvedType);
+    hasher.add((uint64_t)op);
+    hasher.add(splat);
+    hasher.add(expr);
+}
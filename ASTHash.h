@@ -0,0 +1,47 @@
+#ifndef ASTHASH_H
+#define ASTHASH_H
+
+#include <llvm/Support/SHA1.h>
+#include <set>
+#include <string>
+#include <stdint.h>
+
+#include "ASTNodes.h"
+
+// Structural hash of an AST subtree. Besides the hash it collects the names
+// the subtree depends on: the types it names and the functions it calls.
+class ASTHasher{
+private:
+    llvm::SHA1 sha1;
+
+public:
+    std::set<std::string> typeNames;
+    std::set<std::string> calledFunctions;
+
+    void add(llvm::StringRef value);
+    void add(uint64_t value);
+    void add(double value);
+    void add(bool value);
+    // null children are hashed too, so optional children can't shift fields
+    void add(const Node* node);
+    template<typename T>
+    void add(const NodeList<T>* list){
+        add((uint64_t)(list ? list->size() : 0));
+        if( list ){
+            for(auto& child: *list){
+                add(child);
+            }
+        }
+    }
+
+    // the handle would otherwise convert to bool, see NodeRef
+    template<typename T>
+    void add(const NodeRef<T>& ref){
+        add(ref.get());
+    }
+
+    // hex digest, the hasher can't be used afterwards
+    std::string result();
+};
+
+#endif //ASTHASH_H
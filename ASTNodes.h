@@ -5,53 +5,80 @@
 //#define PRINT_NUM_OF_VALID_NODES
 
 #include <llvm/IR/Value.h>
+#include <llvm/IR/Function.h>
+#include <llvm/Support/Casting.h>
 #include <json/json.h>
 #include <vector>
 #include <iostream>
 #include <memory>
 #include <string>
 #include <stdint.h>
+#include "Symbol.h"
+#include "Arena.h"
 
 class CodeGenContext;
+class ASTHasher;
 class NBlock;
 class NStatement;
 class NExpression;
+class NIdentifier;
 class NVariableDeclaration;
 
 using std::endl;
 using std::string;
 using std::cout;
-using std::shared_ptr;
-using std::make_shared;
 using std::vector;
 
-typedef vector<shared_ptr<NStatement>> StatementList;
-typedef vector<shared_ptr<NExpression>> ExpressionList;
-typedef vector<shared_ptr<NVariableDeclaration>> VariableList;
-
-
-static uint64_t nodeNum = 0;
-static uint64_t intNum = 0;
-static uint64_t doubleNum = 0;
-static uint64_t methodNum = 0;
-static uint64_t exprNum = 0;
-static uint64_t blockNum = 0;
+typedef NodeList<NodeRef<NStatement>> StatementList;
+typedef NodeList<NodeRef<NExpression>> ExpressionList;
+typedef NodeList<NodeRef<NVariableDeclaration>> VariableList;
+
+
+// Tag of the concrete node class, kept in the node so the code generator
+// can tell nodes apart with isa<>/dyn_cast<> instead of RTTI
+enum class NodeKind : uint8_t {
+	// statements
+	ExpressionStatement,
+	VariableDeclaration,
+	FunctionDeclaration,
+	StructDeclaration,
+	ReturnStatement,
+	IfStatement,
+	ForStatement,
+	ArrayInitialization,
+	// expressions
+	Double,
+	Integer,
+	Identifier,
+	MethodCall,
+	BinaryOperator,
+	Assignment,
+	Block,
+	StructMember,
+	ArrayIndex,
+	ArrayAssignment,
+	StructAssignment,
+	Literal,
+	Cast,
+};
 
+// Nodes are allocated in the current Arena and never deleted, they refer to
+// each other by NodeRef so none of them may live anywhere else
+static const char m_COLON = ':';
+static const char* const m_PREFIX = "----";
 
-class Node {
-protected:
-	const char m_COLON = ':';
-	const char* m_PREFIX = "----";
+class Node : public ArenaObject {
 public:
-	Node() {
-		nodeNum++;
-#ifdef PRINT_JOSONGEN
-		cout << nodeNum << endl;
-#endif
-	}
+	const NodeKind kind;
+
+	Node(NodeKind kind): kind(kind) {}
 	virtual ~Node() {}
 	virtual string getTypeName() const = 0; 
-	virtual llvm::Value *codeGen(CodeGenContext &context) { return (llvm::Value *)0; }
+	// lowers the node, switches on kind to the codeGen of the concrete class
+	// (CodeGen.cpp), the node classes have no virtual codeGen
+	llvm::Value* codeGen(CodeGenContext& context);
+	// feed the node and its children into a structural hash, see ASTHash.h
+	virtual void hash(ASTHasher& hasher) const;
 
 #ifdef PRINT_JOSONGEN
 	virtual void print(string prefix) const {}
@@ -63,7 +90,11 @@ public:
 
 class NStatement : public Node {
 public:
-	NStatement(){}
+	NStatement(NodeKind kind): Node(kind) {}
+
+	static bool classof(const Node* node) {
+		return node->kind <= NodeKind::ArrayInitialization;
+	}
 
 	string getTypeName() const override {
 		return "NStatement";
@@ -83,7 +114,15 @@ public:
 
 class NExpression : public Node {
 public:
-	NExpression() {}
+	// type of the value, set by the semantic analysis (Semantic.h). nullptr
+	// where the code generator decides it (builtin calls, assignments)
+	NodeRef<NIdentifier> resolvedType = nullptr;
+
+	NExpression(NodeKind kind): Node(kind) {}
+
+	static bool classof(const Node* node) {
+		return node->kind >= NodeKind::Double;
+	}
 
 	string getTypeName() const override {
 		return "NExpression";
@@ -104,13 +143,14 @@ public:
 class NDouble : public NExpression {
 public:
 	double value;
-	uint64_t index;
 
-	NDouble() { doubleNum++; }
+	NDouble() : NExpression(NodeKind::Double) {}
 
 	NDouble(double value)
-		:value(value){
-		doubleNum++; 
+		:NExpression(NodeKind::Double), value(value){}
+
+	static bool classof(const Node* node) {
+		return node->kind == NodeKind::Double;
 	}
 
 	string getTypeName() const override {
@@ -119,29 +159,31 @@ public:
 
 #ifdef PRINT_JOSONGEN
 	void print(string prefix) const override {
-		cout << prefix << getTypeName() << this->m_COLON << value << endl;
+		cout << prefix << getTypeName() << m_COLON << value << endl;
 	}
 
 	Json::Value jsonGen() const override {
 		Json::Value root;
-		root["name"] = getTypeName() + this->m_COLON + std::to_string(value);
+		root["name"] = getTypeName() + m_COLON + std::to_string(value);
 		return root;
 	}
 #endif
 
-	virtual llvm::Value* codeGen(CodeGenContext&) override;
+	llvm::Value* codeGen(CodeGenContext&);
+	void hash(ASTHasher& hasher) const override;
 };
 
-class NInterger : public NExpression {
+class NInteger : public NExpression {
 public:
 	uint64_t value;
-	uint64_t index;
 
-	NInterger() { intNum++; }
+	NInteger() : NExpression(NodeKind::Integer) {}
+
+	NInteger(uint64_t value)
+		:NExpression(NodeKind::Integer), value(value) {}
 
-	NInterger(uint64_t value)
-		:value(value) {
-		intNum++;
+	static bool classof(const Node* node) {
+		return node->kind == NodeKind::Integer;
 	}
 
 	string getTypeName() const override {
@@ -150,12 +192,12 @@ public:
 
 #ifdef PRINT_JOSONGEN
 	void print(string prefix) const override {
-		cout << prefix << getTypeName() << this->m_COLON << value << endl;
+		cout << prefix << getTypeName() << m_COLON << value << endl;
 	}
 
 	Json::Value jsonGen() const override {
 		Json::Value root;
-		root["name"] = getTypeName() + this->m_COLON + std::to_string(value);
+		root["name"] = getTypeName() + m_COLON + std::to_string(value);
 		return root;
 	}
 #endif
@@ -164,66 +206,74 @@ public:
 		return NDouble(value);
 	}
 
-	virtual llvm::Value* codeGen(CodeGenContext&) override;
+	llvm::Value* codeGen(CodeGenContext&);
+	void hash(ASTHasher& hasher) const override;
 };
 
 class NIdentifier : public NExpression {
 public:
-	string name;
+	// the flags first, packed together
 	bool isType = false;
 	bool isArray = false;
-	shared_ptr<ExpressionList> arraySize = make_shared<ExpressionList>();
+	Symbol name;
+	// only arrays have a list of sizes
+	NodeRef<ExpressionList> arraySize = nullptr;
+	// the declaration a variable resolves to, set by the semantic analysis
+	NodeRef<NVariableDeclaration> declaration = nullptr;
 
-	NIdentifier() { exprNum++; }
+	NIdentifier() : NExpression(NodeKind::Identifier) {}
 
-	NIdentifier(const string &name)
-		: name(name) {
-		exprNum++;
-	}
+	NIdentifier(Symbol name)
+		: NExpression(NodeKind::Identifier), name(name) {}
 	
+	static bool classof(const Node* node) {
+		return node->kind == NodeKind::Identifier;
+	}
+
 	string getTypeName() const override {
 		return "NIdentifier";
 	}
 #ifdef PRINT_JOSONGEN
 	Json::Value jsonGen() const override {
 		Json::Value root;
-		root["name"] = getTypeName() + this->m_COLON + name + (isArray ? "(Array)" : "");
-		for (auto child = arraySize->begin(); child != arraySize->end(); child++) {
-			root["children"].append((*child)->jsonGen());
+		root["name"] = getTypeName() + m_COLON + name.str() + (isArray ? "(Array)" : "");
+		if (arraySize) {
+			for (auto child = arraySize->begin(); child != arraySize->end(); child++) {
+				root["children"].append((*child)->jsonGen());
+			}
 		}
 		return root;
 	}
 
 	void print(string prefix) const override {
-		string nPrefix = prefix + this->m_PREFIX;
-		cout << prefix << getTypeName() << this->m_COLON << name << (isArray ? "(Array)" : "") << endl;
-		if (isArray && arraySize() > 0) {
+		string nPrefix = prefix + m_PREFIX;
+		cout << prefix << getTypeName() << m_COLON << name << (isArray ? "(Array)" : "") << endl;
+		if (isArray && arraySize && arraySize->size() > 0) {
 			for (auto child = arraySize->begin(); child != arraySize->end(); child++) {
 				(*child)->print(nPrefix);
 			}
 		}
 	}
 #endif
-	virtual llvm::Value* codeGen(CodeGenContext&) override;
+	llvm::Value* codeGen(CodeGenContext&);
+	void hash(ASTHasher& hasher) const override;
 };
 
 class NMethodCall : public NExpression {
 public:
-	const shared_ptr<NIdentifier> id;
-	shared_ptr<ExpressionList> arguments = make_shared<ExpressionList>();
+	NodeRef<NIdentifier> id = nullptr;
+	NodeRef<ExpressionList> arguments = new ExpressionList();
 
-	NMethodCall() {
-		methodNum++;
-	}
+	NMethodCall() : NExpression(NodeKind::MethodCall) {}
 
-	NMethodCall(const shared_ptr<NIdentifier> id, shared_ptr<ExpressionList> arguments)
-		:id(id), arguments(arguments) {
-		methodNum++;
-	}
+	NMethodCall(NIdentifier* id, ExpressionList* arguments)
+		:NExpression(NodeKind::MethodCall), id(id), arguments(arguments) {}
 
-	NMethodCall(const shared_ptr<NIdentifier> id)
-		:id(id) {
-		methodNum++;
+	NMethodCall(NIdentifier* id)
+		:NExpression(NodeKind::MethodCall), id(id) {}
+
+	static bool classof(const Node* node) {
+		return node->kind == NodeKind::MethodCall;
 	}
 
 	string getTypeName() const override {
@@ -242,8 +292,8 @@ public:
 	}
 
 	void print(string prefix) const override {
-		string nPrefix = prefix + this->m_PREFIX;
-		cout << prefix << getTypeName() << this->m_COLON << endl;
+		string nPrefix = prefix + m_PREFIX;
+		cout << prefix << getTypeName() << m_COLON << endl;
 		this->id->print(nPrefix);
 		for (auto argument = arguments->begin(); argument != arguments->end(); argument++) {
 			(*argument)->print(nPrefix);
@@ -251,22 +301,27 @@ public:
 	}
 #endif
 
-	virtual llvm::Value* codeGen(CodeGenContext&) override;
+	llvm::Value* codeGen(CodeGenContext&);
+	void hash(ASTHasher& hasher) const override;
 };
 
 class NBinaryOperator : public NExpression {
 public:
 	int op;
-	shared_ptr<NExpression> lchild;
-	shared_ptr<NExpression> rchild;
+	NodeRef<NExpression> lchild = nullptr;
+	NodeRef<NExpression> rchild = nullptr;
 
-	NBinaryOperator() {}
+	NBinaryOperator() : NExpression(NodeKind::BinaryOperator) {}
 
-	NBinaryOperator(shared_ptr<NExpression> lchild, int op, shared_ptr<NExpression> rchild)
-		:lchild(lchild), op(op), rchild(rchild) {
+	NBinaryOperator(NExpression* lchild, int op, NExpression* rchild)
+		:NExpression(NodeKind::BinaryOperator), lchild(lchild), op(op), rchild(rchild) {
 
 	}
 
+	static bool classof(const Node* node) {
+		return node->kind == NodeKind::BinaryOperator;
+	}
+
 	string getTypeName() const override {
 		return "NBinaryOperator";
 	}
@@ -274,7 +329,7 @@ public:
 #ifdef PRINT_JOSONGEN
 	Json::Value jsonGen() const override {
 		Json::Value root;
-		root["name"] = getTypeName() + this->m_COLON + std::to_string(op);
+		root["name"] = getTypeName() + m_COLON + std::to_string(op);
 		root["children"].append(lchild->jsonGen());
 		root["children"].append(rchild->jsonGen());
 
@@ -282,27 +337,32 @@ public:
 	}
 
 	void print(string prefix) const override {
-		string nPrefix = prefix + this->m_PREFIX;
-		cout << prefix << getTypeName() << this->m_COLON << op << endl;
+		string nPrefix = prefix + m_PREFIX;
+		cout << prefix << getTypeName() << m_COLON << op << endl;
 		
 		lchild->print(nPrefix);
 		rchild->print(nPrefix);
 
 	}
 #endif
-	virtual llvm::Value* codeGen(CodeGenContext&) override;
+	llvm::Value* codeGen(CodeGenContext&);
+	void hash(ASTHasher& hasher) const override;
 };
 
 
 class NAssignment : public NExpression {
 public:
-	shared_ptr<NExpression> lchild;
-	shared_ptr<NExpression> rchild;
+	NodeRef<NIdentifier> lchild = nullptr;
+	NodeRef<NExpression> rchild = nullptr;
+
+	NAssignment() : NExpression(NodeKind::Assignment) {}
 
-	NAssignment() {}
+	NAssignment(NIdentifier* lchild, NExpression* rchild)
+		:NExpression(NodeKind::Assignment), lchild(lchild), rchild(rchild) {
+	}
 
-	NAssignment(shared_ptr<NExpression> lchild, shared_ptr<NExpression> rchild)
-		:lchild(lchild), rchild(rchild) {
+	static bool classof(const Node* node) {
+		return node->kind == NodeKind::Assignment;
 	}
 
 	string getTypeName() const override {
@@ -319,21 +379,24 @@ public:
 	}
 
 	void print(string prefix) const override {
-		string nPrefix = prefix + this->m_PREFIX;
-		cout << prefix << getTypeName() << this->m_COLON << endl;
+		string nPrefix = prefix + m_PREFIX;
+		cout << prefix << getTypeName() << m_COLON << endl;
 		lchild->print(nPrefix);
 		rchild->print(nPrefix);
 	}
 #endif
-	virtual llvm::Value* codeGen(CodeGenContext&) override;
+	llvm::Value* codeGen(CodeGenContext&);
+	void hash(ASTHasher& hasher) const override;
 };
 
 class NBlock : public NExpression {
 public:
-	shared_ptr<StatementList> statements = make_shared<StatementList>();
+	NodeRef<StatementList> statements = new StatementList();
 
-	NBlock() {
-		blockNum++;
+	NBlock() : NExpression(NodeKind::Block) {}
+
+	static bool classof(const Node* node) {
+		return node->kind == NodeKind::Block;
 	}
 
 	string getTypeName() const override {
@@ -350,24 +413,29 @@ public:
 	}
 
 	void print(string prefix) const override {
-		string nPrefix = prefix + this->m_PREFIX;
-		cout << prefix << getTypeName() << this->m_COLON << endl;
+		string nPrefix = prefix + m_PREFIX;
+		cout << prefix << getTypeName() << m_COLON << endl;
 		for (auto state = statements->begin(); state != statements->end(); state++) {
 			(*state)->print(nPrefix);
 		}
 	}
 #endif
-	virtual llvm::Value* codeGen(CodeGenContext&) override;
+	llvm::Value* codeGen(CodeGenContext&);
+	void hash(ASTHasher& hasher) const override;
 };
 
 class NExpressionStatement : public NStatement {
 public:
-	shared_ptr<NExpression> expr;
+	NodeRef<NExpression> expr = nullptr;
+
+	NExpressionStatement() : NStatement(NodeKind::ExpressionStatement) {}
 
-	NExpressionStatement() {}
+	NExpressionStatement(NExpression* expression)
+		:NStatement(NodeKind::ExpressionStatement), expr(expression) {
+	}
 
-	NExpressionStatement(shared_ptr<NExpression> expression)
-		:expr(expression) {
+	static bool classof(const Node* node) {
+		return node->kind == NodeKind::ExpressionStatement;
 	}
 
 	string getTypeName() const override {
@@ -381,30 +449,43 @@ public:
 		return root;
 	}
 	void print(string prefix) const override {
-		string nPrefix = prefix + this->m_PREFIX;
-		cout << prefix << getTypeName() << this->m_COLON << endl;
+		string nPrefix = prefix + m_PREFIX;
+		cout << prefix << getTypeName() << m_COLON << endl;
 		expr->print(nPrefix);
 	}
 #endif
 
-	virtual llvm::Value* codeGen(CodeGenContext&) override;
+	llvm::Value* codeGen(CodeGenContext&);
+	void hash(ASTHasher& hasher) const override;
 };
 
 class NVariableDeclaration : public NStatement {
 public:
-	const shared_ptr<NIdentifier> type;
-	shared_ptr<NIdentifier> id;
-	shared_ptr<NExpression> expr = nullptr;
-	int32_t index;
-
-	NVariableDeclaration() {}
-
-	NVariableDeclaration(const shared_ptr<NIdentifier> type, shared_ptr<NIdentifier> id, shared_ptr<NExpression> expr = nullptr)
-		:type(type), id(id), expr(expr) {
+	NodeRef<NIdentifier> type = nullptr;
+	NodeRef<NIdentifier> id = nullptr;
+	NodeRef<NExpression> expr = nullptr;
+	// set by the code generator, the identifiers resolved to the declaration
+	// are lowered through them: the stack slot of the variable and the type
+	// it holds, an array argument holds the pointer to its first row
+	llvm::Value* address = nullptr;
+	llvm::Type* addressType = nullptr;
+	// arrays only: the type the subscripts index into and the element type
+	llvm::Type* indexedType = nullptr;
+	llvm::Type* elementType = nullptr;
+	bool isFuncArg = false;
+
+	NVariableDeclaration() : NStatement(NodeKind::VariableDeclaration) {}
+
+	NVariableDeclaration(NIdentifier* type, NIdentifier* id, NExpression* expr = nullptr)
+		:NStatement(NodeKind::VariableDeclaration), type(type), id(id), expr(expr) {
 		// check type.
 		assert(type->isType);
 		assert(!type->isArray || (type->isArray && type->arraySize != nullptr));
 	}
+	static bool classof(const Node* node) {
+		return node->kind == NodeKind::VariableDeclaration;
+	}
+
 	string getTypeName() const override {
 		return "NVariableDeclaration";
 	}
@@ -421,8 +502,8 @@ public:
 	}
 
 	void print(string prefix) const override {
-		string nPrefix = prefix + this->m_PREFIX;
-		cout << prefix << getTypeName() << this->m_COLON << endl;
+		string nPrefix = prefix + m_PREFIX;
+		cout << prefix << getTypeName() << m_COLON << endl;
 		type->print(nPrefix);
 		id->print(nPrefix);
 		if (expr != nullptr) {
@@ -430,24 +511,29 @@ public:
 		}
 	}
 #endif
-	virtual llvm::Value* codeGen(CodeGenContext&) override;
+	llvm::Value* codeGen(CodeGenContext&);
+	void hash(ASTHasher& hasher) const override;
 };
 
 class NFunctionDeclaration : public NStatement {
 public:
-	shared_ptr<NIdentifier> type;
-	shared_ptr<NIdentifier> id;
-	shared_ptr<VariableList> arguments = make_shared< VariableList>();
-	shared_ptr<NBlock> block;
+	NodeRef<NIdentifier> type = nullptr;
+	NodeRef<NIdentifier> id = nullptr;
+	NodeRef<VariableList> arguments = new VariableList();
+	NodeRef<NBlock> block = nullptr;
 	bool external = false;
 
-	NFunctionDeclaration() {}
+	NFunctionDeclaration() : NStatement(NodeKind::FunctionDeclaration) {}
 
-	NFunctionDeclaration(shared_ptr<NIdentifier> type, shared_ptr<NIdentifier> id, shared_ptr<VariableList> arguments, shared_ptr<NBlock> block, bool external = false)
-		:type(type), id(id), arguments(arguments), block(block), external(external) {
+	NFunctionDeclaration(NIdentifier* type, NIdentifier* id, VariableList* arguments, NBlock* block, bool external = false)
+		:NStatement(NodeKind::FunctionDeclaration), type(type), id(id), arguments(arguments), block(block), external(external) {
 		assert(type->isType);
 	}
 
+	static bool classof(const Node* node) {
+		return node->kind == NodeKind::FunctionDeclaration;
+	}
+
 	string getTypeName() const override {
 		return "NFunctionDeclaration";
 	}
@@ -470,8 +556,8 @@ public:
 	}
 
 	void print(string prefix) const override {
-		string nPrefix = prefix + this->m_PREFIX;
-		cout << prefix << getTypeName() << this->m_COLON << endl;
+		string nPrefix = prefix + m_PREFIX;
+		cout << prefix << getTypeName() << m_COLON << endl;
 
 		type->print(nPrefix);
 		id->print(nPrefix);
@@ -487,18 +573,25 @@ public:
 	}
 
 #endif
-	virtual llvm::Value* codeGen(CodeGenContext&) override;
+	llvm::Value* codeGen(CodeGenContext&);
+	// declare the function in the module without generating the body
+	llvm::Function* codeGenPrototype(CodeGenContext&);
+	void hash(ASTHasher& hasher) const override;
 };
 
 class NStructDeclaration : public NStatement {
 public:
-	shared_ptr<NIdentifier> id;
-	shared_ptr<VariableList> members = make_shared<VariableList>();
+	NodeRef<NIdentifier> id = nullptr;
+	NodeRef<VariableList> members = new VariableList();
+
+	NStructDeclaration() : NStatement(NodeKind::StructDeclaration) {}
 
-	NStructDeclaration() {}
+	NStructDeclaration(NIdentifier* id, VariableList* members)
+		:NStatement(NodeKind::StructDeclaration), id(id), members(members) {
+	}
 
-	NStructDeclaration(shared_ptr<NIdentifier> id, shared_ptr<VariableList> members)
-		:id(id), members(members) {
+	static bool classof(const Node* node) {
+		return node->kind == NodeKind::StructDeclaration;
 	}
 
 	string getTypeName() const override {
@@ -508,7 +601,7 @@ public:
 #ifdef PRINT_JOSONGEN
 	Json::Value jsonGen() const override {
 		Json::Value root;
-		root["name"] = getTypeName() + this->m_COLON + id->name;
+		root["name"] = getTypeName() + m_COLON + id->name.str();
 		
 		for (auto member = members->begin(); member != members->end(); member++) {
 			root["children"].append((*member)->jsonGen());
@@ -517,8 +610,8 @@ public:
 		return root;
 	}
 	void print(string prefix)const override {
-		string nPrefix = prefix + this->m_PREFIX;
-		cout << prefix << getTypeName() << this->m_COLON << id->name << endl;
+		string nPrefix = prefix + m_PREFIX;
+		cout << prefix << getTypeName() << m_COLON << id->name << endl;
 
 		for (auto member = members->begin(); member != members->end(); member++) {
 			(*member)->print(nPrefix);
@@ -527,17 +620,22 @@ public:
 	}
 
 #endif
-	virtual llvm::Value* codeGen(CodeGenContext& context) override;
+	llvm::Value* codeGen(CodeGenContext& context);
+	void hash(ASTHasher& hasher) const override;
 };
 
 class NReturnStatement : public NStatement {
 public:
-	shared_ptr<NExpression> expr;
+	NodeRef<NExpression> expr = nullptr;
 
-	NReturnStatement(){}
+	NReturnStatement() : NStatement(NodeKind::ReturnStatement) {}
 
-	NReturnStatement(shared_ptr<NExpression> expr)
-		:expr(expr) {
+	NReturnStatement(NExpression* expr)
+		:NStatement(NodeKind::ReturnStatement), expr(expr) {
+	}
+
+	static bool classof(const Node* node) {
+		return node->kind == NodeKind::ReturnStatement;
 	}
 
 	string getTypeName() const override {
@@ -553,27 +651,32 @@ public:
 	}
 
 	void print(string prefix) const override {
-		string nPrefix = prefix + this->m_PREFIX;
-		cout << prefix << getTypeName() << this->m_COLON << endl;
+		string nPrefix = prefix + m_PREFIX;
+		cout << prefix << getTypeName() << m_COLON << endl;
 		expr->print(nPrefix);
 	}
 
 #endif
-	virtual llvm::Value* codeGen(CodeGenContext& context)override;
+	llvm::Value* codeGen(CodeGenContext& context);
+	void hash(ASTHasher& hasher) const override;
 
 };
 
 class NIfStatement : public NStatement {
 public:
 
-	shared_ptr<NExpression> condition;
-	shared_ptr<NBlock> tBlock;
-	shared_ptr<NBlock> fBlock;
+	NodeRef<NExpression> condition = nullptr;
+	NodeRef<NBlock> tBlock = nullptr;
+	NodeRef<NBlock> fBlock = nullptr;
 
-	NIfStatement(){}
+	NIfStatement() : NStatement(NodeKind::IfStatement) {}
 
-	NIfStatement(shared_ptr<NExpression> condition, shared_ptr<NBlock> tBlock, shared_ptr<NBlock> fBlock = nullptr)
-		:condition(condition), tBlock(tBlock), fBlock(fBlock) {
+	NIfStatement(NExpression* condition, NBlock* tBlock, NBlock* fBlock = nullptr)
+		:NStatement(NodeKind::IfStatement), condition(condition), tBlock(tBlock), fBlock(fBlock) {
+	}
+
+	static bool classof(const Node* node) {
+		return node->kind == NodeKind::IfStatement;
 	}
 
 	string getTypeName() const override {
@@ -592,8 +695,8 @@ public:
 	}
 
 	void print(string prefix) const override {
-		string nPrefix = prefix + this->m_PREFIX;
-		cout << prefix << getTypeName() << this->m_COLON << endl;
+		string nPrefix = prefix + m_PREFIX;
+		cout << prefix << getTypeName() << m_COLON << endl;
 
 		condition->print(nPrefix);
 		tBlock->print(nPrefix);
@@ -605,25 +708,58 @@ public:
 
 #endif
 
-	llvm::Value *codeGen(CodeGenContext&) override;
+	llvm::Value *codeGen(CodeGenContext&);
+	void hash(ASTHasher& hasher) const override;
 
 };
 
 
-class NForStatement : public NStatement {
+// The "#pragma loop" hints in front of a for/while, 0 leaves the choice to
+// the optimizer
+class LoopHints {
 public:
-	shared_ptr<NExpression> initial, condition, increase;
-	shared_ptr<NBlock> block;
+	uint32_t vectorizeWidth = 0;
+	uint32_t interleaveCount = 0;
+	uint32_t unrollCount = 0;
 
-	NForStatement(){}
+	bool empty() const {
+		return vectorizeWidth == 0 && interleaveCount == 0 && unrollCount == 0;
+	}
+};
 
-	NForStatement(shared_ptr<NBlock> block, shared_ptr<NExpression> initial = nullptr, shared_ptr<NExpression> condition = nullptr, shared_ptr<NExpression> increase = nullptr)
-		:block(block), initial(initial), condition(condition), increase(increase) {
+// "reduce(+ sum)" of a parallel for, op is TPLUS or TMUL
+class LoopReduction {
+public:
+	int op;
+	NodeRef<NIdentifier> variable;
+};
+
+typedef NodeList<LoopReduction> ReductionList;
+
+class NForStatement : public NStatement {
+public:
+	NodeRef<NExpression> initial = nullptr;
+	NodeRef<NExpression> condition = nullptr;
+	NodeRef<NExpression> increase = nullptr;
+	NodeRef<NBlock> block = nullptr;
+	LoopHints hints;
+	// "parallel for": the body is outlined and run on the runtime thread pool
+	bool parallel = false;
+	NodeRef<ReductionList> reductions = nullptr;
+
+	NForStatement() : NStatement(NodeKind::ForStatement) {}
+
+	NForStatement(NBlock* block, NExpression* initial = nullptr, NExpression* condition = nullptr, NExpression* increase = nullptr)
+		:NStatement(NodeKind::ForStatement), block(block), initial(initial), condition(condition), increase(increase) {
 		if (condition == nullptr) {
-			condition = make_shared<NInterger>(1);
+			this->condition = new NInteger(1);
 		}
 	}
 
+	static bool classof(const Node* node) {
+		return node->kind == NodeKind::ForStatement;
+	}
+
 	string getTypeName() const override {
 		return "NForStatement";
 	}
@@ -645,8 +781,8 @@ public:
 
 	void print(string prefix) const override {
 		
-		string nPrefix = prefix + this->m_PREFIX;
-		cout << prefix << getTypeName() << this->m_COLON << endl;
+		string nPrefix = prefix + m_PREFIX;
+		cout << prefix << getTypeName() << m_COLON << endl;
 
 		if (initial)
 			initial->print(nPrefix);
@@ -662,19 +798,27 @@ public:
 
 #endif
 
-	llvm::Value *codeGen(CodeGenContext&) override;
+	llvm::Value *codeGen(CodeGenContext&);
+	llvm::Value *codeGenParallel(CodeGenContext&);
+	void hash(ASTHasher& hasher) const override;
 
 };
 
 class NStructMember : public NExpression {
 public:
-	shared_ptr<NIdentifier> id;
-	shared_ptr<NIdentifier> member;
+	NodeRef<NIdentifier> id = nullptr;
+	NodeRef<NIdentifier> member = nullptr;
+	// position of member in the struct, set by the semantic analysis
+	int32_t memberIndex = -1;
 
-	NStructMember(){}
+	NStructMember() : NExpression(NodeKind::StructMember) {}
 
-	NStructMember(shared_ptr<NIdentifier> structId, shared_ptr<NIdentifier> member)
-		:id(structId), member(member) {
+	NStructMember(NIdentifier* structId, NIdentifier* member)
+		:NExpression(NodeKind::StructMember), id(structId), member(member) {
+	}
+
+	static bool classof(const Node* node) {
+		return node->kind == NodeKind::StructMember;
 	}
 
 	string getTypeName() const override {
@@ -693,8 +837,8 @@ public:
 	}
 
 	void print(string prefix) const override {
-		string nPrefix = prefix + this->m_PREFIX;
-		cout << prefix << getTypeName() << this->m_COLON << endl;
+		string nPrefix = prefix + m_PREFIX;
+		cout << prefix << getTypeName() << m_COLON << endl;
 
 		id->print(nPrefix);
 		member->print(nPrefix);
@@ -703,25 +847,30 @@ public:
 
 #endif
 
-	llvm::Value *codeGen(CodeGenContext&) override;
+	llvm::Value *codeGen(CodeGenContext&);
+	void hash(ASTHasher& hasher) const override;
 
 };
 
 class NArrayIndex : public NExpression {
 public:
-	shared_ptr<NIdentifier> arrayId;
-	shared_ptr<ExpressionList> indexs = make_shared<ExpressionList>();
+	NodeRef<NIdentifier> arrayId = nullptr;
+	NodeRef<ExpressionList> expressions = new ExpressionList();
 	int32_t size;
 
-	NArrayIndex(){}
+	NArrayIndex() : NExpression(NodeKind::ArrayIndex) {}
+
+	NArrayIndex(NIdentifier* arrayId, NExpression* expr)
+		: NExpression(NodeKind::ArrayIndex), arrayId(arrayId) {
+		expressions->push_back(expr);
+	}
 
-	NArrayIndex(shared_ptr<NIdentifier> arrayId, shared_ptr<NExpression> expr)
-		: arrayId(arrayId) {
-		indexs->push_back(expr);
+	NArrayIndex(NIdentifier* arrayId, ExpressionList* list)
+		:NExpression(NodeKind::ArrayIndex), arrayId(arrayId), expressions(list) {
 	}
 
-	NArrayIndex(shared_ptr<NIdentifier> arrayId, shared_ptr<ExpressionList> list)
-		:arrayId(arrayId), indexs(list) {
+	static bool classof(const Node* node) {
+		return node->kind == NodeKind::ArrayIndex;
 	}
 
 	string getTypeName() const override {
@@ -733,7 +882,7 @@ public:
 		root["name"] = getTypeName();
 
 		root["children"].append(arrayId->jsonGen());
-		for (auto index = indexs->begin(); index != indexs->end(); index++) {
+		for (auto index = expressions->begin(); index != expressions->end(); index++) {
 			root["children"].append((*index)->jsonGen());
 		}
 		return root;
@@ -741,31 +890,36 @@ public:
 	}
 
 	void print(string prefix) const override {
-		string nPrefix = prefix + this->m_PREFIX;
-		cout << prefix << getTypeName() << this->m_COLON << endl;
+		string nPrefix = prefix + m_PREFIX;
+		cout << prefix << getTypeName() << m_COLON << endl;
 
 		arrayId->print(nPrefix);
-		for (auto index = indexs->begin(); index != indexs->end(); index++) {
+		for (auto index = expressions->begin(); index != expressions->end(); index++) {
 			(*index)->print(nPrefix);
 		}
 
 	}
 #endif
-	llvm::Value *codeGen(CodeGenContext&) override;
+	llvm::Value *codeGen(CodeGenContext&);
+	void hash(ASTHasher& hasher) const override;
 
 };
 
 class NArrayAssignment : public NExpression {
 public:
-	shared_ptr<NArrayIndex> arrayInx;
-	shared_ptr<NExpression> expr;
+	NodeRef<NArrayIndex> arrayInx = nullptr;
+	NodeRef<NExpression> expr = nullptr;
 
-	NArrayAssignment(){}
+	NArrayAssignment() : NExpression(NodeKind::ArrayAssignment) {}
 
-	NArrayAssignment(shared_ptr<NArrayIndex> arrayIndex, shared_ptr<NExpression> expr)
-		:arrayInx(arrayIndex), expr(expr){
+	NArrayAssignment(NArrayIndex* arrayIndex, NExpression* expr)
+		:NExpression(NodeKind::ArrayAssignment), arrayInx(arrayIndex), expr(expr){
 	}
 	
+	static bool classof(const Node* node) {
+		return node->kind == NodeKind::ArrayAssignment;
+	}
+
 	string getTypeName() const override {
 		return "NArrayAssignment";
 	}
@@ -782,26 +936,31 @@ public:
 	}
 	
 	void print(string prefix) const override {
-		string nPrefix = prefix + this->m_PREFIX;
-		cout << prefix << getTypeName() << this->m_COLON << endl;
+		string nPrefix = prefix + m_PREFIX;
+		cout << prefix << getTypeName() << m_COLON << endl;
 
 		arrayInx->print(nPrefix);
 		expr->print(nPrefix);
 	}
 #endif
-	llvm::Value *codeGen(CodeGenContext&) override;
+	llvm::Value *codeGen(CodeGenContext&);
+	void hash(ASTHasher& hasher) const override;
 
 };
 
 class NArrayInitialization : public NStatement {
 public:
 
-	shared_ptr<NVariableDeclaration> declaration;
-	shared_ptr<ExpressionList> expressionList = make_shared<ExpressionList>();
+	NodeRef<NVariableDeclaration> declaration = nullptr;
+	NodeRef<ExpressionList> expressionList = new ExpressionList();
 
-	NArrayInitialization(){}
-	NArrayInitialization(shared_ptr<NVariableDeclaration> decl, shared_ptr<ExpressionList> list)
-		:declaration(decl), expressionList(list) {
+	NArrayInitialization() : NStatement(NodeKind::ArrayInitialization) {}
+	NArrayInitialization(NVariableDeclaration* decl, ExpressionList* list)
+		:NStatement(NodeKind::ArrayInitialization), declaration(decl), expressionList(list) {
+	}
+
+	static bool classof(const Node* node) {
+		return node->kind == NodeKind::ArrayInitialization;
 	}
 
 	string getTypeName() const override {
@@ -820,8 +979,8 @@ public:
 	}
 	void print(string prefix) const override {
 
-		string nPrefix = prefix + this->m_PREFIX;
-		cout << prefix << getTypeName() << this->m_COLON << endl;
+		string nPrefix = prefix + m_PREFIX;
+		cout << prefix << getTypeName() << m_COLON << endl;
 
 		declaration->print(nPrefix);
 		for (auto expr = expressionList->begin(); expr != expressionList->end(); expr++)
@@ -830,19 +989,24 @@ public:
 	}
 #endif
 
-	llvm::Value *codeGen(CodeGenContext &context) override;
+	llvm::Value *codeGen(CodeGenContext &context);
+	void hash(ASTHasher& hasher) const override;
 
 };
 
 class NStructAssignment : public NExpression {
 public:
-	shared_ptr<NStructMember> structMember;
-	shared_ptr<NExpression> expression;
+	NodeRef<NStructMember> structMember = nullptr;
+	NodeRef<NExpression> expression = nullptr;
 
-	NStructAssignment(){}
+	NStructAssignment() : NExpression(NodeKind::StructAssignment) {}
 
-	NStructAssignment(shared_ptr<NStructMember> member, shared_ptr<NExpression> expr)
-		:structMember(member), expression(expr) {
+	NStructAssignment(NStructMember* member, NExpression* expr)
+		:NExpression(NodeKind::StructAssignment), structMember(member), expression(expr) {
+	}
+
+	static bool classof(const Node* node) {
+		return node->kind == NodeKind::StructAssignment;
 	}
 
 	string getTypeName() const override {
@@ -861,8 +1025,8 @@ public:
 	}
 
 	void print(string prefix) const override {
-		string nPrefix = prefix + this->m_PREFIX;
-		cout << prefix << getTypeName() << this->m_COLON << endl;
+		string nPrefix = prefix + m_PREFIX;
+		cout << prefix << getTypeName() << m_COLON << endl;
 
 		structMember->print(nPrefix);
 		expression->print(nPrefix);
@@ -872,18 +1036,23 @@ public:
 
 #endif
 
-	llvm::Value *codeGen(CodeGenContext&) override;
+	llvm::Value *codeGen(CodeGenContext&);
+	void hash(ASTHasher& hasher) const override;
 };
 
 
 class NLiteral : public NExpression {
 public:
-	string value;
+	llvm::StringRef value;
+
+	NLiteral() : NExpression(NodeKind::Literal) {}
 
-	NLiteral(){}
+	NLiteral(llvm::StringRef quoted) : NExpression(NodeKind::Literal) {
+		value = Arena::current().copyString(quoted.substr(1, quoted.size() - 2));
+	}
 
-	NLiteral(const string &str) {
-		value = str.substr(1, str.length() - 2);
+	static bool classof(const Node* node) {
+		return node->kind == NodeKind::Literal;
 	}
 
 	string getTypeName() const override {
@@ -892,17 +1061,61 @@ public:
 #ifdef PRINT_JOSONGEN
 	Json::Value jsonGen() const override {
 		Json::Value root;
-		root["name"] = getTypeName() + this->m_COLON + value;
+		root["name"] = getTypeName() + m_COLON + value.str();
 		return root;
 	}
 	void print(string prefix) const override {
-		cout << prefix << getTypeName() << this->m_COLON << value << endl;
+		cout << prefix << getTypeName() << m_COLON << value.str() << endl;
 	}
 
 #endif
 
-	llvm::Value *codeGen(CodeGenContext&) override;
+	llvm::Value *codeGen(CodeGenContext&);
+	void hash(ASTHasher& hasher) const override;
+
+};
+
+// A conversion the semantic analysis inserted, the target type is
+// resolvedType. op is the llvm::Instruction::CastOps, a splat broadcasts a
+// scalar of the vector's element type to every lane instead
+class NCast : public NExpression {
+public:
+	NodeRef<NExpression> expr = nullptr;
+	unsigned op = 0;
+	bool splat = false;
+
+	NCast() : NExpression(NodeKind::Cast) {}
+
+	NCast(NExpression* expr, NIdentifier* type, unsigned op, bool splat = false)
+		:NExpression(NodeKind::Cast), expr(expr), op(op), splat(splat) {
+		resolvedType = type;
+	}
+
+	static bool classof(const Node* node) {
+		return node->kind == NodeKind::Cast;
+	}
+
+	string getTypeName() const override {
+		return "NCast";
+	}
+
+#ifdef PRINT_JOSONGEN
+	Json::Value jsonGen() const override {
+		Json::Value root;
+		root["name"] = getTypeName() + m_COLON + resolvedType->name.str();
+		root["children"].append(expr->jsonGen());
+		return root;
+	}
+
+	void print(string prefix) const override {
+		string nPrefix = prefix + m_PREFIX;
+		cout << prefix << getTypeName() << m_COLON << resolvedType->name << endl;
+		expr->print(nPrefix);
+	}
+#endif
 
+	llvm::Value *codeGen(CodeGenContext&);
+	void hash(ASTHasher& hasher) const override;
 };
 
 std::unique_ptr<NExpression> LogError(const char* str);
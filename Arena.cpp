@@ -0,0 +1,94 @@
+#include "Arena.h"
+#include <llvm/Support/ErrorHandling.h>
+#include <stdlib.h>
+#include <mutex>
+
+thread_local Arena* Arena::currentArena = nullptr;
+// the slab of each number, number 0 is the null index and never used
+char* Arena::slabTable[Arena::MaxSlabs];
+
+// The slabs of released arenas are kept for the next ones, up to KeptSlabs
+// of them, the numbers of the slabs given back to malloc are reused
+static const size_t KeptSlabs = 64;
+static std::mutex slabLock;
+static std::vector<uint32_t> freeSlabs;
+static std::vector<uint32_t> freeNumbers;
+static uint32_t nextNumber = 1;
+
+uint32_t Arena::takeSlab(){
+    std::lock_guard<std::mutex> lock(slabLock);
+    if( !freeSlabs.empty() ){
+        uint32_t number = freeSlabs.back();
+        freeSlabs.pop_back();
+        return number;
+    }
+
+    uint32_t number;
+    if( !freeNumbers.empty() ){
+        number = freeNumbers.back();
+        freeNumbers.pop_back();
+    }else if( nextNumber < MaxSlabs ){
+        number = nextNumber++;
+    }else{
+        llvm::report_fatal_error("Out of AST arena slabs");
+    }
+    void* slab = nullptr;
+    if( posix_memalign(&slab, SlabSize, SlabSize) != 0 )
+        llvm::report_bad_alloc_error("Can't allocate an AST arena slab");
+    *static_cast<uint32_t*>(slab) = number;
+    slabTable[number] = static_cast<char*>(slab);
+    return number;
+}
+
+Arena::~Arena(){
+    release();
+}
+
+char* Arena::allocateSlow(size_t size, size_t alignment){
+    //Big lists get memory of their own, the current slab keeps serving the
+    //nodes
+    if( size + alignment > SlabSize / 4 ){
+        void* memory = nullptr;
+        if( posix_memalign(&memory, alignment < sizeof(void*) ? sizeof(void*) : alignment, size) != 0 )
+            llvm::report_bad_alloc_error("Can't allocate in the AST arena");
+        largeAllocations.push_back(memory);
+        return static_cast<char*>(memory);
+    }
+
+    uint32_t number = takeSlab();
+    slabs.push_back(number);
+    char* slab = slabTable[number];
+    char* start = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(slab + IndexScale) + alignment - 1) & ~(uintptr_t)(alignment - 1));
+    cursor = start + size;
+    limit = slab + SlabSize;
+    return start;
+}
+
+void Arena::release(){
+    for(auto memory: largeAllocations){
+        free(memory);
+    }
+    largeAllocations.clear();
+    if( !slabs.empty() ){
+        std::lock_guard<std::mutex> lock(slabLock);
+        for(auto number: slabs){
+            if( freeSlabs.size() < KeptSlabs ){
+                freeSlabs.push_back(number);
+            }else{
+                free(slabTable[number]);
+                slabTable[number] = nullptr;
+                freeNumbers.push_back(number);
+            }
+        }
+        slabs.clear();
+    }
+    cursor = limit = nullptr;
+    allocated = 0;
+}
+
+llvm::StringRef Arena::copyString(llvm::StringRef text) {
+    char* copy = static_cast<char*>(allocate(text.size() + 1, 1));
+    memcpy(copy, text.data(), text.size());
+    copy[text.size()] = '\0';
+    return llvm::StringRef(copy, text.size());
+}
@@ -0,0 +1,264 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Casting.h>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <vector>
+#include <stdint.h>
+
+// Bump pointer arena owning the AST of one compilation unit. Nothing in it is
+// freed or destroyed on its own, the memory goes away all at once with
+// release() or the arena, so what lives here must not need its destructor.
+//
+// The arena bumps through 1 MiB slabs that are numbered process wide, so
+// anything allocated in one is also named by a 32-bit index: the slab's
+// number and the offset in it, see NodeRef. Allocations bigger than a
+// quarter slab get memory of their own and have no index.
+class Arena{
+private:
+    char* cursor = nullptr;
+    char* limit = nullptr;
+    std::vector<uint32_t> slabs;
+    std::vector<void*> largeAllocations;
+    size_t allocated = 0;
+
+    static char* slabTable[];
+    static thread_local Arena* currentArena;
+
+    friend class ArenaScope;
+
+    char* allocateSlow(size_t size, size_t alignment);
+    static uint32_t takeSlab();
+
+public:
+    // granularity of the indices, ArenaObjects are aligned to it
+    static const size_t IndexScale = 8;
+    static const unsigned SlabBits = 20;
+    static const size_t SlabSize = size_t(1) << SlabBits;
+    static const unsigned OffsetBits = SlabBits - 3;
+    static const size_t MaxSlabs = size_t(1) << (32 - OffsetBits);
+
+    Arena(){}
+    ~Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t size, size_t alignment){
+        char* start = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(cursor) + alignment - 1) & ~(uintptr_t)(alignment - 1));
+        if( start + size > limit )
+            start = allocateSlow(size, alignment);
+        else
+            cursor = start + size;
+        allocated += size;
+        return start;
+    }
+
+    llvm::StringRef copyString(llvm::StringRef text);
+
+    size_t bytesAllocated() const{
+        return allocated;
+    }
+
+    void release();
+
+    // The arena `new` puts AST nodes in on this thread, see ArenaScope
+    static Arena& current(){
+        assert(currentArena && "No AST arena on this thread");
+        return *currentArena;
+    }
+
+    // A slab starts with its number, the slabs are aligned to their size
+    static uint32_t indexOf(const void* object){
+        if( !object )
+            return 0;
+        uintptr_t address = reinterpret_cast<uintptr_t>(object);
+        const char* slab = reinterpret_cast<const char*>(address & ~(uintptr_t)(SlabSize - 1));
+        uint32_t number = *reinterpret_cast<const uint32_t*>(slab);
+        assert(number && number < MaxSlabs && slabTable[number] == slab && address % IndexScale == 0 && "Not allocated in an arena slab");
+        return number << OffsetBits | static_cast<uint32_t>((address - reinterpret_cast<uintptr_t>(slab)) / IndexScale);
+    }
+
+    static void* objectAt(uint32_t index){
+        if( !index )
+            return nullptr;
+        return slabTable[index >> OffsetBits] + static_cast<size_t>(index & ((1u << OffsetBits) - 1)) * IndexScale;
+    }
+};
+
+// Makes arena the current one on this thread until the scope ends
+class ArenaScope{
+private:
+    Arena* previous;
+
+public:
+    explicit ArenaScope(Arena& arena): previous(Arena::currentArena){
+        Arena::currentArena = &arena;
+    }
+
+    ~ArenaScope(){
+        Arena::currentArena = previous;
+    }
+};
+
+// Base class of the AST nodes and lists, `new` allocates them in the
+// current arena and `delete` is a no-op
+class ArenaObject{
+public:
+    static void* operator new(size_t size){
+        return Arena::current().allocate(size, Arena::IndexScale);
+    }
+
+    static void operator delete(void*){
+    }
+};
+
+// 32-bit handle of a node (or node list) allocated in an arena, converts to
+// and from T* so the nodes read like they hold pointers. Half the size of a
+// pointer, and the same index wherever the node is looked at from, the
+// worker threads of the parallel code generator included.
+template<typename T>
+class NodeRef{
+private:
+    uint32_t index = 0;
+
+public:
+    NodeRef(){}
+    NodeRef(std::nullptr_t){}
+    NodeRef(T* object): index(Arena::indexOf(object)){}
+
+    T* get() const{
+        return static_cast<T*>(Arena::objectAt(index));
+    }
+
+    operator T*() const{
+        return get();
+    }
+
+    T* operator->() const{
+        return get();
+    }
+
+    T& operator*() const{
+        return *get();
+    }
+};
+
+namespace llvm{
+// lets isa<>/dyn_cast<> look through a NodeRef to the node
+template<typename T>
+struct simplify_type<NodeRef<T>>{
+    typedef T* SimpleType;
+    static SimpleType getSimplifiedValue(NodeRef<T>& ref){
+        return ref.get();
+    }
+};
+
+template<typename T>
+struct simplify_type<const NodeRef<T>>{
+    typedef T* SimpleType;
+    static SimpleType getSimplifiedValue(const NodeRef<T>& ref){
+        return ref.get();
+    }
+};
+}
+
+// Growable array of node references stored in the current arena. Outgrown
+// storage stays in the arena, the lists are only built by the parser and
+// the constant folder.
+template<typename T>
+class NodeList : public ArenaObject{
+private:
+    T* items = nullptr;
+    uint32_t count = 0;
+    uint32_t capacity = 0;
+
+public:
+    typedef T* iterator;
+    typedef const T* const_iterator;
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+    void push_back(T item){
+        if( count == capacity ){
+            uint32_t grown = capacity ? capacity * 2 : 4;
+            T* storage = static_cast<T*>(Arena::current().allocate(grown * sizeof(T), alignof(T)));
+            if( count )
+                memcpy(storage, items, count * sizeof(T));
+            items = storage;
+            capacity = grown;
+        }
+        items[count++] = item;
+    }
+
+    size_t size() const{
+        return count;
+    }
+
+    bool empty() const{
+        return count == 0;
+    }
+
+    T& operator[](size_t i){
+        return items[i];
+    }
+
+    const T& operator[](size_t i) const{
+        return items[i];
+    }
+
+    T& at(size_t i){
+        assert(i < count);
+        return items[i];
+    }
+
+    const T& at(size_t i) const{
+        assert(i < count);
+        return items[i];
+    }
+
+    T& front(){
+        return items[0];
+    }
+
+    T& back(){
+        return items[count - 1];
+    }
+
+    iterator begin(){
+        return items;
+    }
+
+    iterator end(){
+        return items + count;
+    }
+
+    const_iterator begin() const{
+        return items;
+    }
+
+    const_iterator end() const{
+        return items + count;
+    }
+
+    reverse_iterator rbegin(){
+        return reverse_iterator(end());
+    }
+
+    reverse_iterator rend(){
+        return reverse_iterator(begin());
+    }
+
+    const_reverse_iterator rbegin() const{
+        return const_reverse_iterator(end());
+    }
+
+    const_reverse_iterator rend() const{
+        return const_reverse_iterator(begin());
+    }
+};
+
+#endif
@@ -0,0 +1,337 @@
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Operator.h>
+
+#include <unordered_map>
+
+#include "Builtins.h"
+
+using namespace llvm;
+
+typedef Value* (*BuiltinEmitter)(const ExpressionList& args, CodeGenContext& context);
+
+class Builtin{
+public:
+    BuiltinEmitter emit;
+    // 0 for the variadic shuffle, it checks its arguments itself
+    size_t arity;
+};
+
+static Value* vectorArg(NExpression* arg, CodeGenContext& context){
+    Value* value = arg->codeGen(context);
+    if( value && !value->getType()->isVectorTy() )
+        return LogErrorV("Expected a vector argument, got " + TypeSystem::llvmTypeToStr(value));
+    return value;
+}
+
+static Value* laneArg(NExpression* arg, CodeGenContext& context){
+    Value* value = arg->codeGen(context);
+    if( value && !value->getType()->isIntegerTy() )
+        return LogErrorV("A lane index must be an integer");
+    return value ? context.builder.CreateSExtOrTrunc(value, Type::getInt32Ty(context.llvmContext)) : nullptr;
+}
+
+// <N x i1> out of a comparison result or any vector of N lanes
+static Value* maskArg(NExpression* arg, unsigned lanes, CodeGenContext& context){
+    Value* value = vectorArg(arg, context);
+    if( !value )
+        return nullptr;
+    auto vectorType = cast<FixedVectorType>(value->getType());
+    if( vectorType->getNumElements() != lanes )
+        return LogErrorV("The mask has " + std::to_string(vectorType->getNumElements()) + " lanes, expected " + std::to_string(lanes));
+    if( vectorType->getElementType()->isIntegerTy(1) )
+        return value;
+    Value* zero = Constant::getNullValue(vectorType);
+    if( vectorType->getElementType()->isFloatingPointTy() )
+        return context.builder.CreateFCmpONE(value, zero, "mask");
+    return context.builder.CreateICmpNE(value, zero, "mask");
+}
+
+// Pointer to the first element of an array argument, any number of
+// dimensions is indexed as one flat run of elements
+static Value* arrayArg(NExpression* arg, Type*& elementType, CodeGenContext& context){
+    auto array = dyn_cast<NIdentifier>(arg);
+    NVariableDeclaration* declaration = array ? array->declaration : nullptr;
+    if( !declaration || !declaration->type->isArray )
+        return LogErrorV("Expected an array argument");
+    elementType = declaration->elementType;
+    Value* base = array->codeGen(context);      // decays to the first row
+    if( !base )
+        return nullptr;
+    return context.builder.CreateBitCast(base, PointerType::get(elementType, 0));
+}
+
+static Value* int64Arg(NExpression* arg, CodeGenContext& context){
+    Value* value = arg->codeGen(context);
+    if( value && !value->getType()->isIntegerTy() )
+        return LogErrorV("Expected an integer argument");
+    return value ? context.builder.CreateSExtOrTrunc(value, Type::getInt64Ty(context.llvmContext)) : nullptr;
+}
+
+// &array[index] as a pointer to vectorType, the array has to hold the
+// vector's elements
+static Value* vectorPtr(NExpression* array, NExpression* indexArg, FixedVectorType* vectorType, CodeGenContext& context){
+    Type* elementType;
+    Value* base = arrayArg(array, elementType, context);
+    Value* index = int64Arg(indexArg, context);
+    if( !base || !index )
+        return nullptr;
+    if( elementType != vectorType->getElementType() )
+        return LogErrorV("The array elements don't match the vector lanes");
+    Value* elementPtr = context.builder.CreateInBoundsGEP(elementType, base, index, "elementPtr");
+    return context.builder.CreateBitCast(elementPtr, PointerType::get(vectorType, 0), "vectorPtr");
+}
+
+static Align elementAlign(FixedVectorType* vectorType, CodeGenContext& context){
+    return context.theModule->getDataLayout().getABITypeAlign(vectorType->getElementType());
+}
+
+static Value* emitExtract(const ExpressionList& args, CodeGenContext& context){
+    Value* vector = vectorArg(args[0], context);
+    Value* lane = laneArg(args[1], context);
+    if( !vector || !lane )
+        return nullptr;
+    return context.builder.CreateExtractElement(vector, lane, "extract");
+}
+
+static Value* emitInsert(const ExpressionList& args, CodeGenContext& context){
+    Value* vector = vectorArg(args[0], context);
+    Value* lane = laneArg(args[1], context);
+    Value* value = args[2]->codeGen(context);
+    if( !vector || !lane || !value )
+        return nullptr;
+    if( value->getType() != vector->getType()->getScalarType() )
+        return LogErrorV("The inserted value doesn't match the vector lanes");
+    return context.builder.CreateInsertElement(vector, value, lane, "insert");
+}
+
+static Value* emitShuffle(const ExpressionList& args, CodeGenContext& context){
+    if( args.size() < 2 )
+        return LogErrorV("shuffle takes a vector and the lane indices");
+    Value* first = vectorArg(args[0], context);
+    if( !first )
+        return nullptr;
+
+    size_t firstIndex = 1;
+    Value* second = nullptr;
+    if( !isa<NInteger>(args[1]) ){
+        second = vectorArg(args[1], context);
+        if( !second )
+            return nullptr;
+        if( second->getType() != first->getType() )
+            return LogErrorV("Both shuffle operands must have the same vector type");
+        firstIndex = 2;
+    }
+
+    unsigned lanes = cast<FixedVectorType>(first->getType())->getNumElements();
+    unsigned sources = second ? 2 * lanes : lanes;
+    SmallVector<int, 16> mask;
+    for(size_t i=firstIndex; i<args.size(); i++){
+        auto index = dyn_cast<NInteger>(args[i]);
+        if( !index )
+            return LogErrorV("shuffle lane indices must be integer constants");
+        if( index->value >= sources )
+            return LogErrorV("shuffle lane index " + std::to_string(index->value) + " out of range");
+        mask.push_back(static_cast<int>(index->value));
+    }
+    if( mask.empty() )
+        return LogErrorV("shuffle takes at least one lane index");
+
+    if( !second )
+        return context.builder.CreateShuffleVector(first, mask, "shuffle");
+    return context.builder.CreateShuffleVector(first, second, mask, "shuffle");
+}
+
+// fp reductions may be reassociated into a tree, the lanes have no order
+static Value* reassociable(Value* reduction){
+    FastMathFlags flags;
+    flags.setAllowReassoc();
+    cast<Instruction>(reduction)->setFastMathFlags(flags);
+    return reduction;
+}
+
+static Value* emitReduceAdd(const ExpressionList& args, CodeGenContext& context){
+    Value* vector = vectorArg(args[0], context);
+    if( !vector )
+        return nullptr;
+    Type* elementType = vector->getType()->getScalarType();
+    if( elementType->isFloatingPointTy() )
+        return reassociable(context.builder.CreateFAddReduce(ConstantFP::getNegativeZero(elementType), vector));
+    return context.builder.CreateAddReduce(vector);
+}
+
+static Value* emitReduceMul(const ExpressionList& args, CodeGenContext& context){
+    Value* vector = vectorArg(args[0], context);
+    if( !vector )
+        return nullptr;
+    Type* elementType = vector->getType()->getScalarType();
+    if( elementType->isFloatingPointTy() )
+        return reassociable(context.builder.CreateFMulReduce(ConstantFP::get(elementType, 1.0), vector));
+    return context.builder.CreateMulReduce(vector);
+}
+
+static Value* emitReduceMin(const ExpressionList& args, CodeGenContext& context){
+    Value* vector = vectorArg(args[0], context);
+    if( !vector )
+        return nullptr;
+    if( vector->getType()->getScalarType()->isFloatingPointTy() )
+        return context.builder.CreateFPMinReduce(vector);
+    return context.builder.CreateIntMinReduce(vector, true);
+}
+
+static Value* emitReduceMax(const ExpressionList& args, CodeGenContext& context){
+    Value* vector = vectorArg(args[0], context);
+    if( !vector )
+        return nullptr;
+    if( vector->getType()->getScalarType()->isFloatingPointTy() )
+        return context.builder.CreateFPMaxReduce(vector);
+    return context.builder.CreateIntMaxReduce(vector, true);
+}
+
+static Value* emitMaskedLoad(const ExpressionList& args, CodeGenContext& context){
+    // the passthru decides the vector type
+    Value* passThru = vectorArg(args[3], context);
+    if( !passThru )
+        return nullptr;
+    auto vectorType = cast<FixedVectorType>(passThru->getType());
+    Value* ptr = vectorPtr(args[0], args[1], vectorType, context);
+    Value* mask = maskArg(args[2], vectorType->getNumElements(), context);
+    if( !ptr || !mask )
+        return nullptr;
+    return context.builder.CreateMaskedLoad(vectorType, ptr, elementAlign(vectorType, context), mask, passThru, "maskedLoad");
+}
+
+static Value* emitMaskedStore(const ExpressionList& args, CodeGenContext& context){
+    Value* value = vectorArg(args[2], context);
+    if( !value )
+        return nullptr;
+    auto vectorType = cast<FixedVectorType>(value->getType());
+    Value* ptr = vectorPtr(args[0], args[1], vectorType, context);
+    Value* mask = maskArg(args[3], vectorType->getNumElements(), context);
+    if( !ptr || !mask )
+        return nullptr;
+    return context.builder.CreateMaskedStore(value, ptr, elementAlign(vectorType, context), mask);
+}
+
+// count elements of a run of array elements in bytes
+static Value* byteCount(Value* count, Type* elementType, CodeGenContext& context){
+    uint64_t size = context.theModule->getDataLayout().getTypeAllocSize(elementType);
+    return context.builder.CreateMul(count, ConstantInt::get(count->getType(), size), "bytes");
+}
+
+static Value* emitCopy(const ExpressionList& args, CodeGenContext& context){
+    Type* dstType;
+    Type* srcType;
+    Value* dst = arrayArg(args[0], dstType, context);
+    Value* src = arrayArg(args[1], srcType, context);
+    Value* count = int64Arg(args[2], context);
+    if( !dst || !src || !count )
+        return nullptr;
+    if( dstType != srcType )
+        return LogErrorV("copy between arrays of different element types");
+    Align align = context.theModule->getDataLayout().getABITypeAlign(dstType);
+    return context.builder.CreateMemCpy(dst, align, src, align, byteCount(count, dstType, context));
+}
+
+static Value* emitFill(const ExpressionList& args, CodeGenContext& context){
+    Type* elementType;
+    Value* base = arrayArg(args[0], elementType, context);
+    Value* value = args[1]->codeGen(context);
+    Value* count = int64Arg(args[2], context);
+    if( !base || !value || !count )
+        return nullptr;
+    if( value->getType() != elementType )
+        return LogErrorV("The fill value doesn't match the array elements");
+
+    Align align = context.theModule->getDataLayout().getABITypeAlign(elementType);
+    auto constant = dyn_cast<Constant>(value);
+    if( elementType->isIntegerTy(8) || (constant && constant->isNullValue()) ){
+        Value* byte = elementType->isIntegerTy(8) ? value : context.builder.getInt8(0);
+        return context.builder.CreateMemSet(base, byte, byteCount(count, elementType, context), MaybeAlign(align));
+    }
+
+    // any other pattern is stored by a loop, the vectorizer takes it from there
+    LLVMContext& llvmContext = context.llvmContext;
+    Function* function = context.builder.GetInsertBlock()->getParent();
+    BasicBlock* entry = context.builder.GetInsertBlock();
+    BasicBlock* loop = BasicBlock::Create(llvmContext, "fill.loop", function);
+    BasicBlock* after = BasicBlock::Create(llvmContext, "fill.end", function);
+    Value* zero = ConstantInt::get(count->getType(), 0);
+    context.builder.CreateCondBr(context.builder.CreateICmpSGT(count, zero), loop, after);
+
+    context.builder.SetInsertPoint(loop);
+    PHINode* i = context.builder.CreatePHI(count->getType(), 2, "i");
+    i->addIncoming(zero, entry);
+    context.builder.CreateAlignedStore(value, context.builder.CreateInBoundsGEP(elementType, base, i), align);
+    Value* next = context.builder.CreateNSWAdd(i, ConstantInt::get(count->getType(), 1), "i.next");
+    i->addIncoming(next, loop);
+    context.builder.CreateCondBr(context.builder.CreateICmpSLT(next, count), loop, after);
+
+    context.builder.SetInsertPoint(after);
+    return nullptr;
+}
+
+static const std::unordered_map<Symbol, Builtin>& builtins(){
+    static const std::unordered_map<Symbol, Builtin> table = {
+        { Symbol("extract"), { emitExtract, 2 } },
+        { Symbol("insert"), { emitInsert, 3 } },
+        { Symbol("shuffle"), { emitShuffle, 0 } },
+        { Symbol("reduce_add"), { emitReduceAdd, 1 } },
+        { Symbol("reduce_mul"), { emitReduceMul, 1 } },
+        { Symbol("reduce_min"), { emitReduceMin, 1 } },
+        { Symbol("reduce_max"), { emitReduceMax, 1 } },
+        { Symbol("masked_load"), { emitMaskedLoad, 4 } },
+        { Symbol("masked_store"), { emitMaskedStore, 4 } },
+        { Symbol("copy"), { emitCopy, 3 } },
+        { Symbol("fill"), { emitFill, 3 } },
+    };
+    return table;
+}
+
+bool isBuiltin(Symbol name){
+    return builtins().count(name) != 0;
+}
+
+Value* emitBuiltin(const NMethodCall& call, CodeGenContext& context){
+    auto& builtin = builtins().at(call.id->name);
+    if( builtin.arity && call.arguments->size() != builtin.arity ){
+        return LogErrorV(call.id->name.str() + " takes " + std::to_string(builtin.arity) + " arguments");
+    }
+    return builtin.emit(*call.arguments, context);
+}
+
+static const std::unordered_map<Symbol, RuntimeFunction>& runtimeFunctions(){
+    static const std::unordered_map<Symbol, RuntimeFunction> table = {
+        { Symbol("print_int"), { "dude_print_int", "void", { "int" } } },
+        { Symbol("print_double"), { "dude_print_double", "void", { "double" } } },
+        { Symbol("print_char"), { "dude_print_char", "void", { "char" } } },
+        { Symbol("print_string"), { "dude_print_string", "void", { "string" } } },
+        { Symbol("flush"), { "dude_flush", "void", {} } },
+        { Symbol("read_int"), { "dude_read_int", "int", {} } },
+        { Symbol("read_double"), { "dude_read_double", "double", {} } },
+        { Symbol("alloc"), { "dude_alloc", "string", { "int" } } },
+        { Symbol("arena_reset"), { "dude_arena_reset", "void", {} } },
+    };
+    return table;
+}
+
+const RuntimeFunction* findRuntimeFunction(Symbol name){
+    auto found = runtimeFunctions().find(name);
+    return found == runtimeFunctions().end() ? nullptr : &found->second;
+}
+
+Function* declareRuntimeFunction(Symbol name, CodeGenContext& context){
+    auto found = findRuntimeFunction(name);
+    if( !found )
+        return nullptr;
+    auto& runtime = *found;
+
+    std::vector<Type*> argTypes;
+    for(auto argType: runtime.argTypes){
+        argTypes.push_back(context.typeSystem.getVarType(Symbol(argType)));
+    }
+    Type* returnType = context.typeSystem.getVarType(Symbol(runtime.returnType));
+    FunctionType* functionType = FunctionType::get(returnType, argTypes, false);
+    auto callee = context.theModule->getOrInsertFunction(runtime.symbol, functionType);
+    return dyn_cast<Function>(callee.getCallee());
+}
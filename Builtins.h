@@ -0,0 +1,43 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+#include "ASTNodes.h"
+#include "CodeGen.h"
+
+// The SIMD intrinsics, called like functions:
+//   extract(v, i)                        lane i of v
+//   insert(v, i, x)                      v with lane i replaced by x
+//   shuffle(a, b, i0, i1, ...)           lanes of a and b picked by constant indices,
+//   shuffle(a, i0, i1, ...)              b's lanes are numbered after a's
+//   reduce_add(v) reduce_mul(v)          horizontal reductions
+//   reduce_min(v) reduce_max(v)
+//   masked_load(array, i, mask, passthru)  the lanes array[i..] where mask is set,
+//                                          passthru elsewhere
+//   masked_store(array, i, v, mask)
+//   copy(dst, src, n)                    memcpy of n array elements
+//   fill(array, x, n)                    the first n array elements set to x
+// A mask is a vector comparison or any vector, non-zero lanes are set.
+// Arrays of several dimensions count their elements row by row.
+// A function of the program with the same name takes precedence.
+bool isBuiltin(Symbol name);
+
+llvm::Value* emitBuiltin(const NMethodCall& call, CodeGenContext& context);
+
+// The runtime library functions (runtime/Runtime.h) the programs call
+// without an extern declaration: print_int, print_double, print_char,
+// print_string, flush, read_int, read_double, alloc and arena_reset.
+// Their signatures are in the language's type names.
+class RuntimeFunction{
+public:
+    const char* symbol;
+    const char* returnType;
+    std::vector<const char*> argTypes;
+};
+
+// nullptr if name is none of them
+const RuntimeFunction* findRuntimeFunction(Symbol name);
+
+// Declared on first use, nullptr if name is none of them.
+llvm::Function* declareRuntimeFunction(Symbol name, CodeGenContext& context);
+
+#endif //BUILTINS_H
@@ -0,0 +1,146 @@
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/SHA1.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <map>
+#include <mutex>
+
+#include "Cache.h"
+#include "ObjGen.h"
+
+using namespace llvm;
+
+CompileCache::CompileCache(const std::string& cacheDir): cacheDir(cacheDir){
+    if( !enabled() )
+        return;
+    if( auto error = sys::fs::create_directories(cacheDir) ){
+        errs() << "Cache disabled, could not create " << cacheDir << ": " << error.message() << "\n";
+        this->cacheDir.clear();
+    }
+}
+
+std::string CompileCache::entryPath(const std::string& key, const char* extension) const{
+    SmallString<128> path(cacheDir);
+    sys::path::append(path, key + extension);
+    return path.str().str();
+}
+
+static void addField(SHA1& hasher, StringRef field){
+    // length prefixed, so two different field lists never hash the same text
+    uint64_t size = field.size();
+    hasher.update(StringRef((const char*)&size, sizeof(size)));
+    hasher.update(field);
+}
+
+static std::string fileStamp(const sys::fs::file_status& status){
+    return std::to_string(status.getSize()) + ":" + std::to_string(status.getLastModificationTime().time_since_epoch().count());
+}
+
+// Size and mtime of the compiler executable, a rebuild changes them even if
+// the tree was edited under the same commit
+static const std::string& buildId(){
+    static const std::string id = [](){
+        std::string path = sys::fs::getMainExecutable(nullptr, (void*)&buildId);
+        sys::fs::file_status status;
+        if( path.empty() || sys::fs::status(path, status) )
+            return std::string();
+        return fileStamp(status);
+    }();
+    return id;
+}
+
+// Hash of the runtime bitcode, it is inlined into the objects at -O2. Kept
+// per path while the file's size and mtime don't change
+static std::string runtimeHash(const std::string& path){
+    static std::mutex mutex;
+    static std::map<std::string, std::pair<std::string, std::string>> hashes;
+
+    sys::fs::file_status status;
+    if( sys::fs::status(path, status) )
+        return "missing";
+    std::string stamp = fileStamp(status);
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& entry = hashes[path];
+    if( entry.first != stamp ){
+        auto buffer = MemoryBuffer::getFile(path);
+        if( !buffer )
+            return "unreadable";
+        entry.first = stamp;
+        entry.second = toHex(SHA1::hash(arrayRefFromStringRef((*buffer)->getBuffer())), true);
+    }
+    return entry.second;
+}
+
+std::string CompileCache::makeKey(StringRef source, const CompilerOptions& options){
+    SHA1 hasher;
+    addField(hasher, COMPILER_VERSION);
+    addField(hasher, buildId());
+    addField(hasher, LLVM_VERSION_STRING);
+    addField(hasher, sys::getDefaultTargetTriple());
+    addField(hasher, getTargetCPU(options));
+    addField(hasher, getTargetFeatures(options));
+    addField(hasher, options.relocModel);
+    addField(hasher, std::to_string(options.optLevel));
+    addField(hasher, options.optLevel >= 2 ? runtimeHash(options.runtimeBitcode) : "");
+    addField(hasher, source);
+    return toHex(hasher.result(), true);
+}
+
+bool CompileCache::fetch(const std::string& key, const std::string& outputFile) const{
+    if( !enabled() )
+        return false;
+    std::string entry = entryPath(key);
+    if( !sys::fs::exists(entry) )
+        return false;
+    return !sys::fs::copy_file(entry, outputFile);
+}
+
+void CompileCache::store(const std::string& key, const std::string& objectFile) const{
+    if( !enabled() )
+        return;
+
+    // copy to a unique temporary next to the entry and rename it into place,
+    // so a reader never sees a partially written object
+    SmallString<128> tempPath;
+    int tempFD;
+    if( sys::fs::createUniqueFile(entryPath(key) + ".tmp-%%%%%%", tempFD, tempPath) )
+        return;
+    sys::fs::closeFile(tempFD);
+
+    if( sys::fs::copy_file(objectFile, tempPath) || sys::fs::rename(tempPath, entryPath(key)) ){
+        errs() << "Could not write cache entry " << entryPath(key) << "\n";
+        sys::fs::remove(tempPath);
+    }
+}
+
+std::unique_ptr<MemoryBuffer> CompileCache::load(const std::string& key, const char* extension) const{
+    if( !enabled() )
+        return nullptr;
+    auto buffer = MemoryBuffer::getFile(entryPath(key, extension));
+    if( !buffer )
+        return nullptr;
+    return std::move(*buffer);
+}
+
+void CompileCache::save(const std::string& key, const char* extension, StringRef data) const{
+    if( !enabled() )
+        return;
+
+    SmallString<128> tempPath;
+    int tempFD;
+    if( sys::fs::createUniqueFile(entryPath(key, extension) + ".tmp-%%%%%%", tempFD, tempPath) )
+        return;
+    {
+        raw_fd_ostream out(tempFD, true);
+        out << data;
+    }
+    if( sys::fs::rename(tempPath, entryPath(key, extension)) ){
+        errs() << "Could not write cache entry " << entryPath(key, extension) << "\n";
+        sys::fs::remove(tempPath);
+    }
+}
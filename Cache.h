@@ -0,0 +1,40 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <memory>
+#include <string>
+#include "Options.h"
+
+// On-disk cache of compiled objects. An entry is keyed by the hash of the
+// source text, the compiler version and build, the target triple, the
+// resolved CPU and features, the options that change the generated code and
+// the content of the runtime bitcode inlined at -O2.
+class CompileCache{
+private:
+    std::string cacheDir;
+
+    std::string entryPath(const std::string& key, const char* extension = ".o") const;
+
+public:
+    CompileCache(const std::string& cacheDir);
+
+    bool enabled() const{
+        return !cacheDir.empty();
+    }
+
+    static std::string makeKey(llvm::StringRef source, const CompilerOptions& options);
+
+    // Copy the cached object to outputFile, returns false on a miss
+    bool fetch(const std::string& key, const std::string& outputFile) const;
+    // Add objectFile to the cache, concurrent writers of the same key are fine
+    void store(const std::string& key, const std::string& objectFile) const;
+
+    // In-memory entries such as the per-function bitcode, load returns
+    // nullptr on a miss
+    std::unique_ptr<llvm::MemoryBuffer> load(const std::string& key, const char* extension) const;
+    void save(const std::string& key, const char* extension, llvm::StringRef data) const;
+};
+
+#endif //CACHE_H
@@ -1,17 +1,16 @@
 #include <llvm/IR/Value.h>
-#include <llvm/IR/LegacyPassManager.h>
-#include <llvm/IR/IRPrintingPasses.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/Module.h>
 #include <limits.h>
 #include <memory.h>
+#include <atomic>
 #include "CodeGen.h"
 #include "ASTNodes.h"
 #include "TypeSystem.h"
+#include "Builtins.h"
 //#define DISPLAY_PARSE_PROCESS
-using legacy::PassManager;
 
 #define ISTYPE(value, id) (value->getType()->getTypeID() == id)
 
@@ -23,8 +22,7 @@ static Type* TypeOf(const NIdentifier & type, CodeGenContext& context){        /
 static Value* CastToBoolean(CodeGenContext& context, Value* condValue){
 
     if( ISTYPE(condValue, Type::IntegerTyID) ){
-        condValue = context.builder.CreateIntCast(condValue, Type::getInt1Ty(context.llvmContext), true);
-        return context.builder.CreateICmpNE(condValue, ConstantInt::get(Type::getInt1Ty(context.llvmContext), 0, true));
+        return context.builder.CreateICmpNE(condValue, ConstantInt::get(condValue->getType(), 0, true));
     }else if( ISTYPE(condValue, Type::DoubleTyID) ){
         return context.builder.CreateFCmpONE(condValue, ConstantFP::get(context.llvmContext, APFloat(0.0)));
     }else{
@@ -32,20 +30,31 @@ static Value* CastToBoolean(CodeGenContext& context, Value* condValue){
     }
 }
 
-static llvm::Value* calcArrayIndex(shared_ptr<NArrayIndex> index, CodeGenContext &context){
-    auto sizeVec = context.getArraySize(index->arrayName->name);
-#ifdef DISPLAY_PARSE_PROCESS
-    std::cout << "sizeVec:" << sizeVec.size() << ", expressions: " << index->expressions->size() << std::endl;
-#endif
-    assert(sizeVec.size() > 0 && sizeVec.size() == index->expressions->size());
-    auto expression = *(index->expressions->rbegin());
-
-    for(unsigned int i=sizeVec.size()-1; i>=1; i--){
-        auto temp = make_shared<NBinaryOperator>(make_shared<NInteger>(sizeVec[i]), TMUL, index->expressions->at(i-1));
-        expression = make_shared<NBinaryOperator>(temp, TPLUS, expression);
+// Address of an array element. A local array is indexed through its nested
+// array type with a leading 0, an array argument through the pointer to its
+// first row.
+static Value* arrayElementPtr(NArrayIndex* index, CodeGenContext &context){
+    NVariableDeclaration* declaration = index->arrayId->declaration;
+    if( !declaration || !declaration->address ){
+        return LogErrorV("Unknown variable name " + index->arrayId->name.str());
+    }
+    if( !declaration->type->isArray ){
+        return LogErrorV("The variable is not array");
     }
 
-    return expression->codeGen(context);
+    Type* indexTy = Type::getInt64Ty(context.llvmContext);
+    std::vector<Value*> indices;
+    Value* varPtr = declaration->address;
+    if( declaration->isFuncArg ){
+        varPtr = context.builder.CreateLoad(declaration->addressType, varPtr, "actualArrayPtr");
+    }else{
+        indices.push_back(ConstantInt::get(indexTy, 0));
+    }
+    for(auto subscript: *index->expressions){
+        Value* value = subscript->codeGen(context);
+        indices.push_back(context.builder.CreateIntCast(value, indexTy, true, "subscript"));
+    }
+    return context.builder.CreateInBoundsGEP(declaration->indexedType, varPtr, indices, "elementPtr");
 }
 
 void CodeGenContext::generateCode(NBlock& root) {
@@ -58,32 +67,98 @@ void CodeGenContext::generateCode(NBlock& root) {
     pushBlock(block);
     Value* retValue = root.codeGen(*this);
     popBlock();
+    return;
+}
 
+void CodeGenContext::generateUnit(NBlock& root, const std::vector<NFunctionDeclaration*>& bodies) {
 
-    PassManager passManager;
-    passManager.add(createPrintModulePass(outs()));
-    passManager.run(*(this->theModule.get()));
-    return;
+    BasicBlock* block = BasicBlock::Create(this->llvmContext, "entry");
+
+    pushBlock(block);
+    // every struct type and a prototype of every function first, so the
+    // bodies can refer to them no matter where they are defined
+    for(auto& statement: *root.statements){
+        if( !isa<NFunctionDeclaration>(statement) )
+            statement->codeGen(*this);
+    }
+    for(auto& statement: *root.statements){
+        if( auto function = dyn_cast<NFunctionDeclaration>(statement) )
+            function->codeGenPrototype(*this);
+    }
+    for(auto body: bodies){
+        body->codeGen(*this);
+    }
+    popBlock();
+    delete block;
+}
+
+llvm::Value* Node::codeGen(CodeGenContext &context) {
+    switch( this->kind ){
+        case NodeKind::ExpressionStatement:
+            return static_cast<NExpressionStatement*>(this)->codeGen(context);
+        case NodeKind::VariableDeclaration:
+            return static_cast<NVariableDeclaration*>(this)->codeGen(context);
+        case NodeKind::FunctionDeclaration:
+            return static_cast<NFunctionDeclaration*>(this)->codeGen(context);
+        case NodeKind::StructDeclaration:
+            return static_cast<NStructDeclaration*>(this)->codeGen(context);
+        case NodeKind::ReturnStatement:
+            return static_cast<NReturnStatement*>(this)->codeGen(context);
+        case NodeKind::IfStatement:
+            return static_cast<NIfStatement*>(this)->codeGen(context);
+        case NodeKind::ForStatement:
+            return static_cast<NForStatement*>(this)->codeGen(context);
+        case NodeKind::ArrayInitialization:
+            return static_cast<NArrayInitialization*>(this)->codeGen(context);
+        case NodeKind::Double:
+            return static_cast<NDouble*>(this)->codeGen(context);
+        case NodeKind::Integer:
+            return static_cast<NInteger*>(this)->codeGen(context);
+        case NodeKind::Identifier:
+            return static_cast<NIdentifier*>(this)->codeGen(context);
+        case NodeKind::MethodCall:
+            return static_cast<NMethodCall*>(this)->codeGen(context);
+        case NodeKind::BinaryOperator:
+            return static_cast<NBinaryOperator*>(this)->codeGen(context);
+        case NodeKind::Assignment:
+            return static_cast<NAssignment*>(this)->codeGen(context);
+        case NodeKind::Block:
+            return static_cast<NBlock*>(this)->codeGen(context);
+        case NodeKind::StructMember:
+            return static_cast<NStructMember*>(this)->codeGen(context);
+        case NodeKind::ArrayIndex:
+            return static_cast<NArrayIndex*>(this)->codeGen(context);
+        case NodeKind::ArrayAssignment:
+            return static_cast<NArrayAssignment*>(this)->codeGen(context);
+        case NodeKind::StructAssignment:
+            return static_cast<NStructAssignment*>(this)->codeGen(context);
+        case NodeKind::Literal:
+            return static_cast<NLiteral*>(this)->codeGen(context);
+        case NodeKind::Cast:
+            return static_cast<NCast*>(this)->codeGen(context);
+    }
+    return nullptr;
 }
 
 llvm::Value* NAssignment::codeGen(CodeGenContext &context) {
 #ifdef DISPLAY_PARSE_PROCESS
     std::cout << "Generating assignment of " << this->lchild->name << " = " << std::endl;
 #endif
-    Value* dst = context.getSymbolValue(this->lchild->name);
-    auto dstType = context.getSymbolType(this->lchild->name);
-    string dstTypeStr = dstType->name;
-    if( !dst ){
+    NVariableDeclaration* declaration = this->lchild->declaration;
+    if( !declaration || !declaration->address ){
         return LogErrorV("Undeclared variable");
     }
-    Value* exp = exp = this->rchild->codeGen(context);
+    Value* exp = this->rchild->codeGen(context);
+    if( !exp ){
+        return nullptr;
+    }
 #ifdef DISPLAY_PARSE_PROCESS
-    std::cout << "dst typeid = " << TypeSystem::llvmTypeToStr(context.typeSystem.getVarType(dstTypeStr)) << std::endl;
+    std::cout << "dst typeid = " << TypeSystem::llvmTypeToStr(declaration->addressType) << std::endl;
     std::cout << "exp typeid = " << TypeSystem::llvmTypeToStr(exp) << std::endl;
 #endif
-    exp = context.typeSystem.cast(exp, context.typeSystem.getVarType(dstTypeStr), context.currentBlock());
-    context.builder.CreateStore(exp, dst);
-    return dst;
+    // the semantic analysis cast the value to the variable's type
+    context.builder.CreateStore(exp, declaration->address);
+    return declaration->address;
 }
 
 llvm::Value* NBinaryOperator::codeGen(CodeGenContext &context) {
@@ -92,21 +167,13 @@ llvm::Value* NBinaryOperator::codeGen(CodeGenContext &context) {
 #endif
     Value* L = this->lchild->codeGen(context);
     Value* R = this->rchild->codeGen(context);
-    bool fp = false;
-
-    if( (L->getType()->getTypeID() == Type::DoubleTyID) || (R->getType()->getTypeID() == Type::DoubleTyID) ){  // type upgrade
-        fp = true;
-        if( (R->getType()->getTypeID() != Type::DoubleTyID) ){
-            R = context.builder.CreateUIToFP(R, Type::getDoubleTy(context.llvmContext), "ftmp");
-        }
-        if( (L->getType()->getTypeID() != Type::DoubleTyID) ){
-            L = context.builder.CreateUIToFP(L, Type::getDoubleTy(context.llvmContext), "ftmp");
-        }
-    }
 
     if( !L || !R ){
         return nullptr;
     }
+
+    // the semantic analysis cast both operands to their common type
+    bool fp = L->getType()->getScalarType()->isFloatingPointTy();
 #ifdef DISPLAY_PARSE_PROCESS
     std::cout << "fp = " << ( fp ? "true" : "false" ) << std::endl;
     std::cout << "L is " << TypeSystem::llvmTypeToStr(L) << std::endl;
@@ -165,35 +232,35 @@ llvm::Value* NInteger::codeGen(CodeGenContext &context) {
 #ifdef DISPLAY_PARSE_PROCESS
     std::cout << "Generating Integer: " << this->value << std::endl;
 #endif
-    return ConstantInt::get(Type::getInt32Ty(context.llvmContext), this->value, true);
+    // a folded bool or char keeps the width of its type
+    Type* type = this->resolvedType ? context.typeSystem.getVarType(*this->resolvedType) : Type::getInt32Ty(context.llvmContext);
+    return ConstantInt::get(type, this->value, true);
 }
 
 llvm::Value* NDouble::codeGen(CodeGenContext &context) {
 #ifdef DISPLAY_PARSE_PROCESS
     std::cout << "Generating Double: " << this->value << std::endl;
 #endif
-    return ConstantFP::get(Type::getDoubleTy(context.llvmContext), this->value);
+    Type* type = this->resolvedType ? context.typeSystem.getVarType(*this->resolvedType) : Type::getDoubleTy(context.llvmContext);
+    return ConstantFP::get(type, this->value);
 }
 
 llvm::Value* NIdentifier::codeGen(CodeGenContext &context) {
 #ifdef DISPLAY_PARSE_PROCESS
     std::cout << "Generating identifier " << this->name << std::endl;
 #endif
-    Value* value = context.getSymbolValue(this->name);
-    if( !value ){
-        return LogErrorV("Unknown variable name " + this->name);
-    }
-    if( value->getType()->isPointerTy() ){
-        auto arrayPtr = context.builder.CreateLoad(value, "arrayPtr");
-        if( arrayPtr->getType()->isArrayTy() ){
-            std::cout << "(Array Type)" << std::endl;
-            std::vector<Value*> indices;
-            indices.push_back(ConstantInt::get(context.typeSystem.intTy, 0, false));
-            auto ptr = context.builder.CreateInBoundsGEP(value, indices, "arrayPtr");
-            return ptr;
-        }
+    NVariableDeclaration* declaration = this->declaration;
+    if( !declaration || !declaration->address ){
+        return LogErrorV("Unknown variable name " + this->name.str());
+    }
+    if( declaration->type->isArray && !declaration->isFuncArg ){
+        // a local array decays to a pointer to its first row, an array
+        // argument already is one
+        Value* zero = ConstantInt::get(Type::getInt64Ty(context.llvmContext), 0);
+        Value* indices[] = { zero, zero };
+        return context.builder.CreateInBoundsGEP(declaration->addressType, declaration->address, indices, "arrayPtr");
     }
-    return context.builder.CreateLoad(value, false, "");
+    return context.builder.CreateLoad(declaration->addressType, declaration->address, false, "");
 
 }
 
@@ -201,27 +268,28 @@ llvm::Value* NExpressionStatement::codeGen(CodeGenContext &context) {
     return this->expr->codeGen(context);
 }
 
-llvm::Value* NFunctionDeclaration::codeGen(CodeGenContext &context) {
-#ifdef DISPLAY_PARSE_PROCESS
-    std::cout << "Generating function declaration of " << this->id->name << std::endl;
-#endif
+llvm::Function* NFunctionDeclaration::codeGenPrototype(CodeGenContext &context) {
     std::vector<Type*> argTypes;
 
     for(auto &arg: *this->arguments){
-        if( arg->type->isArray ){
-            argTypes.push_back(PointerType::get(context.typeSystem.getVarType(arg->type->name), 0));
-        } else{
-            argTypes.push_back(TypeOf(*arg->type, context));
-        }
+        argTypes.push_back(TypeOf(*arg->type, context));
     }
-    Type* retType = nullptr;
-    if( this->type->isArray )
-        retType = PointerType::get(context.typeSystem.getVarType(this->type->name), 0);
-    else
-        retType = TypeOf(*this->type, context);
+    Type* retType = TypeOf(*this->type, context);
 
     FunctionType* functionType = FunctionType::get(retType, argTypes, false);
-    Function* function = Function::Create(functionType, GlobalValue::ExternalLinkage, this->id->name.c_str(), context.theModule.get());
+    // a body following its prototype (an extern, or a unit's predeclaration)
+    const std::string& name = this->id->name.str();
+    Function* existing = context.theModule->getFunction(name);
+    if( existing && existing->isDeclaration() && existing->getFunctionType() == functionType )
+        return existing;
+    return Function::Create(functionType, GlobalValue::ExternalLinkage, name, context.theModule.get());
+}
+
+llvm::Value* NFunctionDeclaration::codeGen(CodeGenContext &context) {
+#ifdef DISPLAY_PARSE_PROCESS
+    std::cout << "Generating function declaration of " << this->id->name << std::endl;
+#endif
+    Function* function = this->codeGenPrototype(context);
 
     if( !this->external){
         BasicBlock* basicBlock = BasicBlock::Create(context.llvmContext, "entry", function, nullptr);
@@ -233,17 +301,21 @@ llvm::Value* NFunctionDeclaration::codeGen(CodeGenContext &context) {
         auto origin_arg = this->arguments->begin();
 
         for(auto &ir_arg_it: function->args()){
-            ir_arg_it.setName((*origin_arg)->id->name);
-            Value* argAlloc;
-            if( (*origin_arg)->type->isArray )
-                argAlloc = context.builder.CreateAlloca(PointerType::get(context.typeSystem.getVarType((*origin_arg)->type->name), 0));
-            else
-                argAlloc = (*origin_arg)->codeGen(context);
-
-            context.builder.CreateStore(&ir_arg_it, argAlloc, false);
-            context.setSymbolValue((*origin_arg)->id->name, argAlloc);
-            context.setSymbolType((*origin_arg)->id->name, (*origin_arg)->type);
-            context.setFuncArg((*origin_arg)->id->name, true);
+            NVariableDeclaration* argument = *origin_arg;
+            ir_arg_it.setName(argument->id->name.str());
+            if( argument->type->isArray ){
+                // the pointer to the first row
+                argument->addressType = TypeOf(*argument->type, context);
+                argument->indexedType = context.typeSystem.getArrayType(*argument->type, 1);
+                argument->elementType = context.typeSystem.getVarType(argument->type->name);
+                argument->address = context.builder.CreateAlloca(argument->addressType);
+                context.declareLocal(argument);
+            }else{
+                argument->codeGen(context);
+            }
+            argument->isFuncArg = true;
+
+            context.builder.CreateStore(&ir_arg_it, argument->address, false);
             origin_arg++;
         }
 
@@ -267,7 +339,7 @@ llvm::Value* NStructDeclaration::codeGen(CodeGenContext& context) {
     std::cout << "Generating struct declaration of " << this->id->name << std::endl;
 #endif
     std::vector<Type*> memberTypes;
-    auto structType = StructType::create(context.llvmContext, this->id->name);
+    auto structType = StructType::create(context.llvmContext, this->id->name.str());
     context.typeSystem.addStructType(this->id->name, structType);
 
     for(auto& member: *this->members){
@@ -284,9 +356,15 @@ llvm::Value* NMethodCall::codeGen(CodeGenContext &context) {
 #ifdef DISPLAY_PARSE_PROCESS
     std::cout << "Generating method call of " << this->id->name << std::endl;
 #endif
-    Function * calleeF = context.theModule->getFunction(this->id->name);
+    Function * calleeF = context.theModule->getFunction(this->id->name.str());
+    if( !calleeF && isBuiltin(this->id->name) ){
+        return emitBuiltin(*this, context);
+    }
     if( !calleeF ){
-        LogErrorV("Function name not found");
+        calleeF = declareRuntimeFunction(this->id->name, context);
+    }
+    if( !calleeF ){
+        return LogErrorV("Function name not found: " + this->id->name.str());
     }
     if( calleeF->arg_size() != this->arguments->size() ){
         //Here is a bug???
@@ -299,45 +377,35 @@ llvm::Value* NMethodCall::codeGen(CodeGenContext &context) {
             return nullptr;
         }
     }
-    return context.builder.CreateCall(calleeF, argsv, "calltmp");
+    // a void call can't be named
+    return context.builder.CreateCall(calleeF, argsv, calleeF->getReturnType()->isVoidTy() ? "" : "calltmp");
 }
 
 llvm::Value* NVariableDeclaration::codeGen(CodeGenContext &context) {
 #ifdef DISPLAY_PARSE_PROCESS
     std::cout << "Generating variable declaration of " << this->type->name << " " << this->id->name << std::endl;
 #endif
-    Type* type = TypeOf(*this->type, context);
-    Value* initial = nullptr;
-
-    Value* inst = nullptr;
-
     if( this->type->isArray ){
-        uint64_t arraySize = 1;
-        std::vector<uint64_t> arraySizes;
-        for(auto it=this->type->arraySize->begin(); it!=this->type->arraySize->end(); it++){
-            NInteger* integer = dynamic_cast<NInteger*>(it->get());
-            arraySize *= integer->value;
-            arraySizes.push_back(integer->value);
-        }
-
-        context.setArraySize(this->id->name, arraySizes);
-        Value* arraySizeValue = NInteger(arraySize).codeGen(context);
-        auto arrayType = ArrayType::get(context.typeSystem.getVarType(this->type->name), arraySize);
-        inst = context.builder.CreateAlloca(arrayType, arraySizeValue, "arraytmp");
+        this->addressType = context.typeSystem.getArrayType(*this->type);
+        this->indexedType = this->addressType;
+        this->elementType = context.typeSystem.getVarType(this->type->name);
+        this->address = context.builder.CreateAlloca(this->addressType, nullptr, "arraytmp");
     }else{
-        inst = context.builder.CreateAlloca(type);
+        this->addressType = TypeOf(*this->type, context);
+        this->address = context.builder.CreateAlloca(this->addressType);
     }
-
-    context.setSymbolType(this->id->name, this->type);
-    context.setSymbolValue(this->id->name, inst);
+    this->isFuncArg = false;
+    context.declareLocal(this);
 
     context.PrintSymTable();
 
     if( this->expr != nullptr ){
-        NAssignment assignment(this->id, this->expr);
-        assignment.codeGen(context);
+        // cast to the variable's type by the semantic analysis
+        Value* initial = this->expr->codeGen(context);
+        if( initial )
+            context.builder.CreateStore(initial, this->address);
     }
-    return inst;
+    return this->address;
 }
 
 llvm::Value* NReturnStatement::codeGen(CodeGenContext &context) {
@@ -404,43 +472,88 @@ llvm::Value* NIfStatement::codeGen(CodeGenContext &context) {
     return nullptr;
 }
 
+// llvm.loop metadata of the back edge, it is distinct so every loop keeps its
+// own hints after inlining and unrolling
+static MDNode* loopMetadata(const LoopHints& hints, LLVMContext& llvmContext){
+    SmallVector<Metadata*, 4> operands;
+    operands.push_back(nullptr);    // the self reference
+
+    auto addHint = [&](const char* name, Constant* value){
+        Metadata* hint[] = { MDString::get(llvmContext, name), ConstantAsMetadata::get(value) };
+        operands.push_back(MDNode::get(llvmContext, hint));
+    };
+    Type* int32Ty = Type::getInt32Ty(llvmContext);
+
+    if( hints.vectorizeWidth ){
+        addHint("llvm.loop.vectorize.enable", ConstantInt::get(Type::getInt1Ty(llvmContext), hints.vectorizeWidth > 1));
+        addHint("llvm.loop.vectorize.width", ConstantInt::get(int32Ty, hints.vectorizeWidth));
+    }
+    if( hints.interleaveCount )
+        addHint("llvm.loop.interleave.count", ConstantInt::get(int32Ty, hints.interleaveCount));
+    if( hints.unrollCount )
+        addHint("llvm.loop.unroll.count", ConstantInt::get(int32Ty, hints.unrollCount));
+
+    MDNode* loopID = MDNode::getDistinct(llvmContext, operands);
+    loopID->replaceOperandWith(0, loopID);
+    return loopID;
+}
+
 llvm::Value* NForStatement::codeGen(CodeGenContext &context) {
+    if( this->parallel )
+        return this->codeGenParallel(context);
 
     Function* theFunction = context.builder.GetInsertBlock()->getParent();
 
-    BasicBlock *block = BasicBlock::Create(context.llvmContext, "forloop", theFunction);
-    BasicBlock *after = BasicBlock::Create(context.llvmContext, "forcont");
+    // The canonical shape the loop passes expect: the current block is the
+    // preheader, the header is the only exit, the body falls into a single
+    // latch that increments and jumps back
+    BasicBlock *header = BasicBlock::Create(context.llvmContext, "for.cond", theFunction);
+    BasicBlock *body = BasicBlock::Create(context.llvmContext, "for.body");
+    BasicBlock *latch = BasicBlock::Create(context.llvmContext, "for.inc");
+    BasicBlock *after = BasicBlock::Create(context.llvmContext, "for.end");
 
     // execute the initial
     if( this->initial )
         this->initial->codeGen(context);
+    BasicBlock* preheader = context.builder.GetInsertBlock();
+    BranchInst* enter = context.builder.CreateBr(header);
 
+    context.builder.SetInsertPoint(header);
+    context.pushBlock(header);
     Value* condValue = this->condition->codeGen(context);
-    if( !condValue )
-        return nullptr;
-
-    condValue = CastToBoolean(context, condValue);
-
-    // fall to the block
-    context.builder.CreateCondBr(condValue, block, after);
-
-    context.builder.SetInsertPoint(block);
-
-    context.pushBlock(block);
+    if( condValue )
+        condValue = CastToBoolean(context, condValue);
+    context.popBlock();
+    if( !condValue ){
+        // drop the half-built loop, the function goes on in the preheader
+        enter->eraseFromParent();
+        header->eraseFromParent();
+        delete body;
+        delete latch;
+        delete after;
+        context.builder.SetInsertPoint(preheader);
+        return LogErrorV("Invalid loop condition");
+    }
+    context.builder.CreateCondBr(condValue, body, after);
 
+    theFunction->getBasicBlockList().push_back(body);
+    context.builder.SetInsertPoint(body);
+    context.pushBlock(body);
     this->block->codeGen(context);
-
     context.popBlock();
+    context.builder.CreateBr(latch);
 
-    // do increment
-    if( this->increase){
+    // do increment and go back to the test
+    theFunction->getBasicBlockList().push_back(latch);
+    context.builder.SetInsertPoint(latch);
+    context.pushBlock(latch);
+    if( this->increase ){
         this->increase->codeGen(context);
     }
-
-    // execute the again or stop
-    condValue = this->condition->codeGen(context);
-    condValue = CastToBoolean(context, condValue);
-    context.builder.CreateCondBr(condValue, block, after);
+    context.popBlock();
+    auto backEdge = context.builder.CreateBr(header);
+    if( !this->hints.empty() )
+        backEdge->setMetadata(LLVMContext::MD_loop, loopMetadata(this->hints, context.llvmContext));
 
     // insert the after block
     theFunction->getBasicBlockList().push_back(after);
@@ -453,47 +566,50 @@ llvm::Value *NStructMember::codeGen(CodeGenContext &context) {
 #ifdef DISPLAY_PARSE_PROCESS
     std::cout << "Generating struct member expression of " << this->id->name << "." << this->member->name << std::endl;
 #endif
-    auto varPtr = context.getSymbolValue(this->id->name);
-    auto structPtr = context.builder.CreateLoad(varPtr, "structPtr");
-    structPtr->setAlignment(4);
+    NVariableDeclaration* declaration = this->id->declaration;
+    if( !declaration || !declaration->address ){
+        return LogErrorV("Unknown variable name " + this->id->name.str());
+    }
+    auto varPtr = declaration->address;
+    auto structType = declaration->addressType;
 
-    if( !structPtr->getType()->isStructTy() ){
+    if( !structType->isStructTy() ){
         return LogErrorV("The variable is not struct");
     }
 
-    string structName = structPtr->getType()->getStructName().str();
-    long memberIndex = context.typeSystem.getStructMemberIndex(structName, this->member->name);
-
     std::vector<Value*> indices;
     indices.push_back(ConstantInt::get(context.typeSystem.intTy, 0, false));
-    indices.push_back(ConstantInt::get(context.typeSystem.intTy, (uint64_t)memberIndex, false));
-    auto ptr = context.builder.CreateInBoundsGEP(varPtr, indices, "memberPtr");
+    indices.push_back(ConstantInt::get(context.typeSystem.intTy, (uint64_t)this->memberIndex, false));
+    auto ptr = context.builder.CreateInBoundsGEP(structType, varPtr, indices, "memberPtr");
 
-    return context.builder.CreateLoad(ptr);
+    return context.builder.CreateLoad(structType->getStructElementType(this->memberIndex), ptr);
 }
 
 llvm::Value* NStructAssignment::codeGen(CodeGenContext &context) {
 #ifdef DISPLAY_PARSE_PROCESS
     std::cout << "Generating struct assignment of " << this->structMember->id->name << "." << this->structMember->member->name << std::endl;
 #endif
-    auto varPtr = context.getSymbolValue(this->structMember->id->name);
-    auto structPtr = context.builder.CreateLoad(varPtr, "structPtr");
-    structPtr->setAlignment(4);
+    NVariableDeclaration* declaration = this->structMember->id->declaration;
+    if( !declaration || !declaration->address ){
+        return LogErrorV("Unknown variable name " + this->structMember->id->name.str());
+    }
+    auto varPtr = declaration->address;
+    auto structType = declaration->addressType;
 
-    if( !structPtr->getType()->isStructTy() ){
+    if( !structType->isStructTy() ){
         return LogErrorV("The variable is not struct");
     }
 
-    string structName = structPtr->getType()->getStructName().str();
-    long memberIndex = context.typeSystem.getStructMemberIndex(structName, this->structMember->member->name);
-
     std::vector<Value*> indices;
     auto value = this->expression->codeGen(context);
+    if( !value ){
+        return nullptr;
+    }
 
     indices.push_back(ConstantInt::get(context.typeSystem.intTy, 0, false));
-    indices.push_back(ConstantInt::get(context.typeSystem.intTy, (uint64_t)memberIndex, false));
+    indices.push_back(ConstantInt::get(context.typeSystem.intTy, (uint64_t)this->structMember->memberIndex, false));
 
-    auto ptr = context.builder.CreateInBoundsGEP(varPtr, indices, "structMemberPtr");
+    auto ptr = context.builder.CreateInBoundsGEP(structType, varPtr, indices, "structMemberPtr");
 
     return context.builder.CreateStore(value, ptr);
 }
@@ -502,37 +618,11 @@ llvm::Value *NArrayIndex::codeGen(CodeGenContext &context) {
 #ifdef DISPLAY_PARSE_PROCESS
     std::cout << "Generating array index expression of " << this->arrayId->name << std::endl;
 #endif
-    auto varPtr = context.getSymbolValue(this->arrayId->name);
-    auto type = context.getSymbolType(this->arrayId->name);
-    string typeStr = type->name;
-
-    assert(type->isArray);
-
-    auto value = calcArrayIndex(make_shared<NArrayIndex>(*this), context);
-    //The indices is the reference to consecutinve address which is store 
-    //in the otherplace and can live longer than the reference
-    ArrayRef<Value*> indices;
-
-    //if this array is the pointer pass-in by the caller so we use the arg that pass
-    //in as the true reference
-    if(context.isFuncArg(this->arrayId->name) ){
-        std::cout << "isFuncArg" << std::endl;
-        varPtr = context.builder.CreateLoad(varPtr, "actualArrayPtr");
-        //Here is a bug to be free
-        //Aware that
-        //The 6.0 api is not the same with the 4.0 api
-        indices =  value ;//This line may be wrong.
-        //indices = {0,value};
-    }else if( varPtr->getType()->isPointerTy() ){
-        std::cout << this->arrayId->name << "Not isFuncArg" << std::endl;
-        indices = { ConstantInt::get(Type::getInt64Ty(context.llvmContext), 0), value };
-    }else{
-        return LogErrorV("The variable is not array");
+    auto ptr = arrayElementPtr(this, context);
+    if( !ptr ){
+        return nullptr;
     }
-    auto ptr = context.builder.CreateInBoundsGEP(varPtr, indices, "elementPtr");
-
-    return context.builder.CreateAlignedLoad(ptr, 4);
-    
+    return context.builder.CreateLoad(this->arrayId->declaration->elementType, ptr, "element");
 }
 
 
@@ -540,38 +630,33 @@ llvm::Value *NArrayAssignment::codeGen(CodeGenContext &context) {
 #ifdef DISPLAY_PARSE_PROCESS
     std::cout << "Generating array index assignment of " << this->arrayInx->arrayId->name << std::endl;
 #endif
-    auto varPtr = context.getSymbolValue(this->arrayInx->arrayId->name);
-
-    if( varPtr == nullptr ){
-        return LogErrorV("Unknown variable name");
+    auto ptr = arrayElementPtr(this->arrayInx, context);
+    if( !ptr ){
+        return nullptr;
     }
-    
-    auto arrayPtr = context.builder.CreateLoad(varPtr, "arrayPtr");
-
-    if( !arrayPtr->getType()->isArrayTy() && !arrayPtr->getType()->isPointerTy() ){
-        return LogErrorV("The variable is not array");
+    auto value = this->expr->codeGen(context);
+    if( !value ){
+        return nullptr;
     }
-    auto index = calcArrayIndex(arrayIndex, context);
-    ArrayRef<Value*> gep2_array{ ConstantInt::get(Type::getInt64Ty(context.llvmContext), 0), index };
-    auto ptr = context.builder.CreateInBoundsGEP(varPtr, gep2_array, "elementPtr");
-
-    return context.builder.CreateAlignedStore(this->expr->codeGen(context), ptr, 4);
+    return context.builder.CreateStore(value, ptr);
 }
 
 llvm::Value *NArrayInitialization::codeGen(CodeGenContext &context) {
 #ifdef DISPLAY_PARSE_PROCESS
     std::cout << "Generating array initialization of " << this->declaration->id->name << std::endl;
 #endif
-    auto arrayPtr = this->declaration->codeGen(context);
-    auto sizeVec = context.getArraySize(this->declaration->id->name);
-    assert(sizeVec.size() == 1);
+    auto varPtr = this->declaration->codeGen(context);
+    assert(this->declaration->type->arraySize->size() == 1);
+    auto arrayType = this->declaration->indexedType;
 
-    for(int index=0; index < this->expressionList->size(); index++){
-        shared_ptr<NInteger> indexValue = make_shared<NInteger>(index);
-
-        shared_ptr<NArrayIndex> arrayIndex = make_shared<NArrayIndex>(this->declaration->id, indexValue);
-        NArrayAssignment assignment(arrayIndex, this->expressionList->at(index));
-        assignment.codeGen(context);
+    for(size_t index=0; index < this->expressionList->size(); index++){
+        auto value = this->expressionList->at(index)->codeGen(context);
+        if( !value ){
+            return nullptr;
+        }
+        Value* indices[] = { ConstantInt::get(Type::getInt64Ty(context.llvmContext), 0), ConstantInt::get(Type::getInt64Ty(context.llvmContext), index) };
+        auto ptr = context.builder.CreateInBoundsGEP(arrayType, varPtr, indices, "elementPtr");
+        context.builder.CreateStore(value, ptr);
     }
     return nullptr;
 }
@@ -580,9 +665,21 @@ llvm::Value *NLiteral::codeGen(CodeGenContext &context) {
     return context.builder.CreateGlobalString(this->value, "string");
 }
 
+llvm::Value *NCast::codeGen(CodeGenContext &context) {
+    Value* value = this->expr->codeGen(context);
+    if( !value ){
+        return nullptr;
+    }
+    Type* type = context.typeSystem.getVarType(*this->resolvedType);
+    if( this->splat ){
+        return context.builder.CreateVectorSplat(cast<FixedVectorType>(type)->getNumElements(), value, "splat");
+    }
+    return context.builder.CreateCast((Instruction::CastOps)this->op, value, type, "cast");
+}
+
 
 std::unique_ptr<NExpression> LogError(const char *str) {
-    static int64_t errorCount=0;
+    static std::atomic<int64_t> errorCount(0);
     ++errorCount;
     //fprintf(stderr,"LogError%lld: %s\n",errorCount,str);
     return nullptr;
@@ -29,65 +29,38 @@ class CodeGenBlock{
 public:
     BasicBlock * block;
     Value * returnValue;
-    std::map<std::string, Value*> locals;
-    std::map<std::string, shared_ptr<NIdentifier>> types;     
-    std::map<std::string, bool> isFuncArg;
-    std::map<std::string, std::vector<uint64_t>> arraySizes;
+    // locals.size() when the block was entered
+    size_t firstLocal;
 };
 
 class CodeGenContext{
 private:
     std::vector<CodeGenBlock*> theBlockStack;
+    // the variables declared in the open blocks, innermost last. Their
+    // identifiers reach them through NIdentifier::declaration
+    std::vector<NVariableDeclaration*> locals;
 public:
-    LLVMContext llvmContext;
+    // held through a pointer so the JIT can take over the context together
+    // with theModule, llvmContext stays a plain reference for the codegen
+    unique_ptr<LLVMContext> ownedContext;
+    LLVMContext& llvmContext;
     IRBuilder<> builder;
     unique_ptr<Module> theModule;
     SymTable globalVars;
     TypeSystem typeSystem;
 
-    CodeGenContext(): builder(llvmContext), typeSystem(llvmContext){
+    CodeGenContext(): ownedContext(new LLVMContext()), llvmContext(*ownedContext), builder(llvmContext), typeSystem(llvmContext){
         theModule = unique_ptr<Module>(new Module("main", this->llvmContext));
     }
 
-    Value* getSymbolValue(std::string name) const{
-        for(auto it=theBlockStack.rbegin(); it!=theBlockStack.rend(); it++){
-            if( (*it)->locals.find(name) != (*it)->locals.end() ){
-                return (*it)->locals[name];
-            }
-        }
-        return nullptr;
+    // declaration's address is set, it stays visible until its block is popped
+    void declareLocal(NVariableDeclaration* declaration){
+        locals.push_back(declaration);
     }
 
-    shared_ptr<NIdentifier> getSymbolType(std::string name) const{
-        for(auto it=theBlockStack.rbegin(); it!=theBlockStack.rend(); it++){
-            if( (*it)->types.find(name) != (*it)->types.end() ){
-                return (*it)->types[name];
-            }
-        }
-        return nullptr;
-    }
-
-    bool isFuncArg(std::string name) const{
-
-        for(auto it=theBlockStack.rbegin(); it!=theBlockStack.rend(); it++){
-            if( (*it)->isFuncArg.find(name) != (*it)->isFuncArg.end() ){
-                return (*it)->isFuncArg[name];
-            }
-        }
-        return false;
-    }
-
-    void setSymbolValue(std::string name, Value* value){
-        theBlockStack.back()->locals[name] = value;
-    }
-
-    void setSymbolType(std::string name, shared_ptr<NIdentifier> value){
-        theBlockStack.back()->types[name] = value;
-    }
-
-    void setFuncArg(std::string name, bool value){
-        //std::cout << "Set " << name << " as func arg" << std::endl;
-        theBlockStack.back()->isFuncArg[name] = value;
+    // The declarations of the open blocks, shadowed ones included
+    const std::vector<NVariableDeclaration*>& visibleLocals() const{
+        return locals;
     }
 
     BasicBlock* currentBlock() const{
@@ -98,12 +71,14 @@ public:
         CodeGenBlock * codeGenBlock = new CodeGenBlock();
         codeGenBlock->block = block;
         codeGenBlock->returnValue = nullptr;
+        codeGenBlock->firstLocal = locals.size();
         theBlockStack.push_back(codeGenBlock);
     }
 
     void popBlock(){
         CodeGenBlock * codeGenBlock = theBlockStack.back();
         theBlockStack.pop_back();
+        locals.resize(codeGenBlock->firstLocal);
         delete codeGenBlock;
     }
 
@@ -115,35 +90,20 @@ public:
         return theBlockStack.back()->returnValue;
     }
 
-    void setArraySize(std::string name, std::vector<uint64_t> value){
-        //std::cout << "setArraySize: " << name << ": " << value.size() << std::endl;
-        theBlockStack.back()->arraySizes[name] = value;
-    }
-
-    std::vector<uint64_t> getArraySize(std::string name){
-        for(auto it=theBlockStack.rbegin(); it!=theBlockStack.rend(); it++){
-            if( (*it)->arraySizes.find(name) != (*it)->arraySizes.end() ){
-                return (*it)->arraySizes[name];
-            }
-        }
-        return theBlockStack.back()->arraySizes[name];
-    }
-
     void PrintSymTable() const{
     #ifdef PRINT_SYMBOL_TABLE
         std::cout << "======= Print Symbol Table ==================" << std::endl;
-        std::string prefix = "";
-        for(auto it=theBlockStack.begin(); it!=theBlockStack.end(); it++){
-            for(auto it2=(*it)->locals.begin(); it2!=(*it)->locals.end(); it2++){
-                std::cout << prefix << it2->first << " = " << it2->second << ": " << this->getSymbolType(it2->first) << std::endl;
-            }
-            prefix += "\t";
+        for(auto declaration: locals){
+            std::cout << declaration->id->name.str() << " = " << declaration->address << ": " << declaration->type->name.str() << std::endl;
         }
         std::cout << "=============================================" << std::endl;
     #endif
     }
 
     void generateCode(NBlock& );
+    // Generate only `bodies` out of root, the other functions are declared.
+    // root may only contain function and struct declarations
+    void generateUnit(NBlock& root, const std::vector<NFunctionDeclaration*>& bodies);
 };
 
 Value* LogErrorV(const char* err);
@@ -0,0 +1,445 @@
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/ExecutionEngine/Orc/CompileUtils.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/Support/DynamicLibrary.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <chrono>
+#include <stdio.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "JIT.h"
+#include "ObjGen.h"
+#include "Optimizer.h"
+#include "runtime/Runtime.h"
+
+using namespace llvm;
+using namespace llvm::orc;
+
+static double elapsedMs(std::chrono::steady_clock::time_point start){
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static int reportError(Error err){
+    errs() << "JIT error: " << toString(std::move(err)) << "\n";
+    return 1;
+}
+
+// Every function without body comes from an `extern` declaration and has to
+// be provided by the host process (libc, or anything linked into the compiler)
+static bool checkExternals(Module& module){
+    bool resolved = true;
+    for(auto& function: module){
+        if( !function.isDeclaration() || function.isIntrinsic() )
+            continue;
+        if( !sys::DynamicLibrary::SearchForAddressOfSymbol(function.getName().str()) ){
+            errs() << "Unresolved extern function: " << function.getName() << "\n";
+            resolved = false;
+        }
+    }
+    return resolved;
+}
+
+static JITTargetMachineBuilder createJITTargetMachineBuilder(const CompilerOptions& options){
+    JITTargetMachineBuilder JTMB((Triple(sys::getProcessTriple())));
+    JTMB.setCPU(getTargetCPU(options));
+
+    std::vector<std::string> features;
+    std::string featureString = getTargetFeatures(options);
+    StringRef rest = featureString;
+    while( !rest.empty() ){
+        auto split = rest.split(',');
+        if( !split.first.empty() )
+            features.push_back(split.first.str());
+        rest = split.second;
+    }
+    JTMB.addFeatures(features);
+
+    switch (options.optLevel){
+        case 0:
+            JTMB.setCodeGenOptLevel(CodeGenOpt::None);
+            break;
+        case 1:
+            JTMB.setCodeGenOptLevel(CodeGenOpt::Less);
+            break;
+        case 2:
+            JTMB.setCodeGenOptLevel(CodeGenOpt::Default);
+            break;
+        default:
+            JTMB.setCodeGenOptLevel(CodeGenOpt::Aggressive);
+    }
+    return JTMB;
+}
+
+// main is called without arguments, so it has to be `int main()` or `void main()`
+static bool checkMain(Module& module, bool& returnsInt){
+    Function* mainFunc = module.getFunction("main");
+    if( !mainFunc || mainFunc->isDeclaration() ){
+        errs() << "JIT error: no main function defined\n";
+        return false;
+    }
+    Type* retType = mainFunc->getReturnType();
+    if( !mainFunc->arg_empty() || !(retType->isVoidTy() || retType->isIntegerTy(32)) ){
+        errs() << "JIT error: main must be `int main()` or `void main()`\n";
+        return false;
+    }
+    returnsInt = retType->isIntegerTy(32);
+    return true;
+}
+
+static Error addHostSymbols(LLJIT& jit){
+    auto generator = DynamicLibrarySearchGenerator::GetForCurrentProcess(jit.getDataLayout().getGlobalPrefix());
+    if( !generator )
+        return generator.takeError();
+    jit.getMainJITDylib().addGenerator(std::move(*generator));
+    return Error::success();
+}
+
+static int callMain(JITTargetAddress address, bool returnsInt){
+    if( returnsInt ){
+        auto mainPtr = (int (*)())(intptr_t)address;
+        return mainPtr();
+    }
+    auto mainPtr = (void (*)())(intptr_t)address;
+    mainPtr();
+    return 0;
+}
+
+static void reportTimes(double compileTime, double runTime){
+    // the program writes through stdio and the runtime, flush them before
+    // the report
+    dude_flush();
+    fflush(stdout);
+    outs().flush();
+    errs() << "JIT compile time: " << format("%.3f", compileTime) << " ms\n";
+    errs() << "JIT run time: " << format("%.3f", runTime) << " ms\n";
+}
+
+int runJIT(CodeGenContext& context, const CompilerOptions& options){
+    doInit();
+
+    bool returnsInt = false;
+    if( !checkMain(*context.theModule, returnsInt) )
+        return 1;
+
+    // make the symbols of the compiler process visible to the JIT
+    sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
+    if( !checkExternals(*context.theModule) )
+        return 1;
+
+    auto compileStart = std::chrono::steady_clock::now();
+
+    auto jit = LLJITBuilder()
+            .setJITTargetMachineBuilder(createJITTargetMachineBuilder(options))
+            .create();
+    if( !jit )
+        return reportError(jit.takeError());
+
+    if( auto err = addHostSymbols(**jit) )
+        return reportError(std::move(err));
+
+    ThreadSafeModule module(std::move(context.theModule), ThreadSafeContext(std::move(context.ownedContext)));
+    if( auto err = (*jit)->addIRModule(std::move(module)) )
+        return reportError(std::move(err));
+
+    // the lookup materializes main and everything it references
+    auto mainSymbol = (*jit)->lookup("main");
+    if( !mainSymbol )
+        return reportError(mainSymbol.takeError());
+
+    double compileTime = elapsedMs(compileStart);
+
+    auto runStart = std::chrono::steady_clock::now();
+    int exitCode = callMain(mainSymbol->getAddress(), returnsInt);
+    reportTimes(compileTime, elapsedMs(runStart));
+
+    return exitCode;
+}
+
+/*
+ * Tiered JIT
+ *
+ * Every function F with a body is split into
+ *   F.tier0  the original body, compiled lazily at -O0 on its first call
+ *   F.impl   a global holding the address of the best compiled body
+ *   F.calls  a call counter
+ *   F        a thunk that counts the call, asks for a tier-up when the
+ *            counter reaches the threshold and calls through F.impl
+ * All the calls in the program go through the thunks. A tier-up request is
+ * served by a background thread which recompiles F from a copy of the
+ * unoptimized module at -O2 (or the -O level if higher) as F.tier2 and
+ * swaps F.impl to it, the program keeps running the tier 0 code meanwhile.
+ */
+
+static const char* tierUpName = "__jit_tier_up";
+
+class TieredJIT;
+static TieredJIT* activeTieredJIT = nullptr;
+
+class TieredJIT{
+private:
+    const CompilerOptions& options;
+    std::unique_ptr<LLLazyJIT> jit;
+    // unoptimized, uninstrumented module the tier 2 code is compiled from
+    SmallVector<char, 0> bitcode;
+    std::vector<std::string> functions;
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable pending;
+    std::deque<uint32_t> requests;
+    // the functions already asked for, a body is compiled at most once
+    std::vector<char> requested;
+    bool stopping = false;
+    unsigned promoted = 0;
+    unsigned failed = 0;
+
+    void instrument(Module& module, uint64_t threshold);
+    Error compileTier2(uint32_t id);
+    void serveRequests();
+
+public:
+    TieredJIT(const CompilerOptions& options): options(options){}
+    ~TieredJIT(){
+        stop();
+    }
+
+    int run(CodeGenContext& context);
+    void requestTierUp(uint32_t id);
+    void stop();
+};
+
+static void tierUpEntry(int32_t id){
+    if( activeTieredJIT )
+        activeTieredJIT->requestTierUp(id);
+}
+
+void TieredJIT::instrument(Module& module, uint64_t threshold){
+    LLVMContext& llvmContext = module.getContext();
+    Type* int32Ty = Type::getInt32Ty(llvmContext);
+    Type* int64Ty = Type::getInt64Ty(llvmContext);
+
+    FunctionType* tierUpType = FunctionType::get(Type::getVoidTy(llvmContext), {int32Ty}, false);
+    Function* tierUp = Function::Create(tierUpType, GlobalValue::ExternalLinkage, tierUpName, &module);
+
+    std::vector<Function*> bodies;
+    for(auto& function: module){
+        if( !function.isDeclaration() )
+            bodies.push_back(&function);
+    }
+
+    for(auto body: bodies){
+        std::string name = body->getName().str();
+        uint32_t id = functions.size();
+        functions.push_back(name);
+
+        // every existing call and address use now refers to the thunk
+        Function* thunk = Function::Create(body->getFunctionType(), GlobalValue::ExternalLinkage, "", &module);
+        body->replaceAllUsesWith(thunk);
+        thunk->takeName(body);
+        body->setName(name + ".tier0");
+
+        auto slot = new GlobalVariable(module, body->getType(), false, GlobalValue::ExternalLinkage, body, name + ".impl");
+        auto counter = new GlobalVariable(module, int64Ty, false, GlobalValue::ExternalLinkage, ConstantInt::get(int64Ty, 0), name + ".calls");
+
+        BasicBlock* entry = BasicBlock::Create(llvmContext, "entry", thunk);
+        BasicBlock* promote = BasicBlock::Create(llvmContext, "tierup", thunk);
+        BasicBlock* dispatch = BasicBlock::Create(llvmContext, "dispatch", thunk);
+
+        IRBuilder<> builder(entry);
+        // the thunks run on the pool threads of parallel for too, only the
+        // call that takes the counter from threshold-1 to threshold asks
+        Value* calls = builder.CreateAtomicRMW(AtomicRMWInst::Add, counter, ConstantInt::get(int64Ty, 1), MaybeAlign(8), AtomicOrdering::Monotonic);
+        builder.CreateCondBr(builder.CreateICmpEQ(calls, ConstantInt::get(int64Ty, threshold - 1)), promote, dispatch);
+
+        builder.SetInsertPoint(promote);
+        builder.CreateCall(tierUp, {ConstantInt::get(int32Ty, id)});
+        builder.CreateBr(dispatch);
+
+        builder.SetInsertPoint(dispatch);
+        // F.impl is written by the tier-up thread
+        LoadInst* impl = builder.CreateLoad(body->getType(), slot, "impl");
+        impl->setAtomic(AtomicOrdering::Monotonic);
+        impl->setAlignment(Align(8));
+
+        std::vector<Value*> args;
+        for(auto& arg: thunk->args()){
+            args.push_back(&arg);
+        }
+        CallInst* call = builder.CreateCall(body->getFunctionType(), impl, args);
+        if( call->getType()->isVoidTy() )
+            builder.CreateRetVoid();
+        else
+            builder.CreateRet(call);
+    }
+}
+
+Error TieredJIT::compileTier2(uint32_t id){
+    const std::string& name = functions[id];
+
+    LLVMContext llvmContext;
+    auto module = parseBitcodeFile(MemoryBufferRef(StringRef(bitcode.data(), bitcode.size()), "tier2"), llvmContext);
+    if( !module )
+        return module.takeError();
+
+    // Keep the other bodies only for the inliner, their symbols resolve to
+    // the thunks already in the JIT
+    Function* hot = (*module)->getFunction(name);
+    if( !hot )
+        return createStringError(inconvertibleErrorCode(), "function not found in the module");
+    for(auto& function: **module){
+        if( &function != hot && !function.isDeclaration() )
+            function.setLinkage(GlobalValue::AvailableExternallyLinkage);
+    }
+    hot->setName(name + ".tier2");
+
+    auto JTMB = createJITTargetMachineBuilder(options);
+    JTMB.setCodeGenOptLevel(options.optLevel >= 3 ? CodeGenOpt::Aggressive : CodeGenOpt::Default);
+    auto targetMachine = JTMB.createTargetMachine();
+    if( !targetMachine )
+        return targetMachine.takeError();
+    (*module)->setDataLayout((*targetMachine)->createDataLayout());
+
+    if( !optimizeModule(**module, std::max(options.optLevel, 2u), targetMachine->get()) )
+        return createStringError(inconvertibleErrorCode(), "the tier 2 module is not valid IR");
+
+    SimpleCompiler compiler(**targetMachine);
+    auto object = compiler(**module);
+    if( !object )
+        return object.takeError();
+    if( auto err = jit->addObjectFile(std::move(*object)) )
+        return err;
+
+    auto tier2 = jit->lookup(name + ".tier2");
+    if( !tier2 )
+        return tier2.takeError();
+    auto slot = jit->lookup(name + ".impl");
+    if( !slot )
+        return slot.takeError();
+
+    __atomic_store_n((uint64_t*)(intptr_t)slot->getAddress(), (uint64_t)tier2->getAddress(), __ATOMIC_RELEASE);
+    return Error::success();
+}
+
+void TieredJIT::serveRequests(){
+    std::unique_lock<std::mutex> lock(mutex);
+    while( true ){
+        pending.wait(lock, [this]{ return stopping || !requests.empty(); });
+        if( stopping )
+            return;
+        uint32_t id = requests.front();
+        requests.pop_front();
+
+        lock.unlock();
+        auto err = compileTier2(id);
+        lock.lock();
+        if( err ){
+            errs() << "JIT tier-up of " << functions[id] << " failed: " << toString(std::move(err)) << "\n";
+            failed++;
+        }else
+            promoted++;
+    }
+}
+
+void TieredJIT::requestTierUp(uint32_t id){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if( id >= requested.size() || requested[id] )
+            return;
+        requested[id] = 1;
+        requests.push_back(id);
+    }
+    pending.notify_one();
+}
+
+void TieredJIT::stop(){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    pending.notify_one();
+    if( worker.joinable() )
+        worker.join();
+}
+
+int TieredJIT::run(CodeGenContext& context){
+    doInit();
+
+    bool returnsInt = false;
+    if( !checkMain(*context.theModule, returnsInt) )
+        return 1;
+
+    sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
+    if( !checkExternals(*context.theModule) )
+        return 1;
+
+    auto compileStart = std::chrono::steady_clock::now();
+
+    raw_svector_ostream bitcodeStream(bitcode);
+    WriteBitcodeToFile(*context.theModule, bitcodeStream);
+    instrument(*context.theModule, options.tierThreshold);
+    requested.assign(functions.size(), 0);
+
+    auto JTMB = createJITTargetMachineBuilder(options);
+    JTMB.setCodeGenOptLevel(CodeGenOpt::None);
+    auto lazyJIT = LLLazyJITBuilder()
+            .setJITTargetMachineBuilder(std::move(JTMB))
+            .create();
+    if( !lazyJIT )
+        return reportError(lazyJIT.takeError());
+    jit = std::move(*lazyJIT);
+
+    if( auto err = addHostSymbols(*jit) )
+        return reportError(std::move(err));
+
+    MangleAndInterner mangle(jit->getExecutionSession(), jit->getDataLayout());
+    SymbolMap runtimeSymbols;
+    runtimeSymbols[mangle(tierUpName)] = JITEvaluatedSymbol(pointerToJITTargetAddress(&tierUpEntry), JITSymbolFlags::Exported | JITSymbolFlags::Callable);
+    if( auto err = jit->getMainJITDylib().define(absoluteSymbols(std::move(runtimeSymbols))) )
+        return reportError(std::move(err));
+
+    ThreadSafeModule module(std::move(context.theModule), ThreadSafeContext(std::move(context.ownedContext)));
+    if( auto err = jit->addLazyIRModule(std::move(module)) )
+        return reportError(std::move(err));
+
+    // only the main thunk gets compiled here, everything else on first call
+    auto mainSymbol = jit->lookup("main");
+    if( !mainSymbol )
+        return reportError(mainSymbol.takeError());
+
+    double compileTime = elapsedMs(compileStart);
+
+    activeTieredJIT = this;
+    worker = std::thread(&TieredJIT::serveRequests, this);
+
+    auto runStart = std::chrono::steady_clock::now();
+    int exitCode = callMain(mainSymbol->getAddress(), returnsInt);
+    double runTime = elapsedMs(runStart);
+
+    stop();
+    activeTieredJIT = nullptr;
+
+    reportTimes(compileTime, runTime);
+    errs() << "JIT functions promoted to tier 2: " << promoted << "/" << functions.size() << "\n";
+
+    // the program ran on its tier 0 code, but a failed tier-up is a
+    // compiler error all the same
+    if( failed && exitCode == 0 )
+        return 1;
+    return exitCode;
+}
+
+int runTieredJIT(CodeGenContext& context, const CompilerOptions& options){
+    TieredJIT tieredJIT(options);
+    return tieredJIT.run(context);
+}
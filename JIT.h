@@ -0,0 +1,18 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "CodeGen.h"
+#include "Options.h"
+
+// Compile context.theModule in-process with ORC LLJIT and call its main().
+// The module and its LLVMContext are moved into the JIT, so the context
+// can't be used for code generation afterwards.
+// Returns the exit code of the program, or 1 if the JIT failed.
+int runJIT(CodeGenContext& context, const CompilerOptions& options);
+
+// Same as runJIT, but every function is compiled lazily at -O0 on its first
+// call and recompiled at -O2 in the background once it has been called
+// options.tierThreshold times. The module must not be optimized beforehand.
+int runTieredJIT(CodeGenContext& context, const CompilerOptions& options);
+
+#endif //JIT_H
@@ -0,0 +1,402 @@
+#include <cassert>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "ASTNodes.h"
+#include "Parser.h"
+#include "grammar.hpp"
+
+// The scanner of the compiler, a hand-written replacement of the flex one in
+// token.l which bench/LexerBench.cpp measures it against. It accepts the
+// same tokens: keywords, identifiers, numbers, string literals, the
+// operators, "#pragma loop" lines and "#" comments. Whitespace, identifiers
+// and numbers are scanned 16 (32 with AVX2) bytes at a time, the keywords
+// are looked up in a perfect hash table, nothing is copied or allocated for
+// a token. All of its state is in the Lexer of a ParseContext, so any
+// number of parses can run at once.
+
+namespace {
+
+class Keyword{
+public:
+    const char* text = nullptr;
+    uint8_t length = 0;
+    int token = 0;
+    // the symbol of the type keywords, they pass their name to the parser
+    bool hasSymbol = false;
+    uint32_t symbol = 0;
+};
+
+// Perfect hash of the keywords, no two of them share a slot. The words are
+// 2 to 8 characters long, everything else is an identifier right away
+class KeywordTable{
+private:
+    static const unsigned tableSize = 64;
+    Keyword slots[tableSize];
+
+    static unsigned hash(const char* text, size_t length){
+        return (length * 7 + (unsigned char)text[0] * 6 + (unsigned char)text[length - 1] * 9 +
+                (unsigned char)text[1]) & (tableSize - 1);
+    }
+
+    void add(const char* text, int token, bool hasSymbol){
+        size_t length = strlen(text);
+        Keyword& slot = slots[hash(text, length)];
+        assert(!slot.text && "Keyword hash collision");
+        slot.text = text;
+        slot.length = length;
+        slot.token = token;
+        slot.hasSymbol = hasSymbol;
+        if( hasSymbol )
+            slot.symbol = Symbol(text, length).getId();
+    }
+
+public:
+    KeywordTable(){
+        add("int", TYINT, true);
+        add("double", TYDOUBLE, true);
+        add("float", TYFLOAT, true);
+        add("char", TYCHAR, true);
+        add("bool", TYBOOL, true);
+        add("string", TYSTRING, true);
+        add("void", TYVOID, true);
+        static const char* const vectorTypes[] = {
+            "char2", "char4", "char8", "char16", "int2", "int4", "int8", "int16",
+            "float2", "float4", "float8", "float16", "double2", "double4", "double8", "double16",
+        };
+        for(const char* name : vectorTypes)
+            add(name, TYVECTOR, true);
+        add("extern", TEXTERN, false);
+        add("if", TIF, false);
+        add("else", TELSE, false);
+        add("return", TRETURN, false);
+        add("for", TFOR, false);
+        add("while", TWHILE, false);
+        add("struct", TSTRUCT, false);
+        add("parallel", TPARALLEL, false);
+        add("reduce", TREDUCE, false);
+    }
+
+    const Keyword* find(const char* text, size_t length) const{
+        if( length < 2 || length > 8 )
+            return nullptr;
+        const Keyword& slot = slots[hash(text, length)];
+        if( slot.length != length || memcmp(slot.text, text, length) != 0 )
+            return nullptr;
+        return &slot;
+    }
+};
+
+}
+
+static bool isSpace(char c){
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static bool isDigit(char c){
+    return (unsigned char)(c - '0') < 10;
+}
+
+static bool isIdentifierChar(char c){
+    return (unsigned char)((c | 0x20) - 'a') < 26 || isDigit(c) || c == '_';
+}
+
+// The bit masks of the bytes of a chunk that are spaces, digits or
+// identifier characters. The unsigned compares are min(x, bound) == x
+#if defined(__AVX2__)
+typedef __m256i Chunk;
+static const size_t chunkSize = 32;
+
+static Chunk loadChunk(const char* p){
+    return _mm256_loadu_si256((const __m256i*)p);
+}
+static uint32_t byteMask(Chunk bytes){
+    return (uint32_t)_mm256_movemask_epi8(bytes);
+}
+static Chunk equalBytes(Chunk bytes, char c){
+    return _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(c));
+}
+static Chunk inRange(Chunk bytes, char low, unsigned char count){
+    Chunk offset = _mm256_sub_epi8(bytes, _mm256_set1_epi8(low));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(offset, _mm256_set1_epi8(count - 1)), offset);
+}
+static Chunk either(Chunk a, Chunk b){
+    return _mm256_or_si256(a, b);
+}
+static Chunk lowerCase(Chunk bytes){
+    return _mm256_or_si256(bytes, _mm256_set1_epi8(0x20));
+}
+#elif defined(__SSE2__)
+typedef __m128i Chunk;
+static const size_t chunkSize = 16;
+
+static Chunk loadChunk(const char* p){
+    return _mm_loadu_si128((const __m128i*)p);
+}
+static uint32_t byteMask(Chunk bytes){
+    return (uint32_t)_mm_movemask_epi8(bytes);
+}
+static Chunk equalBytes(Chunk bytes, char c){
+    return _mm_cmpeq_epi8(bytes, _mm_set1_epi8(c));
+}
+static Chunk inRange(Chunk bytes, char low, unsigned char count){
+    Chunk offset = _mm_sub_epi8(bytes, _mm_set1_epi8(low));
+    return _mm_cmpeq_epi8(_mm_min_epu8(offset, _mm_set1_epi8(count - 1)), offset);
+}
+static Chunk either(Chunk a, Chunk b){
+    return _mm_or_si128(a, b);
+}
+static Chunk lowerCase(Chunk bytes){
+    return _mm_or_si128(bytes, _mm_set1_epi8(0x20));
+}
+#endif
+
+#if defined(__AVX2__) || defined(__SSE2__)
+static const uint32_t fullMask = chunkSize == 32 ? 0xffffffffu : 0xffffu;
+
+static uint32_t spaceMask(Chunk bytes){
+    return byteMask(either(either(equalBytes(bytes, ' '), equalBytes(bytes, '\t')),
+                           either(equalBytes(bytes, '\r'), equalBytes(bytes, '\n'))));
+}
+static uint32_t digitMask(Chunk bytes){
+    return byteMask(inRange(bytes, '0', 10));
+}
+static uint32_t identifierMask(Chunk bytes){
+    return byteMask(either(either(inRange(lowerCase(bytes), 'a', 26), inRange(bytes, '0', 10)),
+                           equalBytes(bytes, '_')));
+}
+
+// Skip the bytes of p whose bit is set in the chunk's mask. The chunks stay
+// inside the text, the tail is done byte by byte
+template<uint32_t (*mask)(Chunk), bool (*test)(char)>
+static const char* skipWhile(const char* p, const char* end){
+    while( p + chunkSize <= end ){
+        uint32_t stop = ~mask(loadChunk(p)) & fullMask;
+        if( stop )
+            return p + __builtin_ctz(stop);
+        p += chunkSize;
+    }
+    while( p < end && test(*p) )
+        p++;
+    return p;
+}
+
+static const char* skipSpaces(const char* p, const char* end){
+    return skipWhile<spaceMask, isSpace>(p, end);
+}
+static const char* skipDigits(const char* p, const char* end){
+    return skipWhile<digitMask, isDigit>(p, end);
+}
+static const char* skipIdentifier(const char* p, const char* end){
+    return skipWhile<identifierMask, isIdentifierChar>(p, end);
+}
+#else
+static const char* skipSpaces(const char* p, const char* end){
+    while( p < end && isSpace(*p) )
+        p++;
+    return p;
+}
+static const char* skipDigits(const char* p, const char* end){
+    while( p < end && isDigit(*p) )
+        p++;
+    return p;
+}
+static const char* skipIdentifier(const char* p, const char* end){
+    while( p < end && isIdentifierChar(*p) )
+        p++;
+    return p;
+}
+#endif
+
+static const char* lineEnd(const char* p, const char* end){
+    const char* newline = (const char*)memchr(p, '\n', end - p);
+    return newline ? newline : end;
+}
+
+static bool startsWith(const char* p, const char* end, const char* prefix, size_t length){
+    return (size_t)(end - p) >= length && memcmp(p, prefix, length) == 0;
+}
+
+// A string literal is the longest text from the quote to a quote in which
+// every other quote follows a backslash, the match of \"(\\.|[^"])*\"
+static const char* literalEnd(const char* quote, const char* end){
+    const char* last = nullptr;
+    const char* p = quote + 1;
+    while( (p = (const char*)memchr(p, '"', end - p)) ){
+        last = p + 1;
+        if( p[-1] != '\\' )
+            break;
+        p++;
+    }
+    return last;
+}
+
+class Lexer{
+private:
+    // the text of a SourceBuffer, cursor is where the next token starts
+    const char* source;
+    const char* end;
+    const char* cursor;
+
+    void saveSpan(YYSTYPE& value, const char* start, const char* stop){
+        value.span = SourceSpan{uint32_t(start - source), uint32_t(stop - start)};
+    }
+
+    int token(YYSTYPE& value, int t, const char* stop){
+        cursor = stop;
+        value.token = t;
+        return t;
+    }
+
+    int lexNumber(YYSTYPE& value, const char* start);
+    int unknownToken(const char* p);
+
+public:
+    explicit Lexer(SourceBuffer& buffer): source(buffer.scanBuffer()), end(source + buffer.text().size()), cursor(source){
+    }
+
+    int lex(YYSTYPE& value);
+};
+
+int Lexer::lexNumber(YYSTYPE& value, const char* start){
+    const char* p = skipDigits(start, end);
+    if( p < end && *p == '.' ){
+        p = skipDigits(p + 1, end);
+        // atof stops at the NUL flex writes behind the token, so does this
+        char buffer[64];
+        std::string longText;
+        const char* text = buffer;
+        if( size_t(p - start) < sizeof(buffer) ){
+            memcpy(buffer, start, p - start);
+            buffer[p - start] = '\0';
+        }else{
+            longText.assign(start, p);
+            text = longText.c_str();
+        }
+        value.number = atof(text);
+        cursor = p;
+        return TDOUBLE;
+    }
+    // saturates like strtoull
+    uint64_t integer = 0;
+    for(const char* digit = start; digit < p; digit++){
+        unsigned d = *digit - '0';
+        if( integer > (UINT64_MAX - d) / 10 ){
+            integer = UINT64_MAX;
+            break;
+        }
+        integer = integer * 10 + d;
+    }
+    value.integer = integer;
+    cursor = p;
+    return TINTEGER;
+}
+
+int Lexer::unknownToken(const char* p){
+    printf("Unknown token:%c\n", *p);
+    cursor = end;
+    return 0;
+}
+
+int Lexer::lex(YYSTYPE& value){
+    static const KeywordTable keywords;
+
+    const char* p = cursor;
+    for(;;){
+        p = skipSpaces(p, end);
+        if( p >= end ){
+            cursor = p;
+            return 0;
+        }
+        if( *p != '#' )
+            break;
+        // "#pragma loop ..." up to the end of the line, any other # line is a comment
+        const char* line = lineEnd(p, end);
+        const char* q = p + 7;
+        if( startsWith(p, end, "#pragma", 7) && q < line && (*q == ' ' || *q == '\t') ){
+            while( *q == ' ' || *q == '\t' )
+                q++;
+            if( startsWith(q, end, "loop", 4) ){
+                saveSpan(value, p, line);
+                cursor = line;
+                return TPRAGMA;
+            }
+        }
+        p = line;
+    }
+
+    char c = *p;
+    if( (unsigned char)((c | 0x20) - 'a') < 26 || c == '_' ){
+        const char* stop = skipIdentifier(p + 1, end);
+        cursor = stop;
+        if( const Keyword* keyword = keywords.find(p, stop - p) ){
+            if( keyword->hasSymbol )
+                value.symbol = keyword->symbol;
+            else
+                value.token = keyword->token;
+            return keyword->token;
+        }
+        value.symbol = Symbol(p, stop - p).getId();
+        return TIDENTIFIER;
+    }
+    if( isDigit(c) )
+        return lexNumber(value, p);
+
+    char next = p + 1 < end ? p[1] : '\0';
+    switch( c ){
+    case '"':{
+        const char* stop = literalEnd(p, end);
+        if( !stop )
+            return unknownToken(p);
+        saveSpan(value, p, stop);
+        cursor = stop;
+        return TLITERAL;
+    }
+    case '=': return next == '=' ? token(value, TCEQ, p + 2) : token(value, TEQUAL, p + 1);
+    case '!': return next == '=' ? token(value, TCNE, p + 2) : unknownToken(p);
+    case '<':
+        if( next == '=' )
+            return token(value, TCLE, p + 2);
+        return next == '<' ? token(value, TSHIFTL, p + 2) : token(value, TCLT, p + 1);
+    case '>':
+        if( next == '=' )
+            return token(value, TCGE, p + 2);
+        return next == '>' ? token(value, TSHIFTR, p + 2) : token(value, TCGT, p + 1);
+    case '(': return token(value, TLPAREN, p + 1);
+    case ')': return token(value, TRPAREN, p + 1);
+    case '{': return token(value, TLBRACE, p + 1);
+    case '}': return token(value, TRBRACE, p + 1);
+    case '[': return token(value, TLBRACKET, p + 1);
+    case ']': return token(value, TRBRACKET, p + 1);
+    case '.': return token(value, TDOT, p + 1);
+    case ',': return token(value, TCOMMA, p + 1);
+    case '+': return token(value, TPLUS, p + 1);
+    case '-': return token(value, TMINUS, p + 1);
+    case '*': return token(value, TMUL, p + 1);
+    case '/': return token(value, TDIV, p + 1);
+    case '&': return token(value, TAND, p + 1);
+    case '|': return token(value, TOR, p + 1);
+    case '^': return token(value, TXOR, p + 1);
+    case '%': return token(value, TMOD, p + 1);
+    case ';': return token(value, TSEMICOLON, p + 1);
+    default: return unknownToken(p);
+    }
+}
+
+Lexer* createLexer(SourceBuffer& source){
+    return new Lexer(source);
+}
+
+void destroyLexer(Lexer* lexer){
+    delete lexer;
+}
+
+int yylex(YYSTYPE* value, ParseContext& context){
+    return context.lexer->lex(*value);
+}
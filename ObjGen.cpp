@@ -1,18 +1,33 @@
 #include <llvm/Support/FileSystem.h>
 #include <llvm/Support/Host.h>
+#include <llvm/Support/CodeGen.h>
 #include <llvm/ADT/Optional.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/MC/SubtargetFeature.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Support/FormattedStream.h>
 #include <llvm/Support/FileSystem.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/Support/raw_ostream.h>
-#include <llvm/Support/TargetRegistry.h>
+#include <llvm/MC/TargetRegistry.h>
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/Target/TargetMachine.h>
 #include <llvm/Target/TargetOptions.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Program.h>
+#include <llvm/Transforms/Utils/SplitModule.h>
+
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <vector>
 
 #include "CodeGen.h"
 #include "ObjGen.h"
+#include "Optimizer.h"
 
 using namespace llvm;
 
@@ -26,46 +41,266 @@ void doInit(){
     InitializeAllAsmPrinters();
 }
 
-void ObjGen(CodeGenContext & context, const string& filename){
-    doInit();
+std::string getTargetCPU(const CompilerOptions& options){
+    if( options.cpu == "native" )
+        return sys::getHostCPUName().str();
+    return options.cpu;
+}
+
+std::string getTargetFeatures(const CompilerOptions& options){
+    SubtargetFeatures features;
+
+    if( options.cpu == "native" ){
+        StringMap<bool> hostFeatures;
+        if( sys::getHostCPUFeatures(hostFeatures) ){
+            for(auto& feature: hostFeatures){
+                features.AddFeature(feature.first(), feature.second);
+            }
+        }
+    }
+
+    // the explicit --features list goes last so it overrides the host detection
+    StringRef rest = options.features;
+    while( !rest.empty() ){
+        auto split = rest.split(',');
+        if( !split.first.empty() )
+            features.AddFeature(split.first);
+        rest = split.second;
+    }
+
+    return features.getString();
+}
+
+static Reloc::Model getRelocModel(const CompilerOptions& options){
+    if( options.relocModel == "static" )
+        return Reloc::Static;
+    if( options.relocModel == "dynamic-no-pic" )
+        return Reloc::DynamicNoPIC;
+    return Reloc::PIC_;
+}
+
+static CodeGenOpt::Level getCodeGenOptLevel(const CompilerOptions& options){
+    switch (options.optLevel){
+        case 0:
+            return CodeGenOpt::None;
+        case 1:
+            return CodeGenOpt::Less;
+        case 2:
+            return CodeGenOpt::Default;
+        default:
+            return CodeGenOpt::Aggressive;
+    }
+}
+
+TargetMachine* createTargetMachine(const CompilerOptions& options){
     auto targetTriple = sys::getDefaultTargetTriple();
-    context.theModule->setTargetTriple(targetTriple);
 
     std::string error;
     auto Target = TargetRegistry::lookupTarget(targetTriple, error);
 
     if( !Target ){
         errs() << error;
-        return;
+        return nullptr;
     }
 
     TargetOptions tOptions;
-    auto RM = Optional<Reloc::Model>();
-
-    const char* features = "";
-    const char* CPU = "generic";
+    auto RM = Optional<Reloc::Model>(getRelocModel(options));
+    auto CM = Optional<CodeModel::Model>();
 
-    llvm::TargetMachine* theTargetMachine = Target->createTargetMachine(targetTriple, CPU, features, tOptions, RM);
+    std::string CPU = getTargetCPU(options);
+    std::string features = getTargetFeatures(options);
 
-    context.theModule->setDataLayout(theTargetMachine->createDataLayout());
-    context.theModule->setTargetTriple(targetTriple);
-
-    std::error_code ErrorCode;
-    raw_fd_ostream dest(filename.c_str(), ErrorCode, sys::fs::F_None);
+    return Target->createTargetMachine(targetTriple, CPU, features, tOptions, RM, CM, getCodeGenOptLevel(options));
+}
 
+static bool emitObject(Module& module, TargetMachine* theTargetMachine, raw_pwrite_stream& dest){
     legacy::PassManager pass;
-    auto fileType = TargetMachine::CGFT_ObjectFile;
+    auto fileType = CGFT_ObjectFile;
 
-    if( theTargetMachine->addPassesToEmitFile(pass, dest, fileType) ){
+    if( theTargetMachine->addPassesToEmitFile(pass, dest, nullptr, fileType) ){
         errs() << "This Type can't be emited";
-        return;
+        return false;
     }
-    pass.run(*context.theModule.get());
+    pass.run(module);
     dest.flush();
 
+    return true;
+}
+
+static bool emitObject(Module& module, TargetMachine* theTargetMachine, const string& filename){
+    std::error_code ErrorCode;
+    raw_fd_ostream dest(filename.c_str(), ErrorCode, sys::fs::OF_None);
+    if( ErrorCode ){
+        errs() << "Could not open " << filename << ": " << ErrorCode.message() << "\n";
+        return false;
+    }
+    return emitObject(module, theTargetMachine, dest);
+}
+
+// output.o -> output.part3.o
+static string partFileName(const string& filename, unsigned index){
+    SmallString<128> path(filename);
+    sys::path::replace_extension(path, "part" + std::to_string(index) + ".o");
+    return path.str().str();
+}
+
+// Merge the part objects into one relocatable object with `ld -r`
+static bool mergeObjects(const std::vector<string>& parts, const string& filename){
+    auto ld = sys::findProgramByName("ld");
+    if( !ld ){
+        errs() << "ld not found, can't merge the objects into " << filename << "\n";
+        return false;
+    }
+
+    std::vector<StringRef> args = { *ld, "-r", "-o", filename };
+    for(auto& part: parts){
+        args.push_back(part);
+    }
+
+    std::string error;
+    if( sys::ExecuteAndWait(*ld, args, None, {}, 0, 0, &error) != 0 ){
+        errs() << "ld -r failed: " << error << "\n";
+        return false;
+    }
+    return true;
+}
+
+// Split the module with SplitModule and run the machine code emission of
+// every part on its own thread. A part is moved through bitcode into a
+// LLVMContext of its own, a context can't be used by two threads at once.
+// Every thread builds its own TargetMachine like theTargetMachine, from its
+// already resolved CPU and features.
+static bool splitObjGen(CodeGenContext & context, const CompilerOptions& options, TargetMachine* theTargetMachine,
+                        const string& filename){
+    CompilerOptions partOptions = options;
+    partOptions.cpu = theTargetMachine->getTargetCPU().str();
+    partOptions.features = theTargetMachine->getTargetFeatureString().str();
+
+    unsigned threads = options.codegenThreads;
+    if( threads == 0 )
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<std::string> bitcodes;
+    SplitModule(*context.theModule, threads, [&](std::unique_ptr<Module> part){
+        std::string bitcode;
+        raw_string_ostream stream(bitcode);
+        WriteBitcodeToFile(*part, stream);
+        stream.flush();
+        bitcodes.push_back(std::move(bitcode));
+    });
+
+    std::vector<string> parts(bitcodes.size());
+    // not vector<bool>, the threads write their own element
+    std::vector<char> emitted(bitcodes.size(), 0);
+    std::vector<std::thread> workers;
+    for(size_t i=0; i<bitcodes.size(); i++){
+        parts[i] = partFileName(filename, i);
+        workers.emplace_back([&, i](){
+            LLVMContext llvmContext;
+            auto module = parseBitcodeFile(MemoryBufferRef(bitcodes[i], parts[i]), llvmContext);
+            if( !module ){
+                errs() << "Could not read back " << parts[i] << ": " << toString(module.takeError()) << "\n";
+                return;
+            }
+            std::unique_ptr<TargetMachine> partTargetMachine(createTargetMachine(partOptions));
+            emitted[i] = partTargetMachine && emitObject(**module, partTargetMachine.get(), parts[i]);
+        });
+    }
+    for(auto& worker: workers){
+        worker.join();
+    }
+
+    for(auto ok: emitted){
+        if( !ok )
+            return false;
+    }
+
+    if( options.splitObjects ){
+        // the batch workers would interleave on stdout
+        if( !options.batch() ){
+            for(auto& part: parts){
+                outs() << "Write OBJ code to : " << part << "\n";
+            }
+        }
+        return true;
+    }
+
+    if( !mergeObjects(parts, filename) )
+        return false;
+    for(auto& part: parts){
+        sys::fs::remove(part);
+    }
+    return true;
+}
+
+bool ObjGen(CodeGenContext & context, const CompilerOptions& options, const string& filename, TargetMachine* theTargetMachine){
+    std::unique_ptr<TargetMachine> ownedTargetMachine;
+    if( !theTargetMachine ){
+        doInit();
+        ownedTargetMachine.reset(createTargetMachine(options));
+        theTargetMachine = ownedTargetMachine.get();
+    }
+    if( !theTargetMachine ){
+        return false;
+    }
+
+    context.theModule->setDataLayout(theTargetMachine->createDataLayout());
+    context.theModule->setTargetTriple(theTargetMachine->getTargetTriple().str());
+
+    if( options.codegenThreads != 1 ){
+        return splitObjGen(context, options, theTargetMachine, filename);
+    }
+
+    if( !emitObject(*context.theModule, theTargetMachine, filename) ){
+        return false;
+    }
+
     //commit this to get the clean output
     //outs() << "Write OBJ code to : " << filename.c_str() << "\n";
 
-    return;
+    return true;
 }
 
+void warmUpPipelines(TargetMachine* theTargetMachine, unsigned optLevel){
+    LLVMContext llvmContext;
+    Module module("warmup", llvmContext);
+    module.setDataLayout(theTargetMachine->createDataLayout());
+    module.setTargetTriple(theTargetMachine->getTargetTriple().str());
+
+    // int sum(int* a, int n){ int s = 0; for(int i = 0; i < n; i++) s += a[i]; return s; }
+    IRBuilder<> builder(llvmContext);
+    Type* intType = builder.getInt32Ty();
+    FunctionType* type = FunctionType::get(intType, { intType->getPointerTo(), intType }, false);
+    Function* sum = Function::Create(type, GlobalValue::ExternalLinkage, "sum", &module);
+    Value* array = &*sum->arg_begin();
+    Value* count = &*std::next(sum->arg_begin());
+    BasicBlock* entry = BasicBlock::Create(llvmContext, "entry", sum);
+    BasicBlock* loop = BasicBlock::Create(llvmContext, "loop", sum);
+    BasicBlock* exit = BasicBlock::Create(llvmContext, "exit", sum);
+
+    builder.SetInsertPoint(entry);
+    builder.CreateCondBr(builder.CreateICmpSGT(count, builder.getInt32(0)), loop, exit);
+
+    builder.SetInsertPoint(loop);
+    PHINode* index = builder.CreatePHI(intType, 2, "i");
+    PHINode* total = builder.CreatePHI(intType, 2, "s");
+    Value* element = builder.CreateLoad(intType, builder.CreateGEP(intType, array, index));
+    Value* next = builder.CreateAdd(total, element);
+    Value* nextIndex = builder.CreateAdd(index, builder.getInt32(1));
+    index->addIncoming(builder.getInt32(0), entry);
+    index->addIncoming(nextIndex, loop);
+    total->addIncoming(builder.getInt32(0), entry);
+    total->addIncoming(next, loop);
+    builder.CreateCondBr(builder.CreateICmpSLT(nextIndex, count), loop, exit);
+
+    builder.SetInsertPoint(exit);
+    PHINode* result = builder.CreatePHI(intType, 2, "result");
+    result->addIncoming(builder.getInt32(0), entry);
+    result->addIncoming(next, loop);
+    builder.CreateRet(result);
+
+    if( !optimizeModule(module, optLevel, theTargetMachine) )
+        return;
+    raw_null_ostream discard;
+    emitObject(module, theTargetMachine, discard);
+}
@@ -1,7 +1,31 @@
 #ifndef OBJGEN_H
 #define OBJGEN_H
 
+#include <string>
+#include "Options.h"
+
+namespace llvm{
+    class TargetMachine;
+}
+class CodeGenContext;
+
 void doInit();
-void ObjGen(CodeGenContext & context, const string& filename = "output.o");
+
+// Resolve options.cpu/options.features, "native" is replaced by the host CPU
+// and the features it supports
+std::string getTargetCPU(const CompilerOptions& options);
+std::string getTargetFeatures(const CompilerOptions& options);
+
+llvm::TargetMachine* createTargetMachine(const CompilerOptions& options);
+
+// Emit the module as an object file, returns false if nothing was written.
+// targetMachine is used instead of a new one when given, the caller has
+// run doInit then. Only one thread at a time may emit with it
+bool ObjGen(CodeGenContext & context, const CompilerOptions& options, const std::string& filename = "output.o",
+            llvm::TargetMachine* targetMachine = nullptr);
+
+// Run the optimization and the machine code pipelines once on a small
+// module, so their passes are registered and initialized up front
+void warmUpPipelines(llvm::TargetMachine* targetMachine, unsigned optLevel);
 
 #endif 
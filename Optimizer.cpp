@@ -0,0 +1,152 @@
+#include <llvm/Analysis/TargetTransformInfo.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Pass.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/InstCombine/InstCombine.h>
+#include <llvm/Transforms/Scalar.h>
+#include <llvm/Transforms/Scalar/GVN.h>
+#include <llvm/Transforms/Utils.h>
+#include <llvm/Transforms/Vectorize.h>
+
+#include "Optimizer.h"
+
+using namespace llvm;
+
+// -O1: get rid of the allocas the code generator emits for every local and
+//      argument and clean up the redundant loads and unfolded constants
+static void addCleanupPasses(legacy::PassManagerBase& pm){
+    pm.add(createSROAPass());
+    pm.add(createPromoteMemoryToRegisterPass());
+    pm.add(createEarlyCSEPass());
+    pm.add(createInstructionCombiningPass());
+    pm.add(createCFGSimplificationPass());
+}
+
+// -O2: redundancy elimination and loop optimizations for the hot loops,
+//      rotation turns the for.cond header test into a guarded do-while so
+//      LICM has a preheader to hoist into
+static void addScalarPasses(legacy::PassManagerBase& pm){
+    pm.add(createReassociatePass());
+    pm.add(createGVNPass());
+    pm.add(createLoopRotatePass());
+    pm.add(createLICMPass());
+    pm.add(createIndVarSimplifyPass());
+    pm.add(createLoopDeletionPass());
+    pm.add(createInstructionCombiningPass());
+    pm.add(createDeadStoreEliminationPass());
+    pm.add(createCFGSimplificationPass());
+}
+
+// -O2: vectorize the loops (honoring the #pragma loop hints), then the
+//      straight-line code, and unroll what is left
+static void addVectorizePasses(legacy::PassManagerBase& pm, unsigned optLevel){
+    pm.add(createLoopVectorizePass());
+    pm.add(createSLPVectorizerPass());
+    pm.add(createInstructionCombiningPass());
+    pm.add(createLoopUnrollPass(optLevel));
+    pm.add(createInstructionCombiningPass());
+    pm.add(createCFGSimplificationPass());
+}
+
+bool optimizeModule(Module& module, unsigned optLevel, TargetMachine* targetMachine){
+    if( verifyModule(module, &errs()) ){
+        errs() << "Module verification failed\n";
+        return false;
+    }
+    if( optLevel == 0 )
+        return true;
+
+    legacy::PassManager pm;
+
+    // without the target the vectorizer sees no vector registers and the
+    // cost model rejects every loop
+    if( targetMachine ){
+        if( module.getDataLayout().isDefault() )
+            module.setDataLayout(targetMachine->createDataLayout());
+        if( module.getTargetTriple().empty() )
+            module.setTargetTriple(targetMachine->getTargetTriple().str());
+        pm.add(createTargetTransformInfoWrapperPass(targetMachine->getTargetIRAnalysis()));
+    }
+
+    // The inliner is a CGSCC pass, the function passes added after it are
+    // run bottom-up on the call graph so every callee is simplified before
+    // it gets inlined into its callers
+    if( optLevel >= 2 ){
+        pm.add(createFunctionInliningPass(optLevel, 0, false));
+    }
+
+    addCleanupPasses(pm);
+
+    if( optLevel >= 2 ){
+        addScalarPasses(pm);
+        addVectorizePasses(pm, optLevel);
+    }
+
+    // -O3: one more round after unrolling exposed new opportunities
+    if( optLevel >= 3 ){
+        pm.add(createAggressiveDCEPass());
+        pm.add(createGVNPass());
+        pm.add(createInstructionCombiningPass());
+        pm.add(createCFGSimplificationPass());
+    }
+
+    pm.add(createGlobalDCEPass());
+    pm.run(module);
+    return true;
+}
+
+bool linkRuntimeBitcode(Module& module, const std::string& path, bool required){
+    if( path.empty() || (!required && !sys::fs::exists(path)) )
+        return true;
+
+    auto buffer = MemoryBuffer::getFile(path);
+    if( !buffer ){
+        errs() << "Can't read the runtime bitcode " << path << ": " << buffer.getError().message() << "\n";
+        return false;
+    }
+    auto runtime = parseBitcodeFile((*buffer)->getMemBufferRef(), module.getContext());
+    if( !runtime ){
+        errs() << "Invalid runtime bitcode " << path << ": " << toString(runtime.takeError()) << "\n";
+        return false;
+    }
+
+    // the library runs its static constructors already
+    for(const char* name: { "llvm.global_ctors", "llvm.global_dtors" }){
+        if( auto structors = (*runtime)->getNamedGlobal(name) )
+            structors->eraseFromParent();
+    }
+    for(auto& global: (*runtime)->globals()){
+        if( !global.isDeclaration() && !global.hasLocalLinkage() ){
+            global.setInitializer(nullptr);
+            global.setComdat(nullptr);
+            global.setLinkage(GlobalValue::ExternalLinkage);
+        }
+    }
+    for(auto& function: **runtime){
+        if( !function.isDeclaration() && !function.hasLocalLinkage() ){
+            function.setLinkage(GlobalValue::AvailableExternallyLinkage);
+            function.setComdat(nullptr);
+        }
+    }
+    if( module.getTargetTriple().empty() ){
+        module.setTargetTriple((*runtime)->getTargetTriple());
+        module.setDataLayout((*runtime)->getDataLayout());
+    }else{
+        (*runtime)->setTargetTriple(module.getTargetTriple());
+        (*runtime)->setDataLayout(module.getDataLayout());
+    }
+
+    // only what the program references, the rest stays out of the module
+    if( Linker::linkModules(module, std::move(*runtime), Linker::Flags::LinkOnlyNeeded) ){
+        errs() << "Can't link the runtime bitcode " << path << "\n";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,25 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include <llvm/IR/Module.h>
+
+#include <string>
+
+namespace llvm{
+    class TargetMachine;
+}
+
+// Run the optimization pipeline selected by optLevel (0-3) over the module.
+// It sits between CodeGenContext::generateCode and ObjGen. Pass the target
+// machine the module is compiled for so the vectorizers get its cost model.
+// The module is verified first, at -O0 too: false (the verifier's messages
+// on errs()) when it isn't valid IR, it must not be compiled then.
+bool optimizeModule(llvm::Module& module, unsigned optLevel, llvm::TargetMachine* targetMachine = nullptr);
+
+// Link the runtime functions the module calls in from the runtime bitcode,
+// as available_externally definitions: the optimizer can inline them, the
+// out of line copies and the runtime state stay in the runtime library.
+// A missing file is not an error unless it was asked for explicitly.
+bool linkRuntimeBitcode(llvm::Module& module, const std::string& path, bool required);
+
+#endif //OPTIMIZER_H
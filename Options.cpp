@@ -0,0 +1,149 @@
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include "Options.h"
+
+void printUsage(const char* program){
+    std::cerr << "Usage: " << program << " [options] [input... | < input]" << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  -o FILE                  object file to write (default output.o)" << std::endl;
+    std::cerr << "  -o DIR/                  with several inputs, the directory of their objects" << std::endl;
+    std::cerr << "  --batch-threads=N        compile N of the inputs at once, 0 uses every core (default 0)" << std::endl;
+    std::cerr << "  -O0 | -O1 | -O2 | -O3    optimization level (default -O0)" << std::endl;
+    std::cerr << "  -march=CPU, --cpu=CPU    target CPU, \"native\" detects the host (default native)" << std::endl;
+    std::cerr << "  --features=+f1,-f2       enable/disable target features" << std::endl;
+    std::cerr << "  --reloc=MODEL            static | pic | dynamic-no-pic (default pic)" << std::endl;
+    std::cerr << "  -jN, --jobs=N            generate the functions on N threads, 0 uses every core" << std::endl;
+    std::cerr << "  --codegen-threads=N      emit machine code on N threads, 0 uses every core" << std::endl;
+    std::cerr << "  --split-objects          with --codegen-threads, keep one object per thread" << std::endl;
+    std::cerr << "  --runtime=FILE           runtime bitcode to inline from at -O2 (default " DUDE_RUNTIME_BITCODE ")" << std::endl;
+    std::cerr << "  --no-runtime-inline      call the runtime out of line" << std::endl;
+    std::cerr << "  --no-print-ir            don't print the generated IR to stdout" << std::endl;
+    std::cerr << "  --jit                    compile in memory and run main() directly" << std::endl;
+    std::cerr << "  --jit-tiered             like --jit, compile lazily and tier up hot functions" << std::endl;
+    std::cerr << "  --tier-threshold=N       calls before a function is recompiled at -O2 (default 1000)" << std::endl;
+    std::cerr << "  --cache-dir=DIR          reuse objects of identical inputs (default $COMPILER_CACHE_DIR)" << std::endl;
+    std::cerr << "  --incremental            with a cache, only regenerate the functions that changed" << std::endl;
+    std::cerr << "  --no-cache               don't read or write the object cache" << std::endl;
+    std::cerr << "  --serve=SOCKET           run as a compile server on the Unix socket SOCKET" << std::endl;
+    std::cerr << "  --connect=SOCKET         compile with the server on SOCKET (default $COMPILER_SERVER)," << std::endl;
+    std::cerr << "                           in-process if it isn't running" << std::endl;
+    std::cerr << "  -h, --help               print this message" << std::endl;
+}
+
+static bool parseUnsigned(const std::string& text, unsigned& value){
+    char* end = nullptr;
+    unsigned long parsed = strtoul(text.c_str(), &end, 10);
+    if( text.empty() || *end != '\0' )
+        return false;
+    value = parsed;
+    return true;
+}
+
+bool parseOptions(int argc, char **argv, CompilerOptions& options){
+    const char* cacheDir = getenv("COMPILER_CACHE_DIR");
+    if( cacheDir )
+        options.cacheDir = cacheDir;
+    const char* server = getenv("COMPILER_SERVER");
+    if( server )
+        options.connectSocket = server;
+    bool readStdin = false;
+    bool outputGiven = false;
+
+    for(int i=1; i<argc; i++){
+        std::string arg = argv[i];
+
+        if( arg == "-h" || arg == "--help" ){
+            printUsage(argv[0]);
+            options.help = true;
+            return true;
+        }else if( arg.size() == 3 && arg.compare(0, 2, "-O") == 0 && arg[2] >= '0' && arg[2] <= '3' ){
+            options.optLevel = arg[2] - '0';
+        }else if( arg == "-o" ){
+            if( i + 1 >= argc ){
+                std::cerr << "Missing file name after -o" << std::endl;
+                return false;
+            }
+            options.outputFile = argv[++i];
+            outputGiven = true;
+        }else if( arg.compare(0, 12, "--cache-dir=") == 0 ){
+            options.cacheDir = arg.substr(12);
+        }else if( arg == "--incremental" ){
+            options.incremental = true;
+        }else if( arg == "--no-cache" ){
+            options.cacheDir.clear();
+        }else if( arg.compare(0, 2, "-j") == 0 || arg.compare(0, 7, "--jobs=") == 0 ){
+            std::string value = arg[1] == 'j' ? arg.substr(2) : arg.substr(7);
+            if( !parseUnsigned(value, options.jobs) ){
+                std::cerr << "Invalid job count: " << arg << std::endl;
+                return false;
+            }
+        }else if( arg.compare(0, 18, "--codegen-threads=") == 0 ){
+            if( !parseUnsigned(arg.substr(18), options.codegenThreads) ){
+                std::cerr << "Invalid thread count: " << arg << std::endl;
+                return false;
+            }
+        }else if( arg == "--split-objects" ){
+            options.splitObjects = true;
+        }else if( arg.compare(0, 10, "--runtime=") == 0 ){
+            options.runtimeBitcode = arg.substr(10);
+        }else if( arg == "--no-runtime-inline" ){
+            options.runtimeBitcode.clear();
+        }else if( arg == "--no-print-ir" ){
+            options.printIR = false;
+        }else if( arg == "--jit" ){
+            options.jit = true;
+        }else if( arg == "--jit-tiered" ){
+            options.jit = true;
+            options.jitTiered = true;
+        }else if( arg.compare(0, 17, "--tier-threshold=") == 0 ){
+            if( !parseUnsigned(arg.substr(17), options.tierThreshold) || options.tierThreshold == 0 ){
+                std::cerr << "The tier threshold must be positive" << std::endl;
+                return false;
+            }
+        }else if( arg.compare(0, 7, "-march=") == 0 ){
+            options.cpu = arg.substr(7);
+        }else if( arg.compare(0, 6, "--cpu=") == 0 ){
+            options.cpu = arg.substr(6);
+        }else if( arg.compare(0, 11, "--features=") == 0 ){
+            options.features = arg.substr(11);
+        }else if( arg.compare(0, 8, "--reloc=") == 0 ){
+            options.relocModel = arg.substr(8);
+            if( options.relocModel != "static" && options.relocModel != "pic" && options.relocModel != "dynamic-no-pic" ){
+                std::cerr << "Unknown relocation model: " << options.relocModel << std::endl;
+                return false;
+            }
+        }else if( arg.compare(0, 16, "--batch-threads=") == 0 ){
+            if( !parseUnsigned(arg.substr(16), options.batchThreads) ){
+                std::cerr << "Invalid thread count: " << arg << std::endl;
+                return false;
+            }
+        }else if( arg.compare(0, 8, "--serve=") == 0 ){
+            options.serveSocket = arg.substr(8);
+        }else if( arg.compare(0, 10, "--connect=") == 0 ){
+            options.connectSocket = arg.substr(10);
+        }else if( arg == "-" ){
+            readStdin = true;
+        }else if( arg[0] != '-' ){
+            options.inputFiles.push_back(arg);
+        }else{
+            std::cerr << "Unknown option: " << arg << std::endl;
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+
+    if( readStdin && !options.inputFiles.empty() ){
+        std::cerr << "stdin can't be compiled together with input files" << std::endl;
+        return false;
+    }
+    if( options.inputFiles.size() > 1 && !outputGiven ){
+        std::cerr << "Several inputs need an output directory, -o DIR/" << std::endl;
+        return false;
+    }
+    if( options.batch() && (options.jit || options.inputFiles.empty()) ){
+        std::cerr << "An output directory needs input files and can't be used with --jit" << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,76 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <string>
+#include <vector>
+
+// part of the compile cache key, the Makefile passes the git revision
+#ifndef COMPILER_VERSION
+#define COMPILER_VERSION "unknown"
+#endif
+
+// runtime bitcode linked in for inlining, the Makefile passes the absolute
+// path of runtime/libdude.bc
+#ifndef DUDE_RUNTIME_BITCODE
+#define DUDE_RUNTIME_BITCODE "runtime/libdude.bc"
+#endif
+
+class CompilerOptions{
+public:
+    // -O0 .. -O3, -O0 emits the code generator output untouched
+    unsigned optLevel = 0;
+    // source files, mapped and lexed in place. None reads stdin
+    std::vector<std::string> inputFiles;
+    // the object file, or with several inputs or a trailing '/' the
+    // directory that gets one object per input
+    std::string outputFile = "output.o";
+    // "native" detects the host CPU and its features, anything else is passed
+    // to the target as is (e.g. "generic", "skylake-avx512")
+    std::string cpu = "native";
+    // comma separated "+feature,-feature" list applied on top of the CPU's features
+    std::string features;
+    // static | pic | dynamic-no-pic
+    std::string relocModel = "pic";
+    // compile in-process with ORC and run main() instead of writing output.o
+    bool jit = false;
+    // lazy per-function JIT, hot functions are recompiled at -O2
+    bool jitTiered = false;
+    // calls after which a function is promoted to the optimized tier
+    unsigned tierThreshold = 1000;
+    // directory of the on-disk object cache, empty disables the cache.
+    // Defaults to $COMPILER_CACHE_DIR
+    std::string cacheDir;
+    // cache and regenerate the program function by function
+    bool incremental = false;
+    // threads for the code generation, 0 uses every core
+    unsigned jobs = 1;
+    // threads for the machine code emission, the module is split with
+    // SplitModule and the parts merged again with `ld -r`. 0 uses every core
+    unsigned codegenThreads = 1;
+    // keep the parts as output.partN.o instead of merging them
+    bool splitObjects = false;
+    // print the module the code generator built to stdout. Off in batch
+    // mode, the units would interleave
+    bool printIR = true;
+    // bitcode of the runtime, its functions the program calls are linked in
+    // at -O2 and up so they can be inlined. Empty disables it
+    std::string runtimeBitcode = DUDE_RUNTIME_BITCODE;
+    // inputs compiled at once when there are several, 0 uses every core
+    unsigned batchThreads = 0;
+    // Unix socket to serve compile requests on, see Server.h
+    std::string serveSocket;
+    // socket of a server to compile with, compiles in-process if none
+    // listens there. Defaults to $COMPILER_SERVER
+    std::string connectSocket;
+    // -h/--help, the usage is printed and there's nothing to compile
+    bool help = false;
+
+    bool batch() const{
+        return inputFiles.size() > 1 || (!outputFile.empty() && outputFile.back() == '/');
+    }
+};
+
+bool parseOptions(int argc, char **argv, CompilerOptions& options);
+void printUsage(const char* program);
+
+#endif //OPTIONS_H
@@ -0,0 +1,242 @@
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+
+#include "ASTNodes.h"
+#include "CodeGen.h"
+#include "grammar.hpp"
+
+/*
+ * parallel for (i = lo; i < hi; i = i + step) reduce(+ sum) { body }
+ *
+ * The body is outlined into
+ *   void F.parfor(i8* env, i64 first, i64 last)
+ * which runs the iterations first, first + step, ... below last. env holds
+ * the address of every variable visible at the loop, so the body shares
+ * them with the enclosing function. While the body is generated the
+ * declarations point at the addresses loaded from env. A reduction variable gets a private
+ * copy per chunk, folded into the shared one under the runtime lock.
+ * The enclosing function calls
+ *   dude_parallel_for(lo, hi, step, F.parfor, env)
+ * of the runtime (runtime/Runtime.h), which splits [lo, hi) into chunks
+ * across its thread pool.
+ */
+
+class ParallelReduction{
+public:
+    int op;
+    Type* type;
+    Value* shared;
+    Value* local;
+};
+
+// i = lo; i < hi (or i <= hi); i = i + step with a positive constant step
+static bool matchCanonicalLoop(NForStatement& loop, NIdentifier*& ivId, NExpression*& lo, NExpression*& hi, bool& inclusive, uint64_t& step){
+    auto init = dyn_cast_or_null<NAssignment>(loop.initial);
+    auto cond = dyn_cast_or_null<NBinaryOperator>(loop.condition);
+    auto inc = dyn_cast_or_null<NAssignment>(loop.increase);
+    if( !init || !cond || !inc )
+        return false;
+
+    ivId = init->lchild;
+    Symbol iv = ivId->name;
+    lo = init->rchild;
+
+    auto condVar = dyn_cast<NIdentifier>(cond->lchild);
+    if( !condVar || condVar->name != iv || (cond->op != TCLT && cond->op != TCLE) )
+        return false;
+    hi = cond->rchild;
+    inclusive = cond->op == TCLE;
+
+    auto next = dyn_cast<NBinaryOperator>(inc->rchild);
+    if( inc->lchild->name != iv || !next || next->op != TPLUS )
+        return false;
+    auto nextVar = dyn_cast<NIdentifier>(next->lchild);
+    auto nextStep = dyn_cast<NInteger>(next->rchild);
+    if( !nextVar || nextVar->name != iv || !nextStep || nextStep->value == 0 )
+        return false;
+    step = nextStep->value;
+    return true;
+}
+
+static Value* toInt64(Value* value, CodeGenContext& context){
+    if( !value )
+        return nullptr;
+    if( !value->getType()->isIntegerTy() )
+        return LogErrorV("parallel for bounds must be integers");
+    return context.builder.CreateSExtOrTrunc(value, Type::getInt64Ty(context.llvmContext));
+}
+
+static Constant* reductionIdentity(int op, Type* type){
+    if( type->getScalarType()->isFloatingPointTy() )
+        return ConstantFP::get(type, op == TMUL ? 1.0 : 0.0);
+    return ConstantInt::get(type, op == TMUL ? 1 : 0);
+}
+
+static Value* reductionCombine(int op, Value* L, Value* R, CodeGenContext& context){
+    bool fp = L->getType()->getScalarType()->isFloatingPointTy();
+    if( op == TMUL )
+        return fp ? context.builder.CreateFMul(L, R, "reduce") : context.builder.CreateMul(L, R, "reduce");
+    return fp ? context.builder.CreateFAdd(L, R, "reduce") : context.builder.CreateAdd(L, R, "reduce");
+}
+
+llvm::Value* NForStatement::codeGenParallel(CodeGenContext &context) {
+#ifdef DISPLAY_PARSE_PROCESS
+    std::cout << "Generating parallel for statement" << std::endl;
+#endif
+    NIdentifier* ivId;
+    NExpression* loExpr;
+    NExpression* hiExpr;
+    bool inclusive;
+    uint64_t step;
+    if( !matchCanonicalLoop(*this, ivId, loExpr, hiExpr, inclusive, step) ){
+        return LogErrorV("parallel for must be of the form (i = lo; i < hi; i = i + step)");
+    }
+    NVariableDeclaration* ivDeclaration = ivId->declaration;
+    if( !ivDeclaration || !ivDeclaration->address || ivDeclaration->type->isArray || !ivDeclaration->addressType->isIntegerTy() ){
+        return LogErrorV("The parallel for variable " + ivId->name.str() + " must be a declared integer");
+    }
+    Value* ivPtr = ivDeclaration->address;
+
+    LLVMContext& llvmContext = context.llvmContext;
+    Type* int64Ty = Type::getInt64Ty(llvmContext);
+    Type* bytePtrTy = Type::getInt8PtrTy(llvmContext);
+    Type* voidTy = Type::getVoidTy(llvmContext);
+
+    Value* lo = toInt64(loExpr->codeGen(context), context);
+    Value* hi = toInt64(hiExpr->codeGen(context), context);
+    if( !lo || !hi )
+        return nullptr;
+    if( inclusive )
+        hi = context.builder.CreateAdd(hi, ConstantInt::get(int64Ty, 1), "hi");
+    Value* stepValue = ConstantInt::get(int64Ty, step);
+
+    // pack the addresses of the visible variables
+    std::vector<NVariableDeclaration*> captures;
+    std::vector<Type*> fieldTypes;
+    for(auto declaration: context.visibleLocals()){
+        if( declaration == ivDeclaration )
+            continue;
+        captures.push_back(declaration);
+        fieldTypes.push_back(declaration->address->getType());
+    }
+    StructType* envType = StructType::get(llvmContext, fieldTypes);
+    Value* env = context.builder.CreateAlloca(envType, nullptr, "parfor.env");
+    for(size_t i=0; i<captures.size(); i++){
+        context.builder.CreateStore(captures[i]->address, context.builder.CreateStructGEP(envType, env, i));
+    }
+
+    // the enclosing function's addresses, given back once the body is done
+    std::vector<std::pair<NVariableDeclaration*, Value*>> outerAddresses;
+    for(auto declaration: captures){
+        outerAddresses.emplace_back(declaration, declaration->address);
+    }
+    outerAddresses.emplace_back(ivDeclaration, ivPtr);
+    auto restoreAddresses = [&](){
+        for(auto& outer: outerAddresses){
+            outer.first->address = outer.second;
+        }
+    };
+
+    // outline the body
+    Function* parent = context.builder.GetInsertBlock()->getParent();
+    FunctionType* bodyType = FunctionType::get(voidTy, { bytePtrTy, int64Ty, int64Ty }, false);
+    Function* body = Function::Create(bodyType, GlobalValue::InternalLinkage, parent->getName() + ".parfor", context.theModule.get());
+    auto bodyArg = body->arg_begin();
+    Value* envArg = &*bodyArg++;
+    Value* first = &*bodyArg++;
+    Value* last = &*bodyArg;
+    envArg->setName("env");
+    first->setName("first");
+    last->setName("last");
+
+    auto savedInsertPoint = context.builder.saveIP();
+    BasicBlock* entry = BasicBlock::Create(llvmContext, "entry", body);
+    BasicBlock* header = BasicBlock::Create(llvmContext, "for.cond", body);
+    BasicBlock* loopBody = BasicBlock::Create(llvmContext, "for.body", body);
+    BasicBlock* latch = BasicBlock::Create(llvmContext, "for.inc", body);
+    BasicBlock* after = BasicBlock::Create(llvmContext, "for.end", body);
+
+    context.builder.SetInsertPoint(entry);
+    context.pushBlock(entry);
+
+    Value* bodyEnv = context.builder.CreateBitCast(envArg, PointerType::get(envType, 0));
+    for(size_t i=0; i<captures.size(); i++){
+        Value* address = context.builder.CreateLoad(fieldTypes[i], context.builder.CreateStructGEP(envType, bodyEnv, i), captures[i]->id->name.str());
+        captures[i]->address = address;
+    }
+
+    std::vector<ParallelReduction> reductions;
+    if( this->reductions ){
+        for(auto& reduction: *this->reductions){
+            Symbol name = reduction.variable->name;
+            NVariableDeclaration* declaration = reduction.variable->declaration;
+            if( !declaration || !declaration->address || declaration->type->isArray || declaration == ivDeclaration ){
+                context.popBlock();
+                context.builder.restoreIP(savedInsertPoint);
+                body->eraseFromParent();
+                restoreAddresses();
+                return LogErrorV("Can't reduce into " + name.str());
+            }
+            ParallelReduction local;
+            local.op = reduction.op;
+            local.type = declaration->addressType;
+            local.shared = declaration->address;
+            local.local = context.builder.CreateAlloca(local.type, nullptr, name.str() + ".local");
+            context.builder.CreateStore(reductionIdentity(local.op, local.type), local.local);
+            declaration->address = local.local;
+            reductions.push_back(local);
+        }
+    }
+
+    // the induction variable is private to the chunk
+    Type* ivTy = ivDeclaration->addressType;
+    Value* localIv = context.builder.CreateAlloca(ivTy, nullptr, ivId->name.str());
+    ivDeclaration->address = localIv;
+    context.builder.CreateStore(context.builder.CreateTrunc(first, ivTy), localIv);
+    context.builder.CreateBr(header);
+
+    context.builder.SetInsertPoint(header);
+    Value* current = context.builder.CreateSExt(context.builder.CreateLoad(ivTy, localIv), int64Ty);
+    context.builder.CreateCondBr(context.builder.CreateICmpSLT(current, last), loopBody, after);
+
+    context.builder.SetInsertPoint(loopBody);
+    context.pushBlock(loopBody);
+    this->block->codeGen(context);
+    context.popBlock();
+    context.builder.CreateBr(latch);
+
+    context.builder.SetInsertPoint(latch);
+    Value* next = context.builder.CreateAdd(context.builder.CreateLoad(ivTy, localIv), ConstantInt::get(ivTy, step), "next");
+    context.builder.CreateStore(next, localIv);
+    context.builder.CreateBr(header);
+
+    context.builder.SetInsertPoint(after);
+    if( !reductions.empty() ){
+        Module& module = *context.theModule;
+        context.builder.CreateCall(module.getOrInsertFunction("dude_reduction_lock", voidTy));
+        for(auto& reduction: reductions){
+            Value* shared = context.builder.CreateLoad(reduction.type, reduction.shared);
+            Value* local = context.builder.CreateLoad(reduction.type, reduction.local);
+            context.builder.CreateStore(reductionCombine(reduction.op, shared, local, context), reduction.shared);
+        }
+        context.builder.CreateCall(module.getOrInsertFunction("dude_reduction_unlock", voidTy));
+    }
+    context.builder.CreateRetVoid();
+
+    context.popBlock();
+    context.builder.restoreIP(savedInsertPoint);
+    restoreAddresses();
+
+    // run it and leave i where a serial loop would
+    FunctionCallee parallelFor = context.theModule->getOrInsertFunction("dude_parallel_for", voidTy,
+            int64Ty, int64Ty, int64Ty, PointerType::get(bodyType, 0), bytePtrTy);
+    context.builder.CreateCall(parallelFor, { lo, hi, stepValue, body, context.builder.CreateBitCast(env, bytePtrTy) });
+
+    Value* span = context.builder.CreateSub(hi, lo);
+    Value* count = context.builder.CreateSDiv(context.builder.CreateAdd(span, ConstantInt::get(int64Ty, step - 1)), stepValue);
+    count = context.builder.CreateSelect(context.builder.CreateICmpSGT(hi, lo), count, ConstantInt::get(int64Ty, 0));
+    Value* end = context.builder.CreateAdd(lo, context.builder.CreateMul(count, stepValue));
+    context.builder.CreateStore(context.builder.CreateTrunc(end, ivTy), ivPtr);
+
+    return nullptr;
+}
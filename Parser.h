@@ -0,0 +1,41 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include <llvm/ADT/StringRef.h>
+#include "ASTNodes.h"
+#include "Source.h"
+
+// The scanner state of one parse, defined by Lexer.cpp (token.l in the
+// lexer benchmark)
+class Lexer;
+Lexer* createLexer(SourceBuffer& source);
+void destroyLexer(Lexer* lexer);
+
+// Everything one parse works on: the source, the lexer's position in it
+// and the root of the program once it is parsed. The parser keeps no
+// global state, so separate contexts can be parsed on separate threads.
+class ParseContext{
+public:
+    SourceBuffer& source;
+    Lexer* lexer;
+    NBlock* program = nullptr;
+
+    explicit ParseContext(SourceBuffer& source): source(source), lexer(createLexer(source)){
+    }
+    ParseContext(const ParseContext&) = delete;
+    ParseContext& operator=(const ParseContext&) = delete;
+
+    ~ParseContext(){
+        destroyLexer(lexer);
+    }
+
+    // The text of a token of the source
+    llvm::StringRef spanText(SourceSpan span) const{
+        return source.text().substr(span.offset, span.length);
+    }
+};
+
+// Parse source into an AST in the current Arena, nullptr on syntax errors
+NBlock* parseProgram(SourceBuffer& source);
+
+#endif //PARSER_H
@@ -0,0 +1,218 @@
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <set>
+#include <thread>
+
+#include "Partition.h"
+#include "ASTHash.h"
+#include "Optimizer.h"
+
+using namespace llvm;
+
+bool canPartition(NBlock& root){
+    for(auto& statement: *root.statements){
+        if( !isa<NFunctionDeclaration>(statement) && !isa<NStructDeclaration>(statement) )
+            return false;
+    }
+    return true;
+}
+
+// Only the signature matters to the callers, the body is left out
+static void hashPrototype(ASTHasher& hasher, NFunctionDeclaration& function){
+    hasher.add(std::string("prototype"));
+    hasher.add(function.type);
+    hasher.add(function.id);
+    hasher.add(function.arguments);
+    hasher.add(function.external);
+}
+
+std::string fingerprintFunction(NBlock& root, NFunctionDeclaration& function){
+    std::map<std::string, NStructDeclaration*> structs;
+    std::map<std::string, NFunctionDeclaration*> functions;
+    for(auto& statement: *root.statements){
+        if( auto structDecl = dyn_cast<NStructDeclaration>(statement) )
+            structs[structDecl->id->name.str()] = structDecl;
+        else if( auto functionDecl = dyn_cast<NFunctionDeclaration>(statement) )
+            functions[functionDecl->id->name.str()] = functionDecl;
+    }
+
+    ASTHasher hasher;
+    function.hash(hasher);
+
+    // Hashing a dependency can name more types (struct members, argument
+    // types), so keep going until nothing new shows up
+    std::set<std::string> hashedTypes, hashedCalls;
+    bool changed = true;
+    while( changed ){
+        changed = false;
+
+        std::set<std::string> calls = hasher.calledFunctions;
+        for(auto& name: calls){
+            if( !hashedCalls.insert(name).second )
+                continue;
+            changed = true;
+            auto it = functions.find(name);
+            if( it != functions.end() ){
+                hashPrototype(hasher, *it->second);
+            }else{
+                hasher.add(std::string("undeclared"));
+                hasher.add(name);
+            }
+        }
+
+        std::set<std::string> types = hasher.typeNames;
+        for(auto& name: types){
+            if( !hashedTypes.insert(name).second )
+                continue;
+            changed = true;
+            auto it = structs.find(name);
+            if( it != structs.end() )
+                it->second->hash(hasher);
+        }
+    }
+
+    return hasher.result();
+}
+
+// Run work(0) .. work(count - 1) on up to `jobs` threads
+static void runParallel(size_t count, unsigned jobs, const std::function<void(size_t)>& work){
+    if( jobs <= 1 || count <= 1 ){
+        for(size_t i=0; i<count; i++){
+            work(i);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    for(unsigned t=0; t<jobs && t<count; t++){
+        workers.emplace_back([&](){
+            size_t i;
+            while( (i = next++) < count ){
+                work(i);
+            }
+        });
+    }
+    for(auto& worker: workers){
+        worker.join();
+    }
+}
+
+bool generateUnitBitcode(NBlock& root, const std::vector<NFunctionDeclaration*>& functions, unsigned optLevel, std::string& bitcode){
+    CodeGenContext unitContext;
+    unitContext.generateUnit(root, functions);
+
+    // the predeclared prototypes nobody in this unit calls
+    std::vector<Function*> unused;
+    for(auto& function: *unitContext.theModule){
+        if( function.isDeclaration() && function.use_empty() )
+            unused.push_back(&function);
+    }
+    for(auto function: unused){
+        function->eraseFromParent();
+    }
+
+    if( !optimizeModule(*unitContext.theModule, optLevel) )
+        return false;
+
+    raw_string_ostream stream(bitcode);
+    WriteBitcodeToFile(*unitContext.theModule, stream);
+    stream.flush();
+    return true;
+}
+
+bool linkUnits(CodeGenContext& context, const std::vector<CodeGenUnit>& units){
+    Linker linker(*context.theModule);
+
+    for(auto& unit: units){
+        const std::string& name = unit.functions.front()->id->name.str();
+        auto buffer = MemoryBuffer::getMemBuffer(unit.bitcode, name, false);
+        auto module = parseBitcodeFile(buffer->getMemBufferRef(), context.llvmContext);
+        if( !module ){
+            errs() << "Could not read the unit of " << name << ": " << toString(module.takeError()) << "\n";
+            return false;
+        }
+        if( linker.linkInModule(std::move(*module)) ){
+            errs() << "Could not link the unit of " << name << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+static std::vector<NFunctionDeclaration*> functionBodies(NBlock& root){
+    std::vector<NFunctionDeclaration*> bodies;
+    for(auto& statement: *root.statements){
+        auto function = dyn_cast<NFunctionDeclaration>(statement);
+        if( function && !function->external )
+            bodies.push_back(function);
+    }
+    return bodies;
+}
+
+static unsigned jobCount(const CompilerOptions& options){
+    if( options.jobs > 0 )
+        return options.jobs;
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+bool generateCodeParallel(NBlock& root, CodeGenContext& context, const CompilerOptions& options){
+    auto bodies = functionBodies(root);
+    unsigned jobs = jobCount(options);
+
+    // a few units per thread so an expensive function doesn't leave the
+    // other threads idle, but few enough that the prototypes every unit
+    // declares stay cheap
+    size_t unitCount = std::min<size_t>(bodies.size(), jobs * 4);
+    std::vector<CodeGenUnit> units(unitCount);
+    for(size_t i=0; i<bodies.size(); i++){
+        units[i * unitCount / bodies.size()].functions.push_back(bodies[i]);
+    }
+
+    std::atomic<bool> failed(false);
+    runParallel(units.size(), jobs, [&](size_t i){
+        if( !generateUnitBitcode(root, units[i].functions, 0, units[i].bitcode) )
+            failed = true;
+    });
+
+    return !failed && linkUnits(context, units);
+}
+
+bool generateCodeIncremental(NBlock& root, CodeGenContext& context, const CompilerOptions& options, const CompileCache& cache){
+    auto bodies = functionBodies(root);
+    std::vector<CodeGenUnit> units(bodies.size());
+    std::vector<size_t> misses;
+
+    for(size_t i=0; i<bodies.size(); i++){
+        units[i].functions.push_back(bodies[i]);
+        units[i].key = CompileCache::makeKey(fingerprintFunction(root, *bodies[i]), options);
+
+        if( auto cached = cache.load(units[i].key, ".bc") )
+            units[i].bitcode = cached->getBuffer().str();
+        else
+            misses.push_back(i);
+    }
+
+    std::atomic<bool> failed(false);
+    runParallel(misses.size(), jobCount(options), [&](size_t i){
+        CodeGenUnit& unit = units[misses[i]];
+        if( generateUnitBitcode(root, unit.functions, options.optLevel, unit.bitcode) )
+            cache.save(unit.key, ".bc", unit.bitcode);
+        else
+            failed = true;
+    });
+
+    if( failed || !linkUnits(context, units) )
+        return false;
+
+    errs() << "Incremental: reused " << (units.size() - misses.size()) << "/" << units.size() << " functions\n";
+    return true;
+}
@@ -0,0 +1,50 @@
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include <string>
+#include <vector>
+
+#include "ASTNodes.h"
+#include "CodeGen.h"
+#include "Cache.h"
+#include "Options.h"
+
+// Function granular code generation: the function bodies of the program are
+// generated into modules of their own (units) together with the struct types
+// and a prototype of every other function, then the units are linked.
+// Every unit has its own CodeGenContext, so units can be generated on
+// separate threads.
+
+class CodeGenUnit{
+public:
+    std::vector<NFunctionDeclaration*> functions;
+    // cache key of a single function unit, see fingerprintFunction
+    std::string key;
+    // the unit module, as bitcode so it can cross LLVMContexts
+    std::string bitcode;
+};
+
+// Only programs made of function and struct declarations can be split
+bool canPartition(NBlock& root);
+
+// Hash of the function subtree, the struct types it uses and the prototypes
+// of the functions it calls
+std::string fingerprintFunction(NBlock& root, NFunctionDeclaration& function);
+
+// Generate the unit of the given functions, optimized at optLevel, into
+// bitcode. false when the unit's module doesn't verify
+bool generateUnitBitcode(NBlock& root, const std::vector<NFunctionDeclaration*>& functions, unsigned optLevel, std::string& bitcode);
+
+// Link the units into context.theModule
+bool linkUnits(CodeGenContext& context, const std::vector<CodeGenUnit>& units);
+
+// Generate root split into units across options.jobs threads. The result is
+// not optimized yet.
+bool generateCodeParallel(NBlock& root, CodeGenContext& context, const CompilerOptions& options);
+
+// Generate root unit by unit, regenerating only the functions whose
+// fingerprint is not in the cache, in parallel with options.jobs. The units are optimized one by one, so
+// the caller must not run optimizeModule on the result.
+bool generateCodeIncremental(NBlock& root, CodeGenContext& context, const CompilerOptions& options, const CompileCache& cache);
+
+#endif //PARTITION_H
@@ -0,0 +1,504 @@
+#include <llvm/Support/raw_ostream.h>
+
+#include <unordered_map>
+
+#include "Semantic.h"
+#include "SymbolTable.h"
+#include "TypeSystem.h"
+#include "Builtins.h"
+#include "grammar.hpp"
+
+using namespace llvm;
+
+namespace {
+
+bool isComparison(int op){
+    return op == TCLT || op == TCLE || op == TCGE || op == TCGT || op == TCEQ || op == TCNE;
+}
+
+bool sameType(const NIdentifier* a, const NIdentifier* b){
+    // array rows are passed as pointers, the sizes don't matter
+    return a->name == b->name && a->isArray == b->isArray;
+}
+
+class SemanticAnalysis{
+private:
+    // declarations of the visible variables, scoped like the code generator
+    SymbolTable symbols;
+    std::unordered_map<Symbol, NFunctionDeclaration*> functions;
+    std::unordered_map<Symbol, NStructDeclaration*> structs;
+    // type nodes of the results that have no declaration to point to
+    std::unordered_map<Symbol, NIdentifier*> namedTypes;
+    NFunctionDeclaration* function = nullptr;
+    unsigned errors = 0;
+
+    Symbol boolName = Symbol("bool");
+    Symbol charName = Symbol("char");
+    Symbol intName = Symbol("int");
+    Symbol floatName = Symbol("float");
+    Symbol doubleName = Symbol("double");
+    Symbol stringName = Symbol("string");
+    Symbol voidName = Symbol("void");
+
+    void error(const std::string& message);
+    NIdentifier* typeNamed(Symbol name);
+    std::string describe(const NIdentifier* type) const;
+    bool isKnownType(const NIdentifier& type);
+    int rank(const NIdentifier* type) const;
+
+    NExpression* convert(NExpression* expr, NIdentifier* type);
+    NExpression* analyze(NExpression* expr);
+    void analyzeBinary(NBinaryOperator* binary);
+    void analyzeCall(NMethodCall* call);
+    void analyzeBuiltin(NMethodCall* call);
+    bool analyzeStructMember(NStructMember* member);
+    bool analyzeArrayIndex(NArrayIndex* index);
+    NVariableDeclaration* resolve(NIdentifier* id);
+    void declare(NVariableDeclaration* declaration);
+    void analyzeStatement(NStatement* statement);
+    void analyzeBlock(NBlock* block);
+    void analyzeScope(NBlock* block);
+
+public:
+    bool run(NBlock& program);
+};
+
+void SemanticAnalysis::error(const std::string& message){
+    errs() << "Semantic error: " << message << "\n";
+    errors++;
+}
+
+NIdentifier* SemanticAnalysis::typeNamed(Symbol name){
+    auto& type = namedTypes[name];
+    if( !type ){
+        type = new NIdentifier(name);
+        type->isType = true;
+    }
+    return type;
+}
+
+std::string SemanticAnalysis::describe(const NIdentifier* type) const{
+    return type->isArray ? type->name.str() + "[]" : type->name.str();
+}
+
+bool SemanticAnalysis::isKnownType(const NIdentifier& type){
+    Symbol element;
+    unsigned lanes;
+    return type.name == boolName || type.name == charName || type.name == intName ||
+           type.name == floatName || type.name == doubleName || type.name == stringName ||
+           type.name == voidName || structs.count(type.name) ||
+           TypeSystem::vectorElement(type.name, element, lanes);
+}
+
+// Order of the arithmetic promotions, 0 for the types that don't take part
+int SemanticAnalysis::rank(const NIdentifier* type) const{
+    if( type->isArray )
+        return 0;
+    if( type->name == boolName )
+        return 1;
+    if( type->name == charName )
+        return 2;
+    if( type->name == intName )
+        return 3;
+    if( type->name == floatName )
+        return 4;
+    if( type->name == doubleName )
+        return 5;
+    return 0;
+}
+
+// expr converted to type, an NCast unless it has that type already
+NExpression* SemanticAnalysis::convert(NExpression* expr, NIdentifier* type){
+    if( !expr || !type )
+        return expr;
+    if( !expr->resolvedType ){
+        // an assignment or a vector comparison, the code generator has no
+        // conversion for them
+        error("Expected a value of type " + describe(type));
+        return expr;
+    }
+    NIdentifier* from = expr->resolvedType;
+    if( sameType(from, type) )
+        return expr;
+    // a char array decays to the string of its elements
+    if( from->isArray && from->name == charName && !type->isArray && type->name == stringName )
+        return expr;
+
+    Symbol element;
+    unsigned lanes;
+    if( !from->isArray && !type->isArray ){
+        Symbol fromElement;
+        if( TypeSystem::vectorElement(type->name, element, lanes) && !TypeSystem::vectorElement(from->name, fromElement, lanes) ){
+            return new NCast(convert(expr, typeNamed(element)), type, 0, true);
+        }
+        CastInst::CastOps op;
+        if( TypeSystem::castOp(from->name, type->name, op) )
+            return new NCast(expr, type, op);
+    }
+    error("Unable to cast from " + describe(from) + " to " + describe(type));
+    return expr;
+}
+
+NVariableDeclaration* SemanticAnalysis::resolve(NIdentifier* id){
+    auto record = symbols.lookup(id->name);
+    if( !record || !record->declaration ){
+        error("Unknown variable name " + id->name.str());
+        return nullptr;
+    }
+    id->declaration = record->declaration;
+    id->resolvedType = record->type;
+    return record->declaration;
+}
+
+void SemanticAnalysis::declare(NVariableDeclaration* declaration){
+    if( !isKnownType(*declaration->type) )
+        error("Unknown type " + declaration->type->name.str() + " of " + declaration->id->name.str());
+    auto& record = symbols.define(declaration->id->name);
+    record.type = declaration->type;
+    record.declaration = declaration;
+}
+
+// Both operands converted to their common type: the vector one, else the
+// higher ranked scalar
+void SemanticAnalysis::analyzeBinary(NBinaryOperator* binary){
+    binary->lchild = analyze(binary->lchild);
+    binary->rchild = analyze(binary->rchild);
+    if( !binary->lchild || !binary->rchild )
+        return;
+    NIdentifier* L = binary->lchild->resolvedType;
+    NIdentifier* R = binary->rchild->resolvedType;
+    if( !L && !R )      // the masks of two vector comparisons
+        return;
+    if( !L || !R ){
+        error("Invalid operands of a binary operator");
+        return;
+    }
+    if( L->isArray || R->isArray )
+        return;
+
+    Symbol element;
+    unsigned lanes;
+    NIdentifier* common = nullptr;
+    bool vector = false;
+    if( TypeSystem::vectorElement(L->name, element, lanes) ){
+        common = L;
+        vector = true;
+    }else if( TypeSystem::vectorElement(R->name, element, lanes) ){
+        common = R;
+        vector = true;
+    }else if( rank(L) && rank(R) ){
+        common = rank(L) >= rank(R) ? L : R;
+    }else if( sameType(L, R) ){
+        common = L;
+    }else{
+        error("Invalid operands " + describe(L) + " and " + describe(R));
+        return;
+    }
+
+    binary->lchild = convert(binary->lchild, common);
+    binary->rchild = convert(binary->rchild, common);
+    if( !isComparison(binary->op) )
+        binary->resolvedType = common;
+    else if( !vector )
+        binary->resolvedType = typeNamed(boolName);
+    // a vector comparison is a mask, only the builtins take it
+}
+
+// A function of the program, else a builtin, else the runtime, the order
+// the code generator looks them up in
+void SemanticAnalysis::analyzeCall(NMethodCall* call){
+    for(auto& argument: *call->arguments){
+        argument = analyze(argument);
+    }
+    Symbol name = call->id->name;
+    auto userFunction = functions.find(name);
+    if( userFunction != functions.end() ){
+        NFunctionDeclaration* callee = userFunction->second;
+        if( callee->arguments->size() != call->arguments->size() ){
+            error(name.str() + " takes " + std::to_string(callee->arguments->size()) + " arguments, got " + std::to_string(call->arguments->size()));
+            return;
+        }
+        for(size_t i=0; i<call->arguments->size(); i++){
+            (*call->arguments)[i] = convert((*call->arguments)[i], (*callee->arguments)[i]->type);
+        }
+        call->resolvedType = callee->type;
+        return;
+    }
+    if( isBuiltin(name) ){
+        analyzeBuiltin(call);
+        return;
+    }
+    if( auto runtime = findRuntimeFunction(name) ){
+        if( runtime->argTypes.size() != call->arguments->size() ){
+            error(name.str() + " takes " + std::to_string(runtime->argTypes.size()) + " arguments, got " + std::to_string(call->arguments->size()));
+            return;
+        }
+        for(size_t i=0; i<call->arguments->size(); i++){
+            (*call->arguments)[i] = convert((*call->arguments)[i], typeNamed(Symbol(runtime->argTypes[i])));
+        }
+        call->resolvedType = typeNamed(Symbol(runtime->returnType));
+        return;
+    }
+    error("Function name not found: " + name.str());
+}
+
+// The result type of a builtin out of its arguments' types, and the value
+// of an insert or a fill converted to the lanes or elements it goes to. The
+// code generator checks the other arguments itself. Stays untyped where the
+// arguments are, and for shuffles to a lane count no type has
+void SemanticAnalysis::analyzeBuiltin(NMethodCall* call){
+    auto& arguments = *call->arguments;
+    const std::string& name = call->id->name.str();
+    NIdentifier* first = arguments.empty() ? nullptr : arguments[0]->resolvedType;
+    Symbol element;
+    unsigned lanes;
+    bool vector = first && !first->isArray && TypeSystem::vectorElement(first->name, element, lanes);
+
+    if( name == "extract" || name.compare(0, 7, "reduce_") == 0 ){
+        if( vector )
+            call->resolvedType = typeNamed(element);
+    }else if( name == "insert" ){
+        if( vector && arguments.size() == 3 ){
+            arguments[2] = convert(arguments[2], typeNamed(element));
+            call->resolvedType = first;
+        }
+    }else if( name == "shuffle" ){
+        size_t indices = 0;
+        for(auto argument: arguments){
+            if( isa<NInteger>(argument) )
+                indices++;
+        }
+        if( vector ){
+            Symbol shuffled(element.str() + std::to_string(indices));
+            if( TypeSystem::vectorElement(shuffled, element, lanes) )
+                call->resolvedType = typeNamed(shuffled);
+        }
+    }else if( name == "masked_load" ){
+        // the passthru's
+        if( arguments.size() == 4 )
+            call->resolvedType = arguments[3]->resolvedType;
+    }else{
+        if( name == "fill" && arguments.size() == 3 && first && first->isArray )
+            arguments[1] = convert(arguments[1], typeNamed(first->name));
+        call->resolvedType = typeNamed(voidName);
+    }
+}
+
+bool SemanticAnalysis::analyzeStructMember(NStructMember* member){
+    if( !resolve(member->id) )
+        return false;
+    NIdentifier* type = member->id->resolvedType;
+    auto structDeclaration = structs.find(type->name);
+    if( type->isArray || structDeclaration == structs.end() ){
+        error(member->id->name.str() + " is not a struct");
+        return false;
+    }
+    auto& members = *structDeclaration->second->members;
+    for(size_t i=0; i<members.size(); i++){
+        if( members[i]->id->name == member->member->name ){
+            member->memberIndex = i;
+            member->resolvedType = members[i]->type;
+            return true;
+        }
+    }
+    error("Unknown struct member " + type->name.str() + "." + member->member->name.str());
+    return false;
+}
+
+bool SemanticAnalysis::analyzeArrayIndex(NArrayIndex* index){
+    for(auto& subscript: *index->expressions){
+        subscript = convert(analyze(subscript), typeNamed(intName));
+    }
+    if( !resolve(index->arrayId) )
+        return false;
+    NIdentifier* type = index->arrayId->resolvedType;
+    if( !type->isArray ){
+        error(index->arrayId->name.str() + " is not an array");
+        return false;
+    }
+    if( type->arraySize->size() != index->expressions->size() ){
+        error("Wrong number of subscripts for " + index->arrayId->name.str());
+        return false;
+    }
+    index->resolvedType = typeNamed(type->name);
+    return true;
+}
+
+// The expression that replaces expr, typed
+NExpression* SemanticAnalysis::analyze(NExpression* expr){
+    if( !expr )
+        return expr;
+
+    switch( expr->kind ){
+        case NodeKind::Integer:
+            expr->resolvedType = typeNamed(intName);
+            break;
+        case NodeKind::Double:
+            expr->resolvedType = typeNamed(doubleName);
+            break;
+        case NodeKind::Literal:
+            expr->resolvedType = typeNamed(stringName);
+            break;
+        case NodeKind::Identifier:
+            resolve(cast<NIdentifier>(expr));
+            break;
+        case NodeKind::BinaryOperator:
+            analyzeBinary(cast<NBinaryOperator>(expr));
+            break;
+        case NodeKind::MethodCall:
+            analyzeCall(cast<NMethodCall>(expr));
+            break;
+        case NodeKind::Assignment: {
+            // the code generator's value of an assignment is the variable's
+            // address, it stays untyped
+            auto assignment = cast<NAssignment>(expr);
+            assignment->rchild = analyze(assignment->rchild);
+            if( resolve(assignment->lchild) )
+                assignment->rchild = convert(assignment->rchild, assignment->lchild->resolvedType);
+            break;
+        }
+        case NodeKind::StructMember:
+            analyzeStructMember(cast<NStructMember>(expr));
+            break;
+        case NodeKind::StructAssignment: {
+            auto assignment = cast<NStructAssignment>(expr);
+            assignment->expression = analyze(assignment->expression);
+            if( analyzeStructMember(assignment->structMember) )
+                assignment->expression = convert(assignment->expression, assignment->structMember->resolvedType);
+            break;
+        }
+        case NodeKind::ArrayIndex:
+            analyzeArrayIndex(cast<NArrayIndex>(expr));
+            break;
+        case NodeKind::ArrayAssignment: {
+            auto assignment = cast<NArrayAssignment>(expr);
+            assignment->expr = analyze(assignment->expr);
+            if( analyzeArrayIndex(assignment->arrayInx) )
+                assignment->expr = convert(assignment->expr, assignment->arrayInx->resolvedType);
+            break;
+        }
+        case NodeKind::Block:
+            analyzeBlock(cast<NBlock>(expr));
+            break;
+        default:
+            break;
+    }
+    return expr;
+}
+
+void SemanticAnalysis::analyzeStatement(NStatement* statement){
+    switch( statement->kind ){
+        case NodeKind::ExpressionStatement: {
+            auto expression = cast<NExpressionStatement>(statement);
+            expression->expr = analyze(expression->expr);
+            break;
+        }
+        case NodeKind::VariableDeclaration: {
+            // declared before its initial value, like the code generator does
+            auto declaration = cast<NVariableDeclaration>(statement);
+            declare(declaration);
+            declaration->expr = convert(analyze(declaration->expr), declaration->type);
+            break;
+        }
+        case NodeKind::ArrayInitialization: {
+            auto initialization = cast<NArrayInitialization>(statement);
+            NIdentifier* type = initialization->declaration->type;
+            declare(initialization->declaration);
+            if( !type->isArray || type->arraySize->size() != 1 ){
+                error("An initializer list needs a one-dimensional array, not " + describe(type));
+                break;
+            }
+            NIdentifier* element = typeNamed(initialization->declaration->type->name);
+            for(auto& expr: *initialization->expressionList){
+                expr = convert(analyze(expr), element);
+            }
+            break;
+        }
+        case NodeKind::FunctionDeclaration: {
+            auto declaration = cast<NFunctionDeclaration>(statement);
+            functions.emplace(declaration->id->name, declaration);
+            if( !isKnownType(*declaration->type) )
+                error("Unknown return type " + declaration->type->name.str() + " of " + declaration->id->name.str());
+            symbols.pushScope();
+            for(auto argument: *declaration->arguments){
+                declare(argument);
+            }
+            NFunctionDeclaration* outer = function;
+            function = declaration;
+            analyzeBlock(declaration->block);
+            function = outer;
+            symbols.popScope();
+            break;
+        }
+        case NodeKind::StructDeclaration: {
+            auto declaration = cast<NStructDeclaration>(statement);
+            structs.emplace(declaration->id->name, declaration);
+            break;
+        }
+        case NodeKind::ReturnStatement: {
+            auto ret = cast<NReturnStatement>(statement);
+            ret->expr = analyze(ret->expr);
+            if( function && function->type->name != voidName )
+                ret->expr = convert(ret->expr, function->type);
+            break;
+        }
+        case NodeKind::IfStatement: {
+            auto ifStatement = cast<NIfStatement>(statement);
+            ifStatement->condition = analyze(ifStatement->condition);
+            analyzeScope(ifStatement->tBlock);
+            analyzeScope(ifStatement->fBlock);
+            break;
+        }
+        case NodeKind::ForStatement: {
+            auto loop = cast<NForStatement>(statement);
+            loop->initial = analyze(loop->initial);
+            loop->condition = analyze(loop->condition);
+            loop->increase = analyze(loop->increase);
+            if( loop->reductions ){
+                for(auto& reduction: *loop->reductions){
+                    resolve(reduction.variable);
+                }
+            }
+            analyzeScope(loop->block);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void SemanticAnalysis::analyzeBlock(NBlock* block){
+    if( !block )
+        return;
+    for(auto statement: *block->statements){
+        analyzeStatement(statement);
+    }
+}
+
+// An if arm or loop body, the code generator opens a scope for it
+void SemanticAnalysis::analyzeScope(NBlock* block){
+    symbols.pushScope();
+    analyzeBlock(block);
+    symbols.popScope();
+}
+
+bool SemanticAnalysis::run(NBlock& program){
+    // functions and structs can be used before their declaration
+    for(auto statement: *program.statements){
+        if( auto declaration = dyn_cast<NFunctionDeclaration>(statement) )
+            functions[declaration->id->name] = declaration;
+        else if( auto declaration = dyn_cast<NStructDeclaration>(statement) )
+            structs[declaration->id->name] = declaration;
+    }
+    symbols.pushScope();
+    analyzeBlock(&program);
+    symbols.popScope();
+    return errors == 0;
+}
+
+}
+
+bool analyzeProgram(NBlock& program){
+    SemanticAnalysis analysis;
+    return analysis.run(program);
+}
@@ -0,0 +1,17 @@
+#ifndef SEMANTIC_H
+#define SEMANTIC_H
+
+#include "ASTNodes.h"
+
+// Type check the program before the code generation. Every variable is
+// resolved to its declaration, every expression gets its resolvedType and
+// the implicit conversions (assignments, arguments, returns, mixed
+// arithmetic, scalars broadcast to vectors) become NCast nodes, so the code
+// generator lowers them without looking at the operand types.
+// The calls of the builtins (Builtins.h) are typed from their arguments and
+// the values insert and fill store are converted like arguments, a vector
+// comparison stays an untyped mask only the builtins take.
+// Reports the errors to stderr, false if there were any.
+bool analyzeProgram(NBlock& program);
+
+#endif //SEMANTIC_H
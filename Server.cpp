@@ -0,0 +1,315 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "Server.h"
+
+using namespace llvm;
+
+// The wire format, all integers in host order:
+//   client: uint32 size with SCM_RIGHTS of its stdin, stdout and stderr,
+//           then size bytes of strings: the working directory and the
+//           arguments, each an uint32 length and the bytes
+//   server: int32 exit code once the request has finished
+
+static const unsigned passedFds = 3;
+// requests are command lines, anything larger is garbage
+static const uint32_t maxRequestSize = 1 << 20;
+
+// a peer that went away is an error, not a SIGPIPE
+static bool writeAll(int fd, const void* data, size_t size){
+    const char* p = (const char*)data;
+    while( size > 0 ){
+        ssize_t written = send(fd, p, size, MSG_NOSIGNAL);
+        if( written < 0 && errno == EINTR )
+            continue;
+        if( written <= 0 )
+            return false;
+        p += written;
+        size -= written;
+    }
+    return true;
+}
+
+static bool readAll(int fd, void* data, size_t size){
+    char* p = (char*)data;
+    while( size > 0 ){
+        ssize_t count = read(fd, p, size);
+        if( count < 0 && errno == EINTR )
+            continue;
+        if( count <= 0 )
+            return false;
+        p += count;
+        size -= count;
+    }
+    return true;
+}
+
+static bool socketAddress(const std::string& socketPath, sockaddr_un& address){
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if( socketPath.size() >= sizeof(address.sun_path) ){
+        errs() << "The socket path is too long: " << socketPath << "\n";
+        return false;
+    }
+    memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+    return true;
+}
+
+static void appendString(std::string& buffer, const std::string& text){
+    uint32_t length = text.size();
+    buffer.append((const char*)&length, sizeof(length));
+    buffer.append(text);
+}
+
+static bool takeString(const std::string& buffer, size_t& offset, std::string& text){
+    uint32_t length;
+    if( buffer.size() - offset < sizeof(length) )
+        return false;
+    memcpy(&length, buffer.data() + offset, sizeof(length));
+    offset += sizeof(length);
+    if( buffer.size() - offset < length )
+        return false;
+    text.assign(buffer, offset, length);
+    offset += length;
+    return true;
+}
+
+// Receive a request, the fds are -1 if none came with it. Reports a
+// malformed request, not a probe that sent nothing
+static bool receiveRequest(int connection, int fds[passedFds], std::string& cwd, std::vector<std::string>& args){
+    uint32_t size;
+    char control[CMSG_SPACE(sizeof(int) * passedFds)];
+    iovec part = { &size, sizeof(size) };
+    msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t count;
+    while( (count = recvmsg(connection, &message, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR ){
+    }
+    // a peer that closes without a request is probing for a live server
+    if( count == 0 )
+        return false;
+    if( count != sizeof(size) || (message.msg_flags & MSG_CTRUNC) ){
+        errs() << "Dropped a malformed request\n";
+        return false;
+    }
+    cmsghdr* header = CMSG_FIRSTHDR(&message);
+    if( !header || header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS ||
+        header->cmsg_len != CMSG_LEN(sizeof(int) * passedFds) ){
+        errs() << "Dropped a request without its streams\n";
+        return false;
+    }
+    memcpy(fds, CMSG_DATA(header), sizeof(int) * passedFds);
+
+    std::string buffer;
+    bool complete = size <= maxRequestSize;
+    if( complete ){
+        buffer.resize(size);
+        complete = readAll(connection, &buffer[0], size);
+    }
+    size_t offset = 0;
+    complete = complete && takeString(buffer, offset, cwd);
+    std::string arg;
+    while( complete && offset < buffer.size() ){
+        complete = takeString(buffer, offset, arg);
+        args.push_back(arg);
+    }
+    if( !complete )
+        errs() << "Dropped a malformed request\n";
+    return complete;
+}
+
+// Runs in a process of its own, forked for the connection: forks the
+// worker, waits for it and reports its exit code. The worker can crash
+// without leaving the client waiting
+static void serveConnection(int connection, const RequestHandler& handler){
+    int fds[passedFds] = { -1, -1, -1 };
+    std::string cwd;
+    std::vector<std::string> args;
+    if( !receiveRequest(connection, fds, cwd, args) ){
+        for(unsigned i=0; i<passedFds; i++){
+            if( fds[i] >= 0 )
+                close(fds[i]);
+        }
+        return;
+    }
+
+    pid_t worker = fork();
+    if( worker == 0 ){
+        close(connection);
+        signal(SIGPIPE, SIG_DFL);
+        // runServer keeps 0, 1 and 2 open, so the received fds are above them
+        for(unsigned i=0; i<passedFds; i++){
+            dup2(fds[i], i);
+            close(fds[i]);
+        }
+        if( chdir(cwd.c_str()) != 0 ){
+            errs() << "Can't change to " << cwd << ": " << strerror(errno) << "\n";
+            exit(1);
+        }
+        // exit, not _exit, so the program output buffered by stdio is flushed
+        exit(handler(args));
+    }
+    for(unsigned i=0; i<passedFds; i++){
+        close(fds[i]);
+    }
+
+    int32_t exitCode = 1;
+    int status;
+    if( worker > 0 ){
+        while( waitpid(worker, &status, 0) < 0 && errno == EINTR ){
+        }
+        if( WIFEXITED(status) )
+            exitCode = WEXITSTATUS(status);
+        else if( WIFSIGNALED(status) )
+            exitCode = 128 + WTERMSIG(status);
+    }else{
+        errs() << "Can't fork a worker: " << strerror(errno) << "\n";
+    }
+    writeAll(connection, &exitCode, sizeof(exitCode));
+}
+
+static std::string serverSocketPath;
+
+static void removeSocket(int signal){
+    unlink(serverSocketPath.c_str());
+    _exit(128 + signal);
+}
+
+int runServer(const std::string& socketPath, const RequestHandler& handler){
+    // descriptors 0 to 2 of a detached server may be closed, they would be
+    // handed out for the client's streams and clobbered by the dup2s
+    for(int fd=0; fd<(int)passedFds; fd++){
+        if( fcntl(fd, F_GETFD) < 0 )
+            open("/dev/null", O_RDWR);
+    }
+
+    sockaddr_un address;
+    if( !socketAddress(socketPath, address) )
+        return 1;
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if( listener < 0 ){
+        errs() << "Can't create the socket: " << strerror(errno) << "\n";
+        return 1;
+    }
+    // a socket left behind by a server that is gone is replaced, a live
+    // one is not
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if( probe >= 0 && connect(probe, (sockaddr*)&address, sizeof(address)) == 0 ){
+        errs() << "A server is already listening on " << socketPath << "\n";
+        close(probe);
+        close(listener);
+        return 1;
+    }
+    if( probe >= 0 )
+        close(probe);
+    unlink(socketPath.c_str());
+
+    // the workers run the programs of --jit requests, only the user may connect
+    mode_t mask = umask(0177);
+    int bound = bind(listener, (sockaddr*)&address, sizeof(address));
+    umask(mask);
+    if( bound != 0 || listen(listener, 64) != 0 ){
+        errs() << "Can't listen on " << socketPath << ": " << strerror(errno) << "\n";
+        close(listener);
+        return 1;
+    }
+
+    serverSocketPath = socketPath;
+    signal(SIGINT, removeSocket);
+    signal(SIGTERM, removeSocket);
+    // the connection processes are reaped by the kernel
+    signal(SIGCHLD, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+
+    for(;;){
+        int connection = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if( connection < 0 ){
+            if( errno != EINTR && errno != ECONNABORTED )
+                errs() << "accept failed: " << strerror(errno) << "\n";
+            continue;
+        }
+        pid_t child = fork();
+        if( child == 0 ){
+            close(listener);
+            signal(SIGINT, SIG_DFL);
+            signal(SIGTERM, SIG_DFL);
+            // waitpid needs the worker's status
+            signal(SIGCHLD, SIG_DFL);
+            serveConnection(connection, handler);
+            _exit(0);
+        }
+        if( child < 0 )
+            errs() << "Can't fork: " << strerror(errno) << "\n";
+        close(connection);
+    }
+}
+
+bool forwardToServer(const std::string& socketPath, const std::vector<std::string>& args, int& exitCode){
+    sockaddr_un address;
+    if( !socketAddress(socketPath, address) )
+        return false;
+    int connection = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if( connection < 0 )
+        return false;
+    if( connect(connection, (sockaddr*)&address, sizeof(address)) != 0 ){
+        close(connection);
+        return false;
+    }
+
+    char* cwd = getcwd(nullptr, 0);
+    std::string payload;
+    appendString(payload, cwd ? cwd : ".");
+    free(cwd);
+    for(auto& arg: args){
+        appendString(payload, arg);
+    }
+
+    uint32_t size = payload.size();
+    int fds[passedFds] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    iovec part = { &size, sizeof(size) };
+    msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(header), fds, sizeof(fds));
+
+    // once the request is sent the server owns it, a failure after that is
+    // reported rather than compiled again
+    exitCode = 1;
+    ssize_t sent;
+    while( (sent = sendmsg(connection, &message, MSG_NOSIGNAL)) < 0 && errno == EINTR ){
+    }
+    int32_t code;
+    if( sent != sizeof(size) || !writeAll(connection, payload.data(), payload.size()) ||
+        !readAll(connection, &code, sizeof(code)) ){
+        errs() << "The compile server at " << socketPath << " dropped the request\n";
+    }else{
+        exitCode = code;
+    }
+    close(connection);
+    return true;
+}
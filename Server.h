@@ -0,0 +1,31 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// Compile server on a Unix domain socket. A request is the command line of
+// a compiler invocation, the client's working directory and its stdin,
+// stdout and stderr (passed as file descriptors). The server forks a
+// worker per request from its warm process (what it prepared before the
+// first request, see serve() in main.cpp), the worker runs the request
+// in the client's directory with the client's standard streams, so reading
+// the source, writing the objects, the error messages and the output of
+// --jit programs behave as if the client had compiled itself. The exit code
+// goes back to the client.
+
+// Runs a request in the worker, returns its exit code
+typedef std::function<int(std::vector<std::string>& args)> RequestHandler;
+
+// Serve requests on socketPath until the process is killed. Every worker
+// is forked from the calling process, which must not have started threads.
+// Returns 1 if the socket can't be set up.
+int runServer(const std::string& socketPath, const RequestHandler& handler);
+
+// Send the request to the server at socketPath and wait for its exit code.
+// False if there's no server listening there, the caller compiles itself
+// then.
+bool forwardToServer(const std::string& socketPath, const std::vector<std::string>& args, int& exitCode);
+
+#endif //SERVER_H
@@ -0,0 +1,107 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "Source.h"
+
+using namespace llvm;
+
+// the spans count bytes in 32 bits, the padding included
+static const size_t maxSourceSize = UINT32_MAX - 2;
+
+SourceBuffer::~SourceBuffer(){
+    if( mappedLength )
+        munmap(data, mappedLength);
+    else
+        free(data);
+}
+
+bool SourceBuffer::allocate(size_t capacity){
+    char* grown = (char*)realloc(data, capacity);
+    if( !grown ){
+        errs() << "Out of memory reading the source\n";
+        return false;
+    }
+    data = grown;
+    return true;
+}
+
+bool SourceBuffer::mapFile(const char* path){
+    int fd = open(path, O_RDONLY);
+    if( fd < 0 ){
+        errs() << "Can't open " << path << ": " << strerror(errno) << "\n";
+        return false;
+    }
+    struct stat status;
+    if( fstat(fd, &status) != 0 || !S_ISREG(status.st_mode) ){
+        // pipes and devices can't be mapped
+        FILE* input = fdopen(fd, "rb");
+        bool result = input && readStream(input);
+        if( input )
+            fclose(input);
+        else
+            close(fd);
+        return result;
+    }
+    if( (size_t)status.st_size > maxSourceSize ){
+        errs() << path << " is too large, the sources are limited to 4GB\n";
+        close(fd);
+        return false;
+    }
+
+    // Reserve room for the file and the padding, then map the file over its
+    // start. The rest of the last file page reads as zeros, if the file
+    // fills it the padding is in the anonymous page behind it
+    size = status.st_size;
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    mappedLength = (size + 2 + pageSize - 1) / pageSize * pageSize;
+    void* region = mmap(nullptr, mappedLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if( region == MAP_FAILED ){
+        errs() << "Can't map " << path << ": " << strerror(errno) << "\n";
+        mappedLength = 0;
+        close(fd);
+        return false;
+    }
+    data = (char*)region;
+    if( size > 0 ){
+        if( mmap(data, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED ){
+            errs() << "Can't map " << path << ": " << strerror(errno) << "\n";
+            close(fd);
+            return false;
+        }
+        madvise(data, size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+    return true;
+}
+
+bool SourceBuffer::readStream(FILE* input){
+    size_t capacity = 1 << 16;
+    size = 0;
+    if( !allocate(capacity) )
+        return false;
+    size_t count;
+    while( (count = fread(data + size, 1, capacity - size - 2, input)) > 0 ){
+        size += count;
+        if( size > maxSourceSize ){
+            errs() << "The source is too large, the sources are limited to 4GB\n";
+            return false;
+        }
+        if( capacity - size - 2 == 0 ){
+            capacity *= 2;
+            if( !allocate(capacity) )
+                return false;
+        }
+    }
+    if( ferror(input) ){
+        errs() << "Can't read the source: " << strerror(errno) << "\n";
+        return false;
+    }
+    data[size] = data[size + 1] = '\0';
+    return true;
+}
@@ -0,0 +1,53 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <llvm/ADT/StringRef.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Where a token is in the source buffer, the lexer hands these to the
+// parser instead of copying the token text
+class SourceSpan{
+public:
+    uint32_t offset;
+    uint32_t length;
+};
+
+// The program text, followed by the two NUL bytes flex's yy_scan_buffer
+// needs. A regular file is mapped instead of read, the lexer runs over the
+// mapping directly. The mapping is private and writable: flex puts a NUL
+// after every token while its action runs.
+class SourceBuffer{
+private:
+    char* data = nullptr;
+    size_t size = 0;
+    // length of the mapping, 0 if data is malloc'ed
+    size_t mappedLength = 0;
+
+    bool allocate(size_t capacity);
+
+public:
+    SourceBuffer(){}
+    SourceBuffer(const SourceBuffer&) = delete;
+    SourceBuffer& operator=(const SourceBuffer&) = delete;
+    ~SourceBuffer();
+
+    // Reports the errors to stderr, false if there were any
+    bool mapFile(const char* path);
+    bool readStream(FILE* input);
+
+    llvm::StringRef text() const{
+        return llvm::StringRef(data, size);
+    }
+
+    // the text and the padding, what yy_scan_buffer takes
+    char* scanBuffer(){
+        return data;
+    }
+    size_t scanLength() const{
+        return size + 2;
+    }
+};
+
+#endif //SOURCE_H
@@ -0,0 +1,124 @@
+#include <llvm/ADT/Hashing.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/ErrorHandling.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+#include "Symbol.h"
+
+namespace {
+
+struct NameHash{
+    size_t operator()(llvm::StringRef name) const{
+        return llvm::hash_value(name);
+    }
+};
+
+typedef std::unordered_map<llvm::StringRef, uint32_t, NameHash> IdMap;
+
+// The names by id, in chunks that are allocated once and never move, so
+// str() reads them without a lock
+class NameTable{
+private:
+    static const uint32_t ChunkBits = 12;
+    static const uint32_t ChunkSize = 1u << ChunkBits;
+    static const uint32_t MaxChunks = 1u << 12;
+
+    std::atomic<std::atomic<const std::string*>*> chunks[MaxChunks];
+    std::mutex growLock;
+
+public:
+    NameTable(){
+        for(auto& chunk: chunks){
+            chunk.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    void set(uint32_t id, const std::string* name){
+        if( id >= ChunkSize * MaxChunks )
+            llvm::report_fatal_error("Too many distinct identifiers");
+        auto& slot = chunks[id >> ChunkBits];
+        std::atomic<const std::string*>* chunk = slot.load(std::memory_order_acquire);
+        if( !chunk ){
+            std::lock_guard<std::mutex> guard(growLock);
+            chunk = slot.load(std::memory_order_acquire);
+            if( !chunk ){
+                chunk = new std::atomic<const std::string*>[ChunkSize]();
+                slot.store(chunk, std::memory_order_release);
+            }
+        }
+        chunk[id & (ChunkSize - 1)].store(name, std::memory_order_release);
+    }
+
+    const std::string& get(uint32_t id) const{
+        return *chunks[id >> ChunkBits].load(std::memory_order_acquire)[id & (ChunkSize - 1)].load(std::memory_order_acquire);
+    }
+};
+
+// The names are spread over shards by hash so threads interning different
+// names rarely meet on a lock, and every thread keeps the ids it has looked
+// up before in a cache of its own that needs no lock at all
+class SymbolInterner{
+private:
+    static const size_t ShardCount = 16;
+
+    struct Shard{
+        std::mutex lock;
+        // a deque never moves its elements, so the keys can point into it
+        // and looking a name up doesn't have to copy it
+        std::deque<std::string> names;
+        IdMap ids;
+    };
+
+    Shard shards[ShardCount];
+    std::atomic<uint32_t> nextId;
+    NameTable table;
+
+public:
+    SymbolInterner(): nextId(0){
+        intern(llvm::StringRef());
+    }
+
+    uint32_t intern(llvm::StringRef name){
+        static thread_local IdMap seen;
+        auto known = seen.find(name);
+        if( known != seen.end() )
+            return known->second;
+
+        size_t hash = NameHash()(name);
+        Shard& shard = shards[hash % ShardCount];
+        std::lock_guard<std::mutex> guard(shard.lock);
+        auto it = shard.ids.find(name);
+        if( it == shard.ids.end() ){
+            uint32_t id = nextId++;
+            shard.names.emplace_back(name.str());
+            table.set(id, &shard.names.back());
+            it = shard.ids.emplace(llvm::StringRef(shard.names.back()), id).first;
+        }
+        seen.emplace(it->first, it->second);
+        return it->second;
+    }
+
+    const std::string& name(uint32_t id) const{
+        return table.get(id);
+    }
+};
+
+SymbolInterner& interner(){
+    static SymbolInterner instance;
+    return instance;
+}
+
+}
+
+Symbol::Symbol(const std::string &name): id(interner().intern(name)) {
+}
+
+Symbol::Symbol(const char *name, size_t length): id(interner().intern(llvm::StringRef(name, length))) {
+}
+
+const std::string& Symbol::str() const {
+    return interner().name(id);
+}
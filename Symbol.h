@@ -0,0 +1,69 @@
+#ifndef SYMBOL_H
+#define SYMBOL_H
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <ostream>
+#include <string>
+
+// Interned identifier. Equal names share one 32-bit id for the lifetime of
+// the process, so symbols compare and hash as integers. The interner is
+// shared by all threads, str() and the lookup of a name the thread has
+// interned before take no lock.
+class Symbol{
+private:
+    uint32_t id;
+
+public:
+    Symbol(): id(0){
+    }
+
+    explicit Symbol(const std::string& name);
+    Symbol(const char* name, size_t length);
+
+    // The lexer passes symbols through the bison union, which needs a
+    // trivial type
+    static Symbol fromId(uint32_t id){
+        Symbol symbol;
+        symbol.id = id;
+        return symbol;
+    }
+
+    uint32_t getId() const{
+        return id;
+    }
+
+    // id 0 is the empty name, used for "no symbol"
+    bool empty() const{
+        return id == 0;
+    }
+
+    const std::string& str() const;
+
+    bool operator==(Symbol other) const{
+        return id == other.id;
+    }
+
+    bool operator!=(Symbol other) const{
+        return id != other.id;
+    }
+
+    bool operator<(Symbol other) const{
+        return id < other.id;
+    }
+};
+
+inline std::ostream& operator<<(std::ostream& os, Symbol symbol){
+    return os << symbol.str();
+}
+
+namespace std {
+template<> struct hash<Symbol>{
+    size_t operator()(Symbol symbol) const{
+        return symbol.getId();
+    }
+};
+}
+
+#endif
@@ -0,0 +1,85 @@
+#include "SymbolTable.h"
+#include <cassert>
+
+static inline uint32_t hashKey(uint32_t key){
+    return key * 0x9E3779B1u;
+}
+
+SymbolTable::SymbolTable(): slots(64, Slot{0, Unbound}) {
+}
+
+SymbolTable::Slot* SymbolTable::findSlot(uint32_t key) {
+    return const_cast<Slot*>(static_cast<const SymbolTable*>(this)->findSlot(key));
+}
+
+// Linear probing, returns the slot holding key or the free slot where it
+// belongs. The table is never full, see grow()
+const SymbolTable::Slot* SymbolTable::findSlot(uint32_t key) const {
+    uint32_t mask = slots.size() - 1;
+    uint32_t i = hashKey(key) & mask;
+    while( slots[i].key != key && slots[i].key != 0 ){
+        i = (i + 1) & mask;
+    }
+    return &slots[i];
+}
+
+void SymbolTable::grow() {
+    std::vector<Slot> old(slots.size() * 2, Slot{0, Unbound});
+    old.swap(slots);
+    for(auto& slot: old){
+        if( slot.key != 0 )
+            *findSlot(slot.key) = slot;
+    }
+}
+
+void SymbolTable::pushScope() {
+    scopes.push_back(std::make_pair(records.size(), undoLog.size()));
+}
+
+void SymbolTable::popScope() {
+    assert(!scopes.empty());
+    auto marks = scopes.back();
+    scopes.pop_back();
+    while( undoLog.size() > marks.second ){
+        Undo& undo = undoLog.back();
+        findSlot(undo.key)->record = undo.previous;
+        undoLog.pop_back();
+    }
+    records.resize(marks.first);
+}
+
+const SymbolRecord* SymbolTable::lookup(Symbol name) const {
+    const Slot* slot = findSlot(name.getId() + 1);
+    if( slot->key == 0 || slot->record == Unbound )
+        return nullptr;
+    return &records[slot->record];
+}
+
+SymbolRecord& SymbolTable::define(Symbol name) {
+    assert(!scopes.empty());
+    uint32_t key = name.getId() + 1;
+    Slot* slot = findSlot(key);
+    if( slot->key == 0 ){
+        if( (usedSlots + 1) * 2 > slots.size() ){
+            grow();
+            slot = findSlot(key);
+        }
+        slot->key = key;
+        slot->record = Unbound;
+        usedSlots++;
+    }
+
+    if( slot->record != Unbound && (size_t)slot->record >= scopes.back().first )
+        return records[slot->record];
+
+    undoLog.push_back(Undo{key, slot->record});
+    if( slot->record == Unbound ){
+        records.emplace_back();
+        records.back().name = name;
+    }else{
+        SymbolRecord shadowed = records[slot->record];
+        records.push_back(std::move(shadowed));
+    }
+    slot->record = records.size() - 1;
+    return records.back();
+}
@@ -0,0 +1,77 @@
+#ifndef SYMBOLTABLE_H
+#define SYMBOLTABLE_H
+
+#include <cstdint>
+#include <vector>
+#include "Symbol.h"
+
+class NIdentifier;
+class NVariableDeclaration;
+
+// What the constant folding and the semantic analysis know about one visible name
+class SymbolRecord{
+public:
+    Symbol name;
+    NIdentifier* type = nullptr;
+    NVariableDeclaration* declaration = nullptr;
+};
+
+// Scoped symbol table. Each symbol maps to its innermost record through an
+// open addressing hash table keyed by the symbol id. Binding a symbol in a
+// scope logs the record it shadows, popScope replays the log backwards, so
+// lookups never walk the scope stack.
+class SymbolTable{
+private:
+    static const int32_t Unbound = -1;
+
+    struct Slot{
+        uint32_t key;       // symbol id + 1, 0 marks a free slot
+        int32_t record;     // index into records, or Unbound
+    };
+
+    struct Undo{
+        uint32_t key;
+        int32_t previous;
+    };
+
+    std::vector<Slot> slots;
+    uint32_t usedSlots = 0;
+    std::vector<SymbolRecord> records;
+    std::vector<Undo> undoLog;
+    // records.size() and undoLog.size() when each scope was opened
+    std::vector<std::pair<size_t, size_t>> scopes;
+
+    Slot* findSlot(uint32_t key);
+    const Slot* findSlot(uint32_t key) const;
+    void grow();
+
+public:
+    SymbolTable();
+
+    void pushScope();
+    void popScope();
+
+    size_t depth() const{
+        return scopes.size();
+    }
+
+    // Innermost record of name, nullptr if it is not visible
+    const SymbolRecord* lookup(Symbol name) const;
+    // Record of name in the current scope. The first write in a scope starts
+    // from a copy of the record it shadows. The reference is only valid until
+    // the next define or popScope.
+    SymbolRecord& define(Symbol name);
+
+    // Visit all records, outermost scope first, including shadowed ones
+    template<typename Visitor>
+    void forEach(Visitor visit) const{
+        size_t scope = 0;
+        for(size_t i=0; i<records.size(); i++){
+            while( scope + 1 < scopes.size() && scopes[scope + 1].first <= i )
+                scope++;
+            visit(scope, records[i]);
+        }
+    }
+};
+
+#endif
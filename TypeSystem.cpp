@@ -19,8 +19,10 @@ string TypeSystem::llvmTypeToStr(Type *value) {
             return "ArrayTyID";
         case Type::PointerTyID:
             return "PointerTyID";
-        case Type::VectorTyID:
-            return "VectorTyID";
+        case Type::FixedVectorTyID:
+            return "FixedVectorTyID";
+        case Type::ScalableVectorTyID:
+            return "ScalableVectorTyID";
         case Type::VoidTyID:
             return "VoidTyID";
         case Type::HalfTyID:
@@ -42,24 +44,91 @@ string TypeSystem::llvmTypeToStr(Value *value) {
         return "Value is nullptr";
 }
 
+// The conversions between the builtin types, in the language's type names
+static const struct{
+    const char* from;
+    const char* to;
+    CastInst::CastOps op;
+} scalarCasts[] = {
+    {"float", "double", CastInst::FPExt},
+    {"float", "int", CastInst::FPToSI},
+    {"double", "int", CastInst::FPToSI},
+    {"int", "float", CastInst::SIToFP},
+    {"int", "double", CastInst::SIToFP},
+    {"bool", "double", CastInst::SIToFP},
+    {"bool", "int", CastInst::ZExt},
+    {"double", "float", CastInst::FPTrunc},
+    {"int", "char", CastInst::Trunc},
+    {"char", "int", CastInst::SExt},
+};
+
+static const unsigned vectorLanes[] = {2, 4, 8, 16};
+
 TypeSystem::TypeSystem(LLVMContext &context): llvmContext(context){
-    addCast(floatTy, doubleTy, llvm::CastInst::FPExt);
-    addCast(floatTy, intTy, llvm::CastInst::FPToSI);
-    addCast(doubleTy, intTy, llvm::CastInst::FPToSI);
-    addCast(intTy, intTy, llvm::CastInst::SExt);
-    addCast(intTy, floatTy, llvm::CastInst::SIToFP);
-    addCast(intTy, doubleTy, llvm::CastInst::SIToFP);
-    addCast(boolTy, doubleTy, llvm::CastInst::SIToFP);
+    builtinTypes[Symbol("bool")] = boolTy;
+    builtinTypes[Symbol("char")] = charTy;
+    builtinTypes[Symbol("void")] = voidTy;
+    builtinTypes[Symbol("int")] = intTy;
+    builtinTypes[Symbol("float")] = floatTy;
+    builtinTypes[Symbol("double")] = doubleTy;
+    builtinTypes[Symbol("string")] = stringTy;
+
+    // SIMD types, float4 is <4 x float>. Vectors of the same width cast lane
+    // by lane like their elements do
+    const std::pair<const char*, Type*> elementTypes[] = {
+        {"char", charTy}, {"int", intTy}, {"float", floatTy}, {"double", doubleTy}
+    };
+    for(unsigned lanes: vectorLanes){
+        for(auto& element: elementTypes){
+            builtinTypes[Symbol(element.first + std::to_string(lanes))] = FixedVectorType::get(element.second, lanes);
+        }
+    }
+}
+
+bool TypeSystem::vectorElement(Symbol typeName, Symbol& element, unsigned& lanes) {
+    const std::string& name = typeName.str();
+    for(unsigned width: vectorLanes){
+        std::string suffix = std::to_string(width);
+        if( name.size() <= suffix.size() || name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0 )
+            continue;
+        std::string elementName = name.substr(0, name.size() - suffix.size());
+        if( elementName == "char" || elementName == "int" || elementName == "float" || elementName == "double" ){
+            element = Symbol(elementName);
+            lanes = width;
+            return true;
+        }
+    }
+    return false;
 }
 
-void TypeSystem::addStructMember(string structName, string memType, string memName) {
+bool TypeSystem::castOp(Symbol from, Symbol to, CastInst::CastOps& op) {
+    Symbol fromElement, toElement;
+    unsigned fromLanes, toLanes;
+    bool fromVector = vectorElement(from, fromElement, fromLanes);
+    bool toVector = vectorElement(to, toElement, toLanes);
+    if( fromVector || toVector ){
+        if( !fromVector || !toVector || fromLanes != toLanes )
+            return false;
+        from = fromElement;
+        to = toElement;
+    }
+    for(auto& scalarCast: scalarCasts){
+        if( from.str() == scalarCast.from && to.str() == scalarCast.to ){
+            op = scalarCast.op;
+            return true;
+        }
+    }
+    return false;
+}
+
+void TypeSystem::addStructMember(Symbol structName, Symbol memType, Symbol memName) {
     if( this->structTypes.find(structName) == this->structTypes.end() ){
         LogError("Unknown struct name");
     }
     this->structMembers[structName].push_back(std::make_pair(memType, memName));
 }
 
-void TypeSystem::addStructType(string name, llvm::StructType *type) {
+void TypeSystem::addStructType(Symbol name, llvm::StructType *type) {
     this->structTypes[name] = type;
     this->structMembers[name] = std::vector<TypeNamePair>();
 }
@@ -67,7 +136,8 @@ void TypeSystem::addStructType(string name, llvm::StructType *type) {
 Type *TypeSystem::getVarType(const NIdentifier& type) {
     assert(type.isType);
     if( type.isArray ){  
-        return PointerType::get(getVarType(type.name), 0);
+        // arrays are passed around as a pointer to their first row, like C
+        return PointerType::get(getArrayType(type, 1), 0);
     }
 
     return getVarType(type.name);
@@ -75,54 +145,35 @@ Type *TypeSystem::getVarType(const NIdentifier& type) {
     return 0;
 }
 
+Type *TypeSystem::getArrayType(const NIdentifier& type, size_t firstDim) {
+    Type* arrayType = getVarType(type.name);
+    if( !type.arraySize )
+        return arrayType;
+    for(size_t i=type.arraySize->size(); i>firstDim; i--){
+        arrayType = ArrayType::get(arrayType, llvm::cast<NInteger>(type.arraySize->at(i-1))->value);
+    }
+    return arrayType;
+}
+
 
 
-Value* TypeSystem::getDefaultValue(string typeStr, LLVMContext &context) {
-    Type* type = this->getVarType(typeStr);
+Value* TypeSystem::getDefaultValue(Symbol typeName, LLVMContext &context) {
+    Type* type = this->getVarType(typeName);
     if( type == this->intTy ){
         return ConstantInt::get(type, 0, true);
     }else if( type == this->doubleTy || type == this->floatTy ){
         return ConstantFP::get(type, 0);
+    }else if( type && type->isVectorTy() ){
+        return Constant::getNullValue(type);
     }
     return nullptr;
 }
 
-//add the valid cast in the context
-void TypeSystem::addCast(Type *from, Type *to, CastInst::CastOps op) {
-    if( castTable.find(from) == castTable.end() ){
-        castTable[from] = std::map<Type*, CastInst::CastOps>();
-    }
-    castTable[from][to] = op;
-}
-
-//Cast the type of a value in the current block
-Value* TypeSystem::cast(Value *value, Type *type, BasicBlock *block) {
-    Type* from = value->getType();
-    if( from == type )
-        return value;
-    if( castTable.find(from) == castTable.end() ){
-        LogError("Type has no cast");
-        return value;
-    }
-    //find the type to be cast in the second map get from the first map
-    if( castTable[from].find(type) == castTable[from].end() ){
-        //Error handle
-        string error = "Unable to cast from ";
-        error += llvmTypeToStr(from) + " to " + llvmTypeToStr(type);
-        LogError(error.c_str());
-        return value;
-    }
-
-    //The real transfer
-    //Insert a instruction to tranfer type in the positon it should be
-    return CastInst::Create(castTable[from][type], value, type, "cast", block);
-}
-
-bool TypeSystem::isStruct(string typeStr) const {
-    return this->structTypes.find(typeStr) != this->structTypes.end();
+bool TypeSystem::isStruct(Symbol typeName) const {
+    return this->structTypes.find(typeName) != this->structTypes.end();
 }
 
-int32_t TypeSystem::getStructMemberIndex(string structName, string memberName) {
+int32_t TypeSystem::getStructMemberIndex(Symbol structName, Symbol memberName) {
     if( this->structTypes.find(structName) == this->structTypes.end() ){
         LogError("Unknown struct name");
         return 0;
@@ -139,32 +190,14 @@ int32_t TypeSystem::getStructMemberIndex(string structName, string memberName) {
     return 0;
 }
 
-Type *TypeSystem::getVarType(string typeStr) {
-    if( typeStr.compare("bool") == 0 ){
-        return this->boolTy;
-    }
-    if( typeStr.compare("char") == 0 ){
-        return this->charTy;
-    }
-    if( typeStr.compare("void") == 0 ){
-        return this->voidTy;
-    }
-    if( typeStr.compare("int") == 0 ){
-        return this->intTy;
-    }
-    if( typeStr.compare("float") == 0 ){
-        return this->floatTy;
-    }
-    if( typeStr.compare("double") == 0 ){
-        return this->doubleTy;
-    }
-    if( typeStr.compare("string") == 0 ){
-        return this->stringTy;
-    }
+Type *TypeSystem::getVarType(Symbol typeName) {
+    auto builtin = this->builtinTypes.find(typeName);
+    if( builtin != this->builtinTypes.end() )
+        return builtin->second;
 
-    if( this->structTypes.find(typeStr) != this->structTypes.end() )
-        return this->structTypes[typeStr];
+    auto structType = this->structTypes.find(typeName);
+    if( structType != this->structTypes.end() )
+        return structType->second;
 
     return nullptr;
 }
-
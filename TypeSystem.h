@@ -8,7 +8,6 @@
 #include <llvm/IR/Module.h>
 
 #include <string>
-#include <map>
 #include <unordered_map>
 #include <vector>
 #include <stdint.h>
@@ -18,7 +17,7 @@
 using std::string;
 using namespace llvm;
 
-#define TypeNamePair std::pair<std::string,std::string>
+#define TypeNamePair std::pair<Symbol,Symbol>
 #define ENABLE 1
 #define DISABLE 2
 
@@ -26,13 +25,11 @@ class TypeSystem{
 private:
     LLVMContext& llvmContext;
 
-    std::map<std::string, std::vector<TypeNamePair>> structMembers;
+    std::unordered_map<Symbol, std::vector<TypeNamePair>> structMembers;
 
-    std::map<std::string, llvm::StructType*> structTypes;
+    std::unordered_map<Symbol, llvm::StructType*> structTypes;
 
-    std::map<Type*, std::map<Type*, CastInst::CastOps>> castTable;
-
-    void addCast(Type* from, Type* to, CastInst::CastOps op);
+    std::unordered_map<Symbol, Type*> builtinTypes;
 
     bool flag=0;
     uint8_t state=ENABLE;
@@ -49,18 +46,26 @@ public:
 
     TypeSystem(LLVMContext& context);
 
-    void addStructType(string structName, llvm::StructType*);
-    void addStructMember(string structName, string memType, string memName);
+    void addStructType(Symbol structName, llvm::StructType*);
+    void addStructMember(Symbol structName, Symbol memType, Symbol memName);
 
-    int32_t getStructMemberIndex(string structName, string memberName);
+    int32_t getStructMemberIndex(Symbol structName, Symbol memberName);
 
     Type* getVarType(const NIdentifier& type) ;
-    Type* getVarType(string typeStr) ;
+    Type* getVarType(Symbol typeName) ;
+    // Nested array type of the dimensions from firstDim on, int[2][3] is [2 x [3 x i32]]
+    Type* getArrayType(const NIdentifier& type, size_t firstDim = 0) ;
+
+    Value* getDefaultValue(Symbol typeName, LLVMContext &context) ;
 
-    Value* getDefaultValue(string typeStr, LLVMContext &context) ;
-    Value* cast(Value* value, Type* type, BasicBlock* block) ;
+    // The cast instruction between two builtin types of the language, false
+    // if they don't convert. Needs no LLVMContext, the semantic analysis
+    // decides the casts with it before any code is generated
+    static bool castOp(Symbol from, Symbol to, CastInst::CastOps& op);
+    // float4 is 4 lanes of float, false for the scalar types
+    static bool vectorElement(Symbol typeName, Symbol& element, unsigned& lanes);
 
-    bool isStruct(string typeStr) const;
+    bool isStruct(Symbol typeName) const;
 
     static string llvmTypeToStr(Value* value) ;
     static string llvmTypeToStr(Type* type) ;
@@ -0,0 +1,82 @@
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ASTNodes.h"
+#include "Parser.h"
+#include "grammar.hpp"
+
+// Lexes a file over and over and reports the throughput. Linked once with
+// Lexer.o and once with the flex scanner of token.l, see `make bench`.
+// With --tokens it prints the tokens instead, so tests/run.sh can compare
+// the two scanners.
+//   lexbench FILE [ROUNDS]
+//   lexbench --tokens FILE
+
+// One line per token, its number and the value the parser takes from it
+static void printTokens(SourceBuffer& source){
+    ParseContext context(source);
+    YYSTYPE value;
+    while( int token = yylex(&value, context) ){
+        switch( token ){
+            case TIDENTIFIER: case TYINT: case TYDOUBLE: case TYFLOAT: case TYCHAR:
+            case TYBOOL: case TYVOID: case TYSTRING: case TYVECTOR:
+                printf("%d %s\n", token, Symbol::fromId(value.symbol).str().c_str());
+                break;
+            case TINTEGER:
+                printf("%d %llu\n", token, (unsigned long long)value.integer);
+                break;
+            case TDOUBLE:
+                printf("%d %.17g\n", token, value.number);
+                break;
+            case TLITERAL: case TPRAGMA:
+                printf("%d %.*s\n", token, (int)value.span.length, source.text().data() + value.span.offset);
+                break;
+            default:
+                printf("%d\n", token);
+                break;
+        }
+    }
+}
+
+int main(int argc, char** argv){
+    bool tokensOnly = argc > 1 && strcmp(argv[1], "--tokens") == 0;
+    if( argc < 2 + tokensOnly ){
+        fprintf(stderr, "Usage: %s FILE [ROUNDS]\n       %s --tokens FILE\n", argv[0], argv[0]);
+        return 1;
+    }
+    if( tokensOnly ){
+        SourceBuffer source;
+        if( !source.mapFile(argv[2]) )
+            return 1;
+        printTokens(source);
+        return 0;
+    }
+    unsigned rounds = argc > 2 ? strtoul(argv[2], nullptr, 10) : 20;
+
+    SourceBuffer source;
+    if( !source.mapFile(argv[1]) )
+        return 1;
+
+    // the first round faults the pages in and interns the identifiers
+    uint64_t tokens = 0;
+    YYSTYPE value;
+    {
+        ParseContext context(source);
+        while( yylex(&value, context) )
+            tokens++;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for(unsigned i=0; i<rounds; i++){
+        ParseContext context(source);
+        while( yylex(&value, context) ){
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    double bytes = double(source.text().size()) * rounds;
+    printf("%s: %llu tokens, %.1f MB/s, %.1f Mtokens/s\n", argv[0], (unsigned long long)tokens,
+           bytes / elapsed.count() / 1e6, double(tokens) * rounds / elapsed.count() / 1e6);
+    return 0;
+}
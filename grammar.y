@@ -1,13 +1,48 @@
+%code requires {
+	#include "Source.h"
+	class ParseContext;
+}
+%code provides {
+	int yylex(YYSTYPE* lval, ParseContext& context);
+}
 %{
 	#include "ASTNodes.h"
+	#include "Parser.h"
 	#include <stdio.h>
-	NBlock* programBlock;
-	extern int yylex();
-	void yyerror(const char* s)
+	#include <string.h>
+	void yyerror(ParseContext& context, const char* s)
 	{
 		printf("Error: %s\n", s);
 	}
+
+	// "#pragma loop vectorize(4) interleave(2) unroll(8)" in front of a loop
+	static void setLoopHints(NStatement* loop, llvm::StringRef span)
+	{
+		LoopHints& hints = llvm::cast<NForStatement>(loop)->hints;
+		std::string pragma = span.str();
+		const char* text = pragma.c_str() + pragma.find("loop") + 4;
+		char name[32];
+		unsigned value;
+		int length;
+		while( sscanf(text, " %31[a-z_] ( %u )%n", name, &value, &length) == 2 ){
+			if( strcmp(name, "vectorize") == 0 )
+				hints.vectorizeWidth = value;
+			else if( strcmp(name, "interleave") == 0 )
+				hints.interleaveCount = value;
+			else if( strcmp(name, "unroll") == 0 )
+				hints.unrollCount = value;
+			else
+				printf("Warning: unknown loop hint %s\n", name);
+			text += length;
+		}
+		if( sscanf(text, " %1s", name) == 1 )
+			printf("Warning: can't parse the loop hints %s\n", text);
+	}
 %}
+%define api.pure full
+%parse-param {ParseContext& context}
+%lex-param {ParseContext& context}
+
 %union
 {
 	NBlock* block;
@@ -16,18 +51,24 @@
 	NIdentifier* ident;
 	NVariableDeclaration* var_decl;
 	NArrayIndex* index;
-	std::vector<shared_ptr<NVariableDeclaration>>* varvec;
-	std::vector<shared_ptr<NExpression>>* exprvec;
-	std::string* string;
+	VariableList* varvec;
+	ExpressionList* exprvec;
+	SourceSpan span;
+	ReductionList* reductions;
+	uint32_t symbol;
+	uint64_t integer;
+	double number;
 	int token;
-	double test;
 }
 
-%token <string> TIDENTIFIER TINTEGER TDOUBLE TYINT TYDOUBLE TYFLOAT TYCHAR TYBOOL TYVOID TYSTRING TEXTERN TLITERAL
+%token <symbol> TIDENTIFIER TYINT TYDOUBLE TYFLOAT TYCHAR TYBOOL TYVOID TYSTRING TYVECTOR
+%token <integer> TINTEGER
+%token <number> TDOUBLE
+%token <span> TLITERAL TPRAGMA
 %token <token> TCEQ TCNE TCLT TCLE TCGT TCGE TEQUAL
 %token <token> TLPAREN TRPAREN TLBRACE TRBRACE TCOMMA TDOT TSEMICOLON TLBRACKET TRBRACKET TQUOTATION
 %token <token> TPLUS TMINUS TMUL TDIV TAND TOR TXOR TMOD TNEG TNOT TSHIFTL TSHIFTR
-%token <token> TIF TELSE TFOR TWHILE TRETURN TSTRUCT
+%token <token> TIF TELSE TFOR TWHILE TRETURN TSTRUCT TEXTERN TPARALLEL TREDUCE
 
 %type <index> array_index
 %type <ident> ident primary_typename array_typename struct_typename typename
@@ -35,8 +76,9 @@
 %type <varvec> func_decl_args struct_members
 %type <exprvec> call_args
 %type <block> program stmts block
-%type <stmt> stmt var_decl func_decl struct_decl if_stmt for_stmt while_stmt
-%type <token> comparison
+%type <stmt> stmt var_decl func_decl struct_decl if_stmt for_stmt while_stmt parallel_for_stmt
+%type <token> comparison reduction_op
+%type <reductions> reductions reduction_list
 
 %left TPLUS TMINUS
 %left TMUL TDIV TMOD
@@ -44,38 +86,43 @@
 %start program
 
 %%
-program : stmts { programBlock = $1; }
+program : stmts { context.program = $1; }
 				;
-stmts : stmt { $$ = new NBlock(); $$->statements->push_back(shared_ptr<NStatement>($1)); }
-			| stmts stmt { $1->statements->push_back(shared_ptr<NStatement>($2)); }
+stmts : stmt { $$ = new NBlock(); $$->statements->push_back($1); }
+			| stmts stmt { $1->statements->push_back($2); }
 			;
 stmt : var_decl | func_decl | struct_decl
-		 | expr { $$ = new NExpressionStatement(shared_ptr<NExpression>($1)); }
-		 | TRETURN expr { $$ = new NReturnStatement(shared_ptr<NExpression>($2)); }
+		 | expr { $$ = new NExpressionStatement($1); }
+		 | TRETURN expr { $$ = new NReturnStatement($2); }
 		 | if_stmt
 		 | for_stmt
 		 | while_stmt
+		 | parallel_for_stmt
+		 | TPRAGMA for_stmt { $$ = $2; setLoopHints($2, context.spanText($1)); }
+		 | TPRAGMA while_stmt { $$ = $2; setLoopHints($2, context.spanText($1)); }
 		 ;
 
 block : TLBRACE stmts TRBRACE { $$ = $2; }
 			| TLBRACE TRBRACE { $$ = new NBlock(); }
 			;
 
-primary_typename : TYINT { $$ = new NIdentifier(*$1); $$->isType = true;  delete $1; }
-					| TYDOUBLE { $$ = new NIdentifier(*$1); $$->isType = true; delete $1; }
-					| TYFLOAT { $$ = new NIdentifier(*$1); $$->isType = true; delete $1; }
-					| TYCHAR { $$ = new NIdentifier(*$1); $$->isType = true; delete $1; }
-					| TYBOOL { $$ = new NIdentifier(*$1); $$->isType = true; delete $1; }
-					| TYVOID { $$ = new NIdentifier(*$1); $$->isType = true; delete $1; }
-					| TYSTRING { $$ = new NIdentifier(*$1); $$->isType = true; delete $1; }
+primary_typename : TYINT { $$ = new NIdentifier(Symbol::fromId($1)); $$->isType = true; }
+					| TYDOUBLE { $$ = new NIdentifier(Symbol::fromId($1)); $$->isType = true; }
+					| TYFLOAT { $$ = new NIdentifier(Symbol::fromId($1)); $$->isType = true; }
+					| TYCHAR { $$ = new NIdentifier(Symbol::fromId($1)); $$->isType = true; }
+					| TYBOOL { $$ = new NIdentifier(Symbol::fromId($1)); $$->isType = true; }
+					| TYVOID { $$ = new NIdentifier(Symbol::fromId($1)); $$->isType = true; }
+					| TYSTRING { $$ = new NIdentifier(Symbol::fromId($1)); $$->isType = true; }
+					| TYVECTOR { $$ = new NIdentifier(Symbol::fromId($1)); $$->isType = true; }
 
 array_typename : primary_typename TLBRACKET TINTEGER TRBRACKET { 
 					$1->isArray = true; 
-					$1->arraySize->push_back(make_shared<NInteger>(atol($3->c_str()))); 
+					$1->arraySize = new ExpressionList();
+					$1->arraySize->push_back(new NInteger($3)); 
 					$$ = $1; 
 				}
 				| array_typename TLBRACKET TINTEGER TRBRACKET {
-					$1->arraySize->push_back(make_shared<NInteger>(atol($3->c_str())));
+					$1->arraySize->push_back(new NInteger($3));
 					$$ = $1;
 				}
 
@@ -88,84 +135,107 @@ typename : primary_typename { $$ = $1; }
 			| array_typename { $$ = $1; }
 			| struct_typename { $$ = $1; }
 
-var_decl : typename ident { $$ = new NVariableDeclaration(shared_ptr<NIdentifier>($1), shared_ptr<NIdentifier>($2), nullptr); }
-				 | typename ident TEQUAL expr { $$ = new NVariableDeclaration(shared_ptr<NIdentifier>($1), shared_ptr<NIdentifier>($2), shared_ptr<NExpression>($4)); }
+var_decl : typename ident { $$ = new NVariableDeclaration($1, $2, nullptr); }
+				 | typename ident TEQUAL expr { $$ = new NVariableDeclaration($1, $2, $4); }
 				 | typename ident TEQUAL TLBRACKET call_args TRBRACKET {
-					 $$ = new NArrayInitialization(make_shared<NVariableDeclaration>(shared_ptr<NIdentifier>($1), shared_ptr<NIdentifier>($2), nullptr), shared_ptr<ExpressionList>($5));
+					 $$ = new NArrayInitialization(new NVariableDeclaration($1, $2, nullptr), $5);
 				 }
 				 ;
 
 func_decl : typename ident TLPAREN func_decl_args TRPAREN block
-				{ $$ = new NFunctionDeclaration(shared_ptr<NIdentifier>($1), shared_ptr<NIdentifier>($2), shared_ptr<VariableList>($4), shared_ptr<NBlock>($6));  }
-			| TEXTERN typename ident TLPAREN func_decl_args TRPAREN { $$ = new NFunctionDeclaration(shared_ptr<NIdentifier>($2), shared_ptr<NIdentifier>($3), shared_ptr<VariableList>($5), nullptr, true); }
+				{ $$ = new NFunctionDeclaration($1, $2, $4, $6);  }
+			| TEXTERN typename ident TLPAREN func_decl_args TRPAREN { $$ = new NFunctionDeclaration($2, $3, $5, nullptr, true); }
 
 func_decl_args : /* blank */ { $$ = new VariableList(); }
-							 | var_decl { $$ = new VariableList(); $$->push_back(shared_ptr<NVariableDeclaration>($<var_decl>1)); }
-							 | func_decl_args TCOMMA var_decl { $1->push_back(shared_ptr<NVariableDeclaration>($<var_decl>3)); }
+							 | var_decl { $$ = new VariableList(); $$->push_back($<var_decl>1); }
+							 | func_decl_args TCOMMA var_decl { $1->push_back($<var_decl>3); }
 							 ;
 
-ident : TIDENTIFIER { $$ = new NIdentifier(*$1); delete $1; }
+ident : TIDENTIFIER { $$ = new NIdentifier(Symbol::fromId($1)); }
 			;
 
-numeric : TINTEGER { $$ = new NInteger(atol($1->c_str())); }
-				| TDOUBLE { $$ = new NDouble(atof($1->c_str())); }
+numeric : TINTEGER { $$ = new NInteger($1); }
+				| TDOUBLE { $$ = new NDouble($1); }
 				;
 expr : 	assign { $$ = $1; }
-		 | ident TLPAREN call_args TRPAREN { $$ = new NMethodCall(shared_ptr<NIdentifier>($1), shared_ptr<ExpressionList>($3)); }
+		 | ident TLPAREN call_args TRPAREN { $$ = new NMethodCall($1, $3); }
 		 | ident { $<ident>$ = $1; }
-		 | ident TDOT ident { $$ = new NStructMember(shared_ptr<NIdentifier>($1), shared_ptr<NIdentifier>($3)); }
+		 | ident TDOT ident { $$ = new NStructMember($1, $3); }
 		 | numeric
-		 | expr comparison expr { $$ = new NBinaryOperator(shared_ptr<NExpression>($1), $2, shared_ptr<NExpression>($3)); }
-		 | expr TMOD expr { $$ = new NBinaryOperator(shared_ptr<NExpression>($1), $2, shared_ptr<NExpression>($3)); }
-		 | expr TMUL expr { $$ = new NBinaryOperator(shared_ptr<NExpression>($1), $2, shared_ptr<NExpression>($3)); }
-		 | expr TDIV expr { $$ = new NBinaryOperator(shared_ptr<NExpression>($1), $2, shared_ptr<NExpression>($3)); }
-		 | expr TPLUS expr { $$ = new NBinaryOperator(shared_ptr<NExpression>($1), $2, shared_ptr<NExpression>($3)); }
-		 | expr TMINUS expr { $$ = new NBinaryOperator(shared_ptr<NExpression>($1), $2, shared_ptr<NExpression>($3)); }
+		 | expr comparison expr { $$ = new NBinaryOperator($1, $2, $3); }
+		 | expr TMOD expr { $$ = new NBinaryOperator($1, $2, $3); }
+		 | expr TMUL expr { $$ = new NBinaryOperator($1, $2, $3); }
+		 | expr TDIV expr { $$ = new NBinaryOperator($1, $2, $3); }
+		 | expr TPLUS expr { $$ = new NBinaryOperator($1, $2, $3); }
+		 | expr TMINUS expr { $$ = new NBinaryOperator($1, $2, $3); }
 		 | TLPAREN expr TRPAREN { $$ = $2; }
 		 | TMINUS expr { $$ = nullptr; /* TODO */ }
 		 | array_index { $$ = $1; }
-		 | TLITERAL { $$ = new NLiteral(*$1); delete $1; }
+		 | TLITERAL { $$ = new NLiteral(context.spanText($1)); }
 		 ;
 
 array_index : ident TLBRACKET expr TRBRACKET 
-				{ $$ = new NArrayIndex(shared_ptr<NIdentifier>($1), shared_ptr<NExpression>($3)); }
+				{ $$ = new NArrayIndex($1, $3); }
 				| array_index TLBRACKET expr TRBRACKET 
 					{ 	
-						$1->expressions->push_back(shared_ptr<NExpression>($3));
+						$1->expressions->push_back($3);
 						$$ = $1;
 					}
-assign : ident TEQUAL expr { $$ = new NAssignment(shared_ptr<NIdentifier>($1), shared_ptr<NExpression>($3)); }
+assign : ident TEQUAL expr { $$ = new NAssignment($1, $3); }
 			| array_index TEQUAL expr {
-				$$ = new NArrayAssignment(shared_ptr<NArrayIndex>($1), shared_ptr<NExpression>($3));
+				$$ = new NArrayAssignment($1, $3);
 			}
 			| ident TDOT ident TEQUAL expr {
-				auto member = make_shared<NStructMember>(shared_ptr<NIdentifier>($1), shared_ptr<NIdentifier>($3)); 
-				$$ = new NStructAssignment(member, shared_ptr<NExpression>($5)); 
+				auto member = new NStructMember($1, $3); 
+				$$ = new NStructAssignment(member, $5); 
 			}
 			;
 
 call_args : /* blank */ { $$ = new ExpressionList(); }
-					| expr { $$ = new ExpressionList(); $$->push_back(shared_ptr<NExpression>($1)); }
-					| call_args TCOMMA expr { $1->push_back(shared_ptr<NExpression>($3)); }
+					| expr { $$ = new ExpressionList(); $$->push_back($1); }
+					| call_args TCOMMA expr { $1->push_back($3); }
 comparison : TCEQ | TCNE | TCLT | TCLE | TCGT | TCGE
 				 | TAND | TOR | TXOR | TSHIFTL | TSHIFTR
 					 ;
-if_stmt : TIF expr block { $$ = new NIfStatement(shared_ptr<NExpression>($2), shared_ptr<NBlock>($3)); }
-		| TIF expr block TELSE block { $$ = new NIfStatement(shared_ptr<NExpression>($2), shared_ptr<NBlock>($3), shared_ptr<NBlock>($5)); }
+if_stmt : TIF expr block { $$ = new NIfStatement($2, $3); }
+		| TIF expr block TELSE block { $$ = new NIfStatement($2, $3, $5); }
 		| TIF expr block TELSE if_stmt { 
 			auto blk = new NBlock(); 
-			blk->statements->push_back(shared_ptr<NStatement>($5)); 
-			$$ = new NIfStatement(shared_ptr<NExpression>($2), shared_ptr<NBlock>($3), shared_ptr<NBlock>(blk)); 
+			blk->statements->push_back($5); 
+			$$ = new NIfStatement($2, $3, blk); 
 		}
 
-for_stmt : TFOR TLPAREN expr TSEMICOLON expr TSEMICOLON expr TRPAREN block { $$ = new NForStatement(shared_ptr<NBlock>($9), shared_ptr<NExpression>($3), shared_ptr<NExpression>($5), shared_ptr<NExpression>($7)); }
+for_stmt : TFOR TLPAREN expr TSEMICOLON expr TSEMICOLON expr TRPAREN block { $$ = new NForStatement($9, $3, $5, $7); }
 		
-while_stmt : TWHILE TLPAREN expr TRPAREN block { $$ = new NForStatement(shared_ptr<NBlock>($5), nullptr, shared_ptr<NExpression>($3), nullptr); }
+while_stmt : TWHILE TLPAREN expr TRPAREN block { $$ = new NForStatement($5, nullptr, $3, nullptr); }
+
+parallel_for_stmt : TPARALLEL TFOR TLPAREN expr TSEMICOLON expr TSEMICOLON expr TRPAREN reductions block {
+					auto loop = new NForStatement($11, $4, $6, $8);
+					loop->parallel = true;
+					loop->reductions = $10;
+					$$ = loop;
+				}
+
+reductions : /* blank */ { $$ = nullptr; }
+			| TREDUCE TLPAREN reduction_list TRPAREN { $$ = $3; }
+
+reduction_list : reduction_op ident { $$ = new ReductionList(); $$->push_back(LoopReduction{$1, $2}); }
+				| reduction_list TCOMMA reduction_op ident { $1->push_back(LoopReduction{$3, $4}); }
+
+reduction_op : TPLUS | TMUL
 
-struct_decl : TSTRUCT ident TLBRACE struct_members TRBRACE {$$ = new NStructDeclaration(shared_ptr<NIdentifier>($2), shared_ptr<VariableList>($4)); }
+struct_decl : TSTRUCT ident TLBRACE struct_members TRBRACE {$$ = new NStructDeclaration($2, $4); }
 
 struct_members : /* blank */ { $$ = new VariableList(); }
-				| var_decl { $$ = new VariableList(); $$->push_back(shared_ptr<NVariableDeclaration>($<var_decl>1)); }
-				| struct_members var_decl { $1->push_back(shared_ptr<NVariableDeclaration>($<var_decl>2)); }
+				| var_decl { $$ = new VariableList(); $$->push_back($<var_decl>1); }
+				| struct_members var_decl { $1->push_back($<var_decl>2); }
 
-%%
\ No newline at end of file
+%%
+
+NBlock* parseProgram(SourceBuffer& source)
+{
+	ParseContext context(source);
+	if( yyparse(context) != 0 )
+		return nullptr;
+	return context.program;
+}
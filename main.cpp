@@ -1,37 +1,300 @@
 #include <iostream>
 #include <fstream>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <memory>
+#include <set>
+#include <thread>
+#include <vector>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
 #include "ASTNodes.h"
+#include "ASTFold.h"
+#include "Semantic.h"
 #include "CodeGen.h"
 #include "ObjGen.h"
+#include "JIT.h"
+#include "Optimizer.h"
+#include "Options.h"
+#include "Cache.h"
+#include "Partition.h"
+#include "Server.h"
+#include "Parser.h"
+#include "Source.h"
+
+//Build the module of source in context and optimize it. targetMachine
+//describes the target at -O2 and up, one is created if it's nullptr
+static bool generateProgram(SourceBuffer& source, CodeGenContext& context, const CompilerOptions& options,
+                            const CompileCache& cache, llvm::TargetMachine* targetMachine){
+    //Use the token stream to build a AST, all of its nodes live in astArena
+    //until the code is generated
+    Arena astArena;
+    ArenaScope astScope(astArena);
+    NBlock* program = parseProgram(source);
+    if( !program )
+        return false;
+    //Resolve the names and types, the code generation relies on them
+    if( !analyzeProgram(*program) )
+        return false;
+    //Fold the constant expressions and casts and drop the dead branches
+    //before any code is generated for them
+    foldConstants(*program);
+
+    #ifdef PRINT_NUM_OF_VALID_NODES
+        llvm::errs() << "AST: " << astArena.bytesAllocated() << " bytes in the arena\n";
+    #endif
 
-extern shared_ptr<NBlock> programBlock;
-extern int yyparse();
-int main(int argc, char **argv) {
-    //Use the token stream to build a AST whose root is programBlock
-    yyparse();
-    
     #ifdef PRINT_AND_JOSONGEN
-        programBlock->print("--");
-        auto root = programBlock->jsonGen();
+        program->print("--");
+        auto root = program->jsonGen();
+        std::string outPutJsonFile = "visual/Tree.json";
+        std::ofstream astJson(outPutJsonFile);
+        if( astJson.is_open() ){
+            astJson << root;
+            astJson.close();
+            std::cout << "json file output" << outPutJsonFile << std::endl;
+        }
     #endif
-    
-    //innitial the llvm context
+
+    //Reuse the cached code of the unchanged functions, the units are
+    //optimized on their own
+    bool partition = canPartition(*program);
+    if( options.incremental && cache.enabled() && !options.jitTiered && partition ){
+        if( !generateCodeIncremental(*program, context, options, cache) )
+            return false;
+        if( options.printIR )
+            context.theModule->print(llvm::outs(), nullptr);
+        return true;
+    }
+
+    //Use the root Node of the AST to do the code generation, split
+    //across threads with -j
+    if( options.jobs != 1 && partition ){
+        if( !generateCodeParallel(*program, context, options) )
+            return false;
+    }else{
+        context.generateCode(*program);
+    }
+    if( options.printIR )
+        context.theModule->print(llvm::outs(), nullptr);
+    //Optimize the module with the selected -O level, the tiered JIT starts
+    //from the unoptimized module and optimizes the hot functions itself
+    if( options.jitTiered )
+        return optimizeModule(*context.theModule, 0);
+
+    std::unique_ptr<llvm::TargetMachine> ownedTargetMachine;
+    if( options.optLevel >= 2 ){
+        if( !targetMachine ){
+            doInit();
+            ownedTargetMachine.reset(createTargetMachine(options));
+            targetMachine = ownedTargetMachine.get();
+        }
+        if( targetMachine ){
+            context.theModule->setDataLayout(targetMachine->createDataLayout());
+            context.theModule->setTargetTriple(targetMachine->getTargetTriple().str());
+        }
+        bool required = options.runtimeBitcode != DUDE_RUNTIME_BITCODE;
+        if( !linkRuntimeBitcode(*context.theModule, options.runtimeBitcode, required) )
+            return false;
+    }
+    return optimizeModule(*context.theModule, options.optLevel, targetMachine);
+}
+
+//Compile source to outputFile, through the object cache if there is one
+static bool compileToObject(SourceBuffer& source, const CompilerOptions& options, const CompileCache& cache,
+                            const std::string& outputFile, llvm::TargetMachine* targetMachine){
+    std::string cacheKey;
+    if( cache.enabled() && !options.splitObjects ){
+        cacheKey = CompileCache::makeKey(source.text(), options);
+        if( cache.fetch(cacheKey, outputFile) )
+            return true;
+    }
+
+    CodeGenContext context;
+    if( !generateProgram(source, context, options, cache, targetMachine) )
+        return false;
+    if( !ObjGen(context, options, outputFile, targetMachine) )
+        return false;
+    if( !cacheKey.empty() )
+        cache.store(cacheKey, outputFile);
+    return true;
+}
+
+//Compile every input to DIR/<name>.o in one process. The targets are
+//initialized once and the host CPU detected once, the units are spread
+//over a pool of threads each of which keeps its own TargetMachine (they
+//aren't safe to share between threads)
+static bool compileBatch(const CompilerOptions& options, const CompileCache& cache){
+    const std::string& outputDir = options.outputFile;
+    if( auto error = llvm::sys::fs::create_directories(outputDir) ){
+        llvm::errs() << "Could not create " << outputDir << ": " << error.message() << "\n";
+        return false;
+    }
+
+    std::vector<std::string> outputs;
+    std::set<std::string> taken;
+    for(auto& input: options.inputFiles){
+        llvm::SmallString<128> path(outputDir);
+        llvm::sys::path::append(path, llvm::sys::path::stem(input) + ".o");
+        std::string output = path.str().str();
+        if( !taken.insert(output).second ){
+            llvm::errs() << "Two inputs would both be compiled to " << output << "\n";
+            return false;
+        }
+        outputs.push_back(output);
+    }
+
+    doInit();
+    CompilerOptions unitOptions = options;
+    unitOptions.cpu = getTargetCPU(options);
+    unitOptions.features = getTargetFeatures(options);
+    unitOptions.printIR = false;
+
+    size_t count = options.inputFiles.size();
+    unsigned threads = options.batchThreads;
+    if( threads == 0 )
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::atomic<size_t> next(0);
+    // not vector<bool>, the threads write their own element
+    std::vector<char> compiled(count, 0);
+    std::vector<std::thread> workers;
+    for(unsigned t=0; t<threads && t<count; t++){
+        workers.emplace_back([&](){
+            std::unique_ptr<llvm::TargetMachine> targetMachine(createTargetMachine(unitOptions));
+            if( !targetMachine )
+                return;
+            size_t i;
+            while( (i = next++) < count ){
+                SourceBuffer source;
+                compiled[i] = source.mapFile(options.inputFiles[i].c_str()) &&
+                              compileToObject(source, unitOptions, cache, outputs[i], targetMachine.get());
+            }
+        });
+    }
+    for(auto& worker: workers){
+        worker.join();
+    }
+
+    bool success = true;
+    for(size_t i=0; i<count; i++){
+        if( !compiled[i] ){
+            llvm::errs() << options.inputFiles[i] << ": not compiled\n";
+            success = false;
+        }
+    }
+    return success;
+}
+
+//Compile as the command line asks. targetMachine, if any, matches the
+//target options and is used for a single object
+static int compile(const CompilerOptions& options, llvm::TargetMachine* targetMachine){
+    CompileCache cache(options.cacheDir);
+    if( options.batch() )
+        return compileBatch(options, cache) ? 0 : 1;
+
+    //The whole source is read up front, it is the key of the object cache.
+    //A file is mapped, the lexer works on the mapping without copying it
+    SourceBuffer source;
+    if( options.inputFiles.empty() ? !source.readStream(stdin) : !source.mapFile(options.inputFiles[0].c_str()) )
+        return 1;
+
+    if( !options.jit )
+        return compileToObject(source, options, cache, options.outputFile, targetMachine) ? 0 : 1;
+
+    //Run the program in-process
     CodeGenContext context;
-    //Use the root Node of the AST to do the code generation
-    context.generateCode(*programBlock);
-    //Output the target
-    ObjGen(context);
-
-#ifdef PRINT_AND_JOSONGEN
-    std::string outPutJsonFile = "visual/Tree.json";
-    std::ofstream astJson(outPutJsonFile);
-    if( astJson.is_open() ){
-        astJson << root;
-        astJson.close();
-        std::cout << "json file output" << outPutJsonFile << std::endl;
-    }
-#endif
-
-    return 0;
+    if( !generateProgram(source, context, options, cache, nullptr) )
+        return 1;
+    if( options.jitTiered )
+        return runTieredJIT(context, options);
+    return runJIT(context, options);
 }
 
+//Serve the compile requests of the clients on options.serveSocket. The
+//targets are registered, the host CPU detected and a TargetMachine created
+//for each -O level before any request, with the server's CPU, features and
+//relocation model, and the pass pipelines of each are run once. Every
+//request is run by a worker forked from this warm process. A single object
+//with the server's target options is emitted by the TargetMachine of its
+//-O level, other target options, batches and --jit create their own
+static int serve(const CompilerOptions& serverOptions){
+    doInit();
+    CompilerOptions warmOptions = serverOptions;
+    warmOptions.cpu = getTargetCPU(serverOptions);
+    warmOptions.features = getTargetFeatures(serverOptions);
+    //-O0 to -O3
+    std::unique_ptr<llvm::TargetMachine> warmTargetMachines[4];
+    for(unsigned level=0; level<4; level++){
+        warmOptions.optLevel = level;
+        warmTargetMachines[level].reset(createTargetMachine(warmOptions));
+        if( !warmTargetMachines[level] )
+            return 1;
+        warmUpPipelines(warmTargetMachines[level].get(), level);
+    }
+
+    return runServer(serverOptions.serveSocket, [&](std::vector<std::string>& args){
+        //Requests without a cache of their own share the server's
+        if( serverOptions.cacheDir.empty() )
+            unsetenv("COMPILER_CACHE_DIR");
+        else
+            setenv("COMPILER_CACHE_DIR", serverOptions.cacheDir.c_str(), 1);
+
+        std::vector<char*> argv;
+        argv.push_back((char*)"compiler");
+        for(auto& arg: args){
+            argv.push_back(&arg[0]);
+        }
+        argv.push_back(nullptr);
+        CompilerOptions options;
+        if( !parseOptions(argv.size() - 1, argv.data(), options) )
+            return 1;
+        if( options.help )
+            return 0;
+        if( !options.serveSocket.empty() ){
+            llvm::errs() << "A request can't start a server\n";
+            return 1;
+        }
+
+        bool warm = options.relocModel == warmOptions.relocModel &&
+                    getTargetCPU(options) == warmOptions.cpu && getTargetFeatures(options) == warmOptions.features;
+        return compile(options, warm ? warmTargetMachines[options.optLevel].get() : nullptr);
+    });
+}
+
+//The command line for the server: the client's cache directory is passed
+//on, the server's environment isn't the client's
+static std::vector<std::string> requestArgs(int argc, char **argv){
+    std::vector<std::string> args;
+    const char* cacheDir = getenv("COMPILER_CACHE_DIR");
+    if( cacheDir )
+        args.push_back(std::string("--cache-dir=") + cacheDir);
+    for(int i=1; i<argc; i++){
+        if( strncmp(argv[i], "--connect=", 10) != 0 )
+            args.push_back(argv[i]);
+    }
+    return args;
+}
+
+int main(int argc, char **argv) {
+    CompilerOptions options;
+    if( !parseOptions(argc, argv, options) )
+        return 1;
+    if( options.help )
+        return 0;
+
+    if( !options.serveSocket.empty() )
+        return serve(options);
+
+    //Let a running server compile, or compile here if there is none
+    if( !options.connectSocket.empty() ){
+        int exitCode;
+        if( forwardToServer(options.connectSocket, requestArgs(argc, argv), exitCode) )
+            return exitCode;
+    }
+    return compile(options, nullptr);
+}
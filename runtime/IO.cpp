@@ -0,0 +1,232 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "Runtime.h"
+
+/*
+ * Buffered console I/O. Output is formatted straight into dude_out_buffer
+ * and written with one write(2) when it fills up, on dude_flush and at
+ * exit. Input is read in blocks and parsed in place.
+ * Output written with printf is flushed before ours, don't read stdin with
+ * both scanf and dude_read_*. The bodies of a parallel for share the
+ * buffers under dude_runtime_lock.
+ */
+
+extern "C" {
+
+char dude_out_buffer[1 << 16];
+size_t dude_out_length = 0;
+
+char dude_in_buffer[1 << 16];
+size_t dude_in_position = 0;
+size_t dude_in_length = 0;
+
+}
+
+static const char digitPairs[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// Write the digits of value backwards ending at end, returns the first one
+static char* formatUnsigned(uint64_t value, char* end){
+    while( value >= 100 ){
+        unsigned pair = (value % 100) * 2;
+        value /= 100;
+        *--end = digitPairs[pair + 1];
+        *--end = digitPairs[pair];
+    }
+    if( value >= 10 ){
+        unsigned pair = value * 2;
+        *--end = digitPairs[pair + 1];
+        *--end = digitPairs[pair];
+    }else{
+        *--end = '0' + value;
+    }
+    return end;
+}
+
+static void flushOutput(){
+    // keep the order with the output of printf
+    fflush(stdout);
+    size_t done = 0;
+    while( done < dude_out_length ){
+        ssize_t written = write(1, dude_out_buffer + done, dude_out_length - done);
+        if( written <= 0 )
+            break;
+        done += written;
+    }
+    dude_out_length = 0;
+}
+
+static void append(const char* text, size_t length){
+    if( dude_out_length + length > sizeof(dude_out_buffer) ){
+        flushOutput();
+        if( length > sizeof(dude_out_buffer) ){
+            ssize_t written = 0;
+            while( length > 0 && (written = write(1, text, length)) > 0 ){
+                text += written;
+                length -= written;
+            }
+            return;
+        }
+    }
+    memcpy(dude_out_buffer + dude_out_length, text, length);
+    dude_out_length += length;
+}
+
+void dude_flush(void){
+    DudeLoopGuard guard;
+    flushOutput();
+}
+
+void dude_print_char(int8_t value){
+    DudeLoopGuard guard;
+    if( dude_out_length == sizeof(dude_out_buffer) )
+        flushOutput();
+    dude_out_buffer[dude_out_length++] = value;
+}
+
+void dude_print_string(const char* value){
+    DudeLoopGuard guard;
+    append(value, strlen(value));
+}
+
+void dude_print_int(int32_t value){
+    DudeLoopGuard guard;
+    char digits[12];
+    char* end = digits + sizeof(digits);
+    uint32_t magnitude = value < 0 ? 0u - (uint32_t)value : value;
+    char* start = formatUnsigned(magnitude, end);
+    if( value < 0 )
+        *--start = '-';
+    append(start, end - start);
+}
+
+// Like printf("%f"). Below 1e9 the value scaled by 1e6 is exact enough to
+// round in integers, ties (where the scaling may have rounded) and anything
+// else go through snprintf
+void dude_print_double(double value){
+    DudeLoopGuard guard;
+    double magnitude = fabs(value);
+    double scaledValue = magnitude * 1e6;
+    double rounded = floor(scaledValue + 0.5);
+    if( !(magnitude < 1e9) || rounded - scaledValue == 0.5 ){
+        char text[400];
+        int length = snprintf(text, sizeof(text), "%f", value);
+        append(text, length);
+        return;
+    }
+
+    uint64_t scaled = (uint64_t)rounded;
+    char digits[32];
+    char* end = digits + sizeof(digits);
+    char* start = formatUnsigned(scaled % 1000000 + 1000000, end);
+    *start = '.';   // over the leading 1 of the zero padding
+    start = formatUnsigned(scaled / 1000000, start);
+    if( signbit(value) )
+        *--start = '-';
+    append(start, end - start);
+}
+
+static int nextChar(){
+    if( dude_in_position == dude_in_length ){
+        ssize_t count = read(0, dude_in_buffer, sizeof(dude_in_buffer));
+        if( count <= 0 )
+            return EOF;
+        dude_in_position = 0;
+        dude_in_length = count;
+    }
+    return (unsigned char)dude_in_buffer[dude_in_position++];
+}
+
+static int skipSpaces(){
+    int c = nextChar();
+    while( c == ' ' || c == '\t' || c == '\n' || c == '\r' )
+        c = nextChar();
+    return c;
+}
+
+// The next decimal integer of stdin, 0 at the end of the input
+int32_t dude_read_int(void){
+    DudeLoopGuard guard;
+    int c = skipSpaces();
+    bool negative = c == '-';
+    if( c == '-' || c == '+' )
+        c = nextChar();
+    int64_t value = 0;
+    while( c >= '0' && c <= '9' ){
+        value = value * 10 + (c - '0');
+        c = nextChar();
+    }
+    if( c != EOF )
+        dude_in_position--;
+    return (int32_t)(negative ? -value : value);
+}
+
+// The next number of stdin. Up to 15 digits without an exponent it is the
+// exactly rounded quotient of two doubles, anything else goes to strtod
+double dude_read_double(void){
+    static const double powers[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    char text[64];
+    size_t length = 0;
+    DudeLoopGuard guard;
+    int c = skipSpaces();
+    while( c != EOF && length + 1 < sizeof(text) &&
+           ((c >= '0' && c <= '9') || c == '.' || c == '-' || c == '+' || c == 'e' || c == 'E') ){
+        text[length++] = c;
+        c = nextChar();
+    }
+    if( c != EOF )
+        dude_in_position--;
+    text[length] = '\0';
+
+    const char* p = text;
+    bool negative = *p == '-';
+    if( *p == '-' || *p == '+' )
+        p++;
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int fraction = -1;
+    for(; *p; p++){
+        if( *p >= '0' && *p <= '9' ){
+            mantissa = mantissa * 10 + (*p - '0');
+            digits++;
+            if( fraction >= 0 )
+                fraction++;
+        }else if( *p == '.' && fraction < 0 ){
+            fraction = 0;
+        }else{
+            break;
+        }
+    }
+    if( *p || digits > 15 )
+        return strtod(text, nullptr);
+
+    double value = (double)mantissa;
+    if( fraction > 0 )
+        value /= powers[fraction];
+    return negative ? -value : value;
+}
+
+namespace {
+
+// flush the output of the programs that never call dude_flush
+class FlushAtExit{
+public:
+    ~FlushAtExit(){
+        flushOutput();
+    }
+};
+
+FlushAtExit flushAtExit;
+
+}
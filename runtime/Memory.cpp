@@ -0,0 +1,70 @@
+#include <stdlib.h>
+
+#include "Runtime.h"
+
+/*
+ * Bump allocator. dude_alloc carves 16 byte aligned pieces out of the
+ * current block and only takes a new one from malloc when it is full,
+ * dude_arena_reset gives everything back at once. The bodies of a
+ * parallel for share the arena under dude_runtime_lock.
+ */
+
+namespace {
+
+class ArenaBlock{
+public:
+    ArenaBlock* previous;
+    size_t size;
+};
+
+const size_t blockSize = 1 << 20;
+const size_t headerSize = (sizeof(ArenaBlock) + 15) & ~(size_t)15;
+
+}
+
+extern "C" {
+
+char* dude_arena_next = nullptr;
+char* dude_arena_end = nullptr;
+void* dude_arena_blocks = nullptr;
+
+}
+
+static __attribute__((noinline)) void* allocateBlock(size_t size){
+    size_t total = headerSize + (size > blockSize ? size : blockSize);
+    ArenaBlock* block = static_cast<ArenaBlock*>(malloc(total));
+    if( !block )
+        abort();
+    block->previous = static_cast<ArenaBlock*>(dude_arena_blocks);
+    block->size = total;
+    dude_arena_blocks = block;
+
+    char* start = reinterpret_cast<char*>(block) + headerSize;
+    dude_arena_next = start + size;
+    dude_arena_end = reinterpret_cast<char*>(block) + total;
+    return start;
+}
+
+void* dude_alloc(int32_t bytes){
+    size_t size = ((size_t)(bytes > 0 ? bytes : 0) + 15) & ~(size_t)15;
+    DudeLoopGuard guard;
+    if( size <= (size_t)(dude_arena_end - dude_arena_next) ){
+        void* piece = dude_arena_next;
+        dude_arena_next += size;
+        return piece;
+    }
+    return allocateBlock(size);
+}
+
+void dude_arena_reset(void){
+    DudeLoopGuard guard;
+    ArenaBlock* block = static_cast<ArenaBlock*>(dude_arena_blocks);
+    while( block ){
+        ArenaBlock* previous = block->previous;
+        free(block);
+        block = previous;
+    }
+    dude_arena_blocks = nullptr;
+    dude_arena_next = nullptr;
+    dude_arena_end = nullptr;
+}
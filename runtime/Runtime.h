@@ -0,0 +1,79 @@
+#ifndef DUDE_RUNTIME_H
+#define DUDE_RUNTIME_H
+
+#include <stdint.h>
+
+// Runtime library of the compiled programs, linked into every executable
+// and into the compiler itself so the JIT resolves it from the process.
+// The compiler declares these functions on its own, keep the signatures in
+// sync with the code generator (runtimeFunctions in Builtins.cpp).
+// IO.cpp and Memory.cpp are also built as bitcode, the compiler links their
+// definitions in as available_externally to inline them, so their mutable
+// state has to be in external globals, never in statics.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Body of a parallel for, runs the iterations first, first + step, ...
+// below last
+typedef void (*dude_loop_body)(void* env, int64_t first, int64_t last);
+
+// Run body over [begin, end) by step (> 0) on the thread pool, returns when
+// every iteration is done. The pool has DUDE_NUM_THREADS threads, or one per
+// core. A parallel for inside another one runs on the calling thread.
+void dude_parallel_for(int64_t begin, int64_t end, int64_t step, dude_loop_body body, void* env);
+
+// Held while a chunk folds its reduction variables into the shared ones
+void dude_reduction_lock(void);
+void dude_reduction_unlock(void);
+
+// The I/O and allocation functions hold it around their state while a
+// parallel for runs, the loop bodies share that state
+void dude_runtime_lock(void);
+void dude_runtime_unlock(void);
+
+// Buffered stdout, see IO.cpp
+void dude_print_int(int32_t value);
+void dude_print_double(double value);
+void dude_print_char(int8_t value);
+void dude_print_string(const char* value);
+void dude_flush(void);
+
+// Parse the next number of stdin, 0 at the end of the input
+int32_t dude_read_int(void);
+double dude_read_double(void);
+
+// 16 byte aligned memory freed all at once by dude_arena_reset
+void* dude_alloc(int32_t bytes);
+void dude_arena_reset(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef __cplusplus
+#include <atomic>
+
+// Number of dude_parallel_for calls running, read by the pool's workers
+// while the calling thread changes it
+extern "C" std::atomic<int32_t> dude_loop_active;
+
+// Scope of a runtime function, takes dude_runtime_lock inside a parallel for
+class DudeLoopGuard{
+private:
+    bool locked;
+
+public:
+    DudeLoopGuard(): locked(dude_loop_active.load(std::memory_order_acquire) != 0){
+        if( locked )
+            dude_runtime_lock();
+    }
+    ~DudeLoopGuard(){
+        if( locked )
+            dude_runtime_unlock();
+    }
+};
+#endif
+
+#endif //DUDE_RUNTIME_H
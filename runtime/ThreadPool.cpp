@@ -0,0 +1,236 @@
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Runtime.h"
+
+/*
+ * Work stealing over iteration ranges. A loop of n iterations is cut into
+ * one contiguous range per participant (the workers and the calling
+ * thread). A participant runs its own range front to back a chunk at a
+ * time; once it is empty it steals the back half of another participant's
+ * range, or the whole rest if that is a single chunk. Ranges only shrink or
+ * move to their thief, so a participant that finds every range empty is done, and the loop
+ * is done when every participant is.
+ */
+
+extern "C" {
+
+std::atomic<int32_t> dude_loop_active(0);
+
+}
+
+namespace {
+
+class Range{
+public:
+    std::mutex lock;
+    // iteration numbers, the induction value is begin + i * step
+    int64_t first = 0;
+    int64_t last = 0;
+    // keeps neighbouring ranges off each other's cache line (C++11 new
+    // ignores alignas)
+    char padding[64];
+};
+
+class ThreadPool{
+private:
+    std::vector<std::thread> workers;
+    std::unique_ptr<Range[]> ranges;
+    unsigned participants;
+
+    // one loop at a time, the others wait for the pool
+    std::mutex loopLock;
+
+    std::mutex stateLock;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    uint64_t generation = 0;
+    unsigned running = 0;
+    bool stopping = false;
+
+    // the current loop
+    dude_loop_body body = nullptr;
+    void* env = nullptr;
+    int64_t begin = 0;
+    int64_t step = 1;
+    int64_t grain = 1;
+
+    bool takeOwn(unsigned self, int64_t& first, int64_t& last);
+    bool steal(unsigned self, int64_t& first, int64_t& last);
+    void participate(unsigned self);
+    void workerLoop(unsigned self);
+
+public:
+    ThreadPool();
+    ~ThreadPool();
+
+    void run(int64_t begin, int64_t end, int64_t step, dude_loop_body body, void* env);
+};
+
+thread_local bool insideLoop = false;
+
+std::mutex reductionLock;
+
+std::mutex runtimeLock;
+
+unsigned threadCount(){
+    const char* value = getenv("DUDE_NUM_THREADS");
+    if( value && atoi(value) > 0 )
+        return atoi(value);
+    unsigned cores = std::thread::hardware_concurrency();
+    return cores ? cores : 1;
+}
+
+ThreadPool::ThreadPool(): participants(threadCount()){
+    ranges.reset(new Range[participants]);
+    // participant 0 is the thread calling dude_parallel_for
+    for(unsigned i=1; i<participants; i++){
+        workers.emplace_back([this, i](){ workerLoop(i); });
+    }
+}
+
+ThreadPool::~ThreadPool(){
+    {
+        std::lock_guard<std::mutex> guard(stateLock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for(auto& worker: workers){
+        worker.join();
+    }
+}
+
+bool ThreadPool::takeOwn(unsigned self, int64_t& first, int64_t& last){
+    Range& range = ranges[self];
+    std::lock_guard<std::mutex> guard(range.lock);
+    if( range.first >= range.last )
+        return false;
+    first = range.first;
+    last = std::min(range.first + grain, range.last);
+    range.first = last;
+    return true;
+}
+
+bool ThreadPool::steal(unsigned self, int64_t& first, int64_t& last){
+    for(unsigned i=1; i<participants; i++){
+        Range& victim = ranges[(self + i) % participants];
+        {
+            std::lock_guard<std::mutex> guard(victim.lock);
+            int64_t left = victim.last - victim.first;
+            if( left <= 0 )
+                continue;
+            first = victim.last - (left > grain ? left / 2 : left);
+            last = victim.last;
+            victim.last = first;
+        }
+
+        // keep what is beyond the first chunk in our own range, so it can
+        // be stolen in turn
+        Range& own = ranges[self];
+        std::lock_guard<std::mutex> guard(own.lock);
+        own.first = std::min(first + grain, last);
+        own.last = last;
+        last = own.first;
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::participate(unsigned self){
+    insideLoop = true;
+    int64_t first, last;
+    while( takeOwn(self, first, last) || steal(self, first, last) ){
+        body(env, begin + first * step, begin + last * step);
+    }
+    insideLoop = false;
+}
+
+void ThreadPool::workerLoop(unsigned self){
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> state(stateLock);
+    for(;;){
+        wake.wait(state, [&](){ return stopping || generation != seen; });
+        if( stopping )
+            return;
+        seen = generation;
+        state.unlock();
+
+        participate(self);
+
+        state.lock();
+        if( --running == 0 )
+            finished.notify_all();
+    }
+}
+
+void ThreadPool::run(int64_t begin, int64_t end, int64_t step, dude_loop_body body, void* env){
+    int64_t count = (end - begin + step - 1) / step;
+    std::lock_guard<std::mutex> loop(loopLock);
+
+    this->body = body;
+    this->env = env;
+    this->begin = begin;
+    this->step = step;
+    // small enough chunks to balance, big enough to amortize the locks
+    this->grain = std::max<int64_t>(1, count / (participants * 16));
+    for(unsigned i=0; i<participants; i++){
+        std::lock_guard<std::mutex> guard(ranges[i].lock);
+        ranges[i].first = count * i / participants;
+        ranges[i].last = count * (i + 1) / participants;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(stateLock);
+        running = participants - 1;
+        generation++;
+    }
+    wake.notify_all();
+
+    participate(0);
+
+    std::unique_lock<std::mutex> state(stateLock);
+    finished.wait(state, [&](){ return running == 0; });
+}
+
+ThreadPool& pool(){
+    static ThreadPool threadPool;
+    return threadPool;
+}
+
+}
+
+extern "C" void dude_parallel_for(int64_t begin, int64_t end, int64_t step, dude_loop_body body, void* env){
+    if( end <= begin || step <= 0 )
+        return;
+    if( insideLoop ){
+        body(env, begin, end);
+        return;
+    }
+    // a count, so a loop that ends doesn't unlock one that still runs
+    dude_loop_active.fetch_add(1, std::memory_order_acq_rel);
+    pool().run(begin, end, step, body, env);
+    dude_loop_active.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+extern "C" void dude_reduction_lock(void){
+    reductionLock.lock();
+}
+
+extern "C" void dude_reduction_unlock(void){
+    reductionLock.unlock();
+}
+
+extern "C" void dude_runtime_lock(void){
+    runtimeLock.lock();
+}
+
+extern "C" void dude_runtime_unlock(void){
+    runtimeLock.unlock();
+}
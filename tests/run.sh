@@ -0,0 +1,264 @@
+#!/bin/sh
+# Runs the programs in tests/ through the compiler in each of its modes.
+# X.src has to print X.expected, in any order of its characters if there is
+# an X.unordered, and print the IR X.ir describes. With X.error instead it
+# must fail to compile with that message.
+# Given the two lexer benchmarks, every X.src has to lex to the same tokens
+# with both.
+# usage: tests/run.sh COMPILER RUNTIME_LIBRARY [LEXBENCH LEXBENCH_FLEX]
+COMPILER=${1:-./compiler}
+RUNTIME=${2:-runtime/libdude.a}
+LEXBENCH=$3
+LEXBENCH_FLEX=$4
+CXX=${CXX:-clang++}
+TESTS=$(dirname "$0")
+WORK=$(mktemp -d)
+server=
+trap '[ -z "$server" ] || kill $server; rm -rf "$WORK"' EXIT
+# the caches are the ones the tests choose
+unset COMPILER_CACHE_DIR
+# more than one worker, so the parallel for loops really split
+DUDE_NUM_THREADS=${DUDE_NUM_THREADS:-4}
+export DUDE_NUM_THREADS
+
+# objects at each -O level, linked against the runtime and run, for the
+# host CPU and for explicitly chosen ones
+OBJECT_MODES="-O0|-O1|-O2|-O3|-O2 --cpu=generic|-O3 --cpu=native"
+case $(uname -m) in
+    x86_64) OBJECT_MODES="$OBJECT_MODES|-O2 --cpu=x86-64 --features=+sse4.2,-avx|-O3 -march=haswell --features=-avx2" ;;
+esac
+# in memory with the JIT, and with the tiered one promoting the functions
+# after their first calls
+JIT_MODES="--jit|-O1 --jit|-O2 --jit|-O3 --jit|--jit-tiered --tier-threshold=1|-O3 --jit-tiered --tier-threshold=2"
+# the function bodies generated on several threads
+JIT_MODES="$JIT_MODES|-j2 --jit|-j0 -O2 --jit"
+OBJECT_MODES="$OBJECT_MODES|-j2 -O0|-j3 -O3"
+# the machine code emitted on several threads and merged again
+OBJECT_MODES="$OBJECT_MODES|--codegen-threads=2|-O2 --codegen-threads=3|-O3 --codegen-threads=0 -j2"
+runs=0
+failures=0
+
+fail(){
+    echo "FAIL $1 ($2)"
+    failures=$((failures + 1))
+}
+
+# compare the output in $WORK/out with the one test $1 expects
+compare(){
+    runs=$((runs + 1))
+    if [ -f "$TESTS/$1.unordered" ] && [ -f "$WORK/out" ]; then
+        tr -d '\n' < "$WORK/out" | fold -w 1 | sort > "$WORK/sorted"
+        mv "$WORK/sorted" "$WORK/out"
+    fi
+    diff -u "$TESTS/$1.expected" "$WORK/out" > "$WORK/diff" || { fail "$1" "$2"; cat "$WORK/diff"; }
+}
+
+# call "$2..." with every mode of the |-separated list $1
+forEachMode(){
+    modes=$1
+    shift
+    while [ -n "$modes" ]; do
+        mode=${modes%%|*}
+        case "$modes" in
+            *"|"*) modes=${modes#*|} ;;
+            *) modes= ;;
+        esac
+        "$@" "$mode"
+    done
+}
+
+runObject(){
+    rm -f "$WORK/prog" "$WORK/out"
+    "$COMPILER" --no-print-ir $2 -o "$WORK/$1.o" "$TESTS/$1.src" > /dev/null 2>&1 &&
+        $CXX -o "$WORK/prog" "$WORK/$1.o" "$RUNTIME" -pthread &&
+        "$WORK/prog" > "$WORK/out"
+    compare "$1" "object $2"
+}
+
+runJIT(){
+    "$COMPILER" --no-print-ir $2 "$TESTS/$1.src" > "$WORK/out" 2> /dev/null
+    compare "$1" "$2"
+}
+
+# the object cache: a miss stores the object, a hit copies the entry as it
+# is, a different -O level misses
+checkCache(){
+    cache="$WORK/cache-$1"
+    runs=$((runs + 1))
+    "$COMPILER" --no-print-ir --cache-dir="$cache" -o "$WORK/$1.o" "$TESTS/$1.src" > /dev/null 2>&1
+    entry=$(ls "$cache"/*.o 2> /dev/null)
+    if [ -z "$entry" ] || ! cmp -s "$entry" "$WORK/$1.o"; then
+        fail "$1" "cache miss not stored"
+        return
+    fi
+    echo cached > "$entry"
+    "$COMPILER" --no-print-ir --cache-dir="$cache" -o "$WORK/$1.o" "$TESTS/$1.src" > /dev/null 2>&1
+    grep -qx cached "$WORK/$1.o" || fail "$1" "cache hit not taken"
+
+    rm -f "$WORK/prog" "$WORK/out"
+    "$COMPILER" --no-print-ir -O2 --cache-dir="$cache" -o "$WORK/$1.o" "$TESTS/$1.src" > /dev/null 2>&1 &&
+        $CXX -o "$WORK/prog" "$WORK/$1.o" "$RUNTIME" -pthread &&
+        "$WORK/prog" > "$WORK/out"
+    compare "$1" "cache -O2"
+    test $(ls "$cache"/*.o | wc -l) -eq 2 || fail "$1" "cache entry shared by -O0 and -O2"
+}
+
+# per-function incremental builds: the second one has to reuse every
+# function
+checkIncremental(){
+    cache="$WORK/incremental-$1"
+    "$COMPILER" --no-print-ir --incremental --cache-dir="$cache" --jit "$TESTS/$1.src" > "$WORK/out" 2> /dev/null
+    compare "$1" "incremental miss"
+    "$COMPILER" --no-print-ir --incremental --cache-dir="$cache" --jit "$TESTS/$1.src" > "$WORK/out" 2> "$WORK/err"
+    compare "$1" "incremental hit"
+    grep -Eq 'reused ([0-9]+)/\1 functions' "$WORK/err" || fail "$1" "incremental build didn't reuse every function"
+}
+
+# --split-objects keeps the parts, they are linked as they are
+checkSplit(){
+    rm -rf "$WORK/split" "$WORK/prog" "$WORK/out"
+    mkdir "$WORK/split"
+    "$COMPILER" --no-print-ir -O2 --codegen-threads=2 --split-objects -o "$WORK/split/$1.o" "$TESTS/$1.src" > /dev/null 2>&1 &&
+        $CXX -o "$WORK/prog" "$WORK/split/$1".part*.o "$RUNTIME" -pthread &&
+        "$WORK/prog" > "$WORK/out"
+    compare "$1" "split objects"
+}
+
+# every line of X.ir is in the IR -O0 prints, the ones starting with a !
+# are not
+checkIR(){
+    runs=$((runs + 1))
+    "$COMPILER" -o "$WORK/$1.o" "$TESTS/$1.src" > "$WORK/ir" 2> /dev/null
+    while IFS= read -r line; do
+        case "$line" in
+            !*) ! grep -qF -- "${line#!}" "$WORK/ir" || fail "$1" "IR has ${line#!}" ;;
+            *) grep -qF -- "$line" "$WORK/ir" || fail "$1" "IR lacks $line" ;;
+        esac
+    done < "$TESTS/$1.ir"
+}
+
+# $2... compiled in one batch by $1 threads, every object linked and run
+# on its own. A copy X.K.src prints X.expected
+runBatch(){
+    threads=$1
+    shift
+    rm -rf "$WORK/batch"
+    mkdir "$WORK/batch"
+    runs=$((runs + 1))
+    "$COMPILER" --batch-threads=$threads -O2 -o "$WORK/batch/" "$@" > /dev/null 2>&1 || fail "batch" "--batch-threads=$threads"
+    for src in "$@"; do
+        name=$(basename "$src" .src)
+        rm -f "$WORK/prog" "$WORK/out"
+        $CXX -o "$WORK/prog" "$WORK/batch/$name.o" "$RUNTIME" -pthread &&
+            "$WORK/prog" > "$WORK/out"
+        compare "${name%%.*}" "batch of $threads threads"
+    done
+}
+
+# the hand-written lexer against the flex scanner
+checkTokens(){
+    runs=$((runs + 1))
+    "$LEXBENCH" --tokens "$TESTS/$1.src" > "$WORK/tokens" 2>&1
+    "$LEXBENCH_FLEX" --tokens "$TESTS/$1.src" > "$WORK/tokens-flex" 2>&1
+    diff -u "$WORK/tokens-flex" "$WORK/tokens" > "$WORK/diff" || { fail "$1" "tokens"; cat "$WORK/diff"; }
+}
+
+for src in "$TESTS"/*.src; do
+    name=$(basename "$src" .src)
+    if [ -n "$LEXBENCH" ]; then
+        checkTokens "$name"
+    fi
+
+    if [ -f "$TESTS/$name.error" ]; then
+        runs=$((runs + 1))
+        if "$COMPILER" --no-print-ir -o "$WORK/$name.o" "$src" > "$WORK/out" 2>&1; then
+            fail "$name" "compiled"
+        elif ! grep -qF -f "$TESTS/$name.error" "$WORK/out"; then
+            fail "$name" "error"
+            cat "$WORK/out"
+        fi
+        continue
+    fi
+
+    if [ -f "$TESTS/$name.ir" ]; then
+        checkIR "$name"
+    fi
+    forEachMode "$OBJECT_MODES" runObject "$name"
+    forEachMode "$JIT_MODES" runJIT "$name"
+    checkSplit "$name"
+    checkCache "$name"
+    checkIncremental "$name"
+done
+
+# the programs that compile, in one batch
+set --
+for src in "$TESTS"/*.src; do
+    [ -f "${src%.src}.error" ] || set -- "$@" "$src"
+done
+runBatch 1 "$@"
+
+# and four copies of each, parsed and compiled by four threads at once
+mkdir "$WORK/copies"
+for src in "$@"; do
+    for copy in 1 2 3 4; do
+        cp "$src" "$WORK/copies/$(basename "$src" .src).$copy.src"
+    done
+done
+runBatch 4 "$WORK"/copies/*.src
+
+# through a compile server, at -O levels it has a TargetMachine for, with a
+# CPU it has to create one for and with --jit. The requests share its
+# cache, so that has the objects of the requests it served
+sock="$WORK/server.sock"
+"$COMPILER" --serve="$sock" --cache-dir="$WORK/server-cache" > /dev/null 2>&1 &
+server=$!
+tries=0
+while [ ! -S "$sock" ] && [ $tries -lt 100 ]; do
+    sleep 0.1
+    tries=$((tries + 1))
+done
+for src in "$@"; do
+    name=$(basename "$src" .src)
+    forEachMode "--connect=$sock -O0|--connect=$sock -O2|--connect=$sock -O3 --cpu=generic" runObject "$name"
+    runJIT "$name" "--connect=$sock -O2 --jit"
+done
+runs=$((runs + 1))
+ls "$WORK/server-cache"/*.o > /dev/null 2>&1 || fail "server" "requests not served"
+kill $server
+server=
+
+# an input that doesn't compile fails the batch, not the other inputs
+rm -rf "$WORK/batch"
+mkdir "$WORK/batch"
+runs=$((runs + 1))
+if "$COMPILER" --batch-threads=2 -o "$WORK/batch/" "$TESTS/recursion.src" "$TESTS/untyped.src" > /dev/null 2> "$WORK/err"; then
+    fail "batch" "compiled untyped"
+elif ! grep -q 'untyped.src: not compiled' "$WORK/err" || [ ! -f "$WORK/batch/recursion.o" ]; then
+    fail "batch" "failing input"
+fi
+
+# an AST over many arena slabs, with a statement list too large for one,
+# compiled in 1 GB of address space
+awk 'BEGIN{ print "int main(){"; print "    int s = 0"; for(i = 0; i < 70000; i++) print "    s = s + " i % 7
+            print "    print_int(s)"; print "    print_char(10)"; print "    return 0"; print "}" }' > "$WORK/large.src"
+echo 210000 > "$WORK/large.expected"
+runs=$((runs + 1))
+( ulimit -v 1000000 2> /dev/null; "$COMPILER" --no-print-ir --jit "$WORK/large.src" ) > "$WORK/out" 2> /dev/null
+cmp -s "$WORK/large.expected" "$WORK/out" || fail "large" "--jit"
+
+# after an edit of main only fib is reused
+cache="$WORK/incremental-edit"
+"$COMPILER" --no-print-ir --incremental --cache-dir="$cache" --jit "$TESTS/recursion.src" > /dev/null 2>&1
+sed 's/i < 10/i < 11/' "$TESTS/recursion.src" > "$WORK/edited.src"
+runs=$((runs + 1))
+"$COMPILER" --no-print-ir --incremental --cache-dir="$cache" --jit "$WORK/edited.src" > "$WORK/out" 2> "$WORK/err"
+grep -q 'reused 1/2 functions' "$WORK/err" && grep -qx 143 "$WORK/out" || fail "recursion" "incremental edit"
+
+# the usage is not an error, an unknown option is
+runs=$((runs + 1))
+"$COMPILER" --help > /dev/null 2>&1 || fail "options" "--help"
+runs=$((runs + 1))
+"$COMPILER" --no-such-option > /dev/null 2>&1 && fail "options" "unknown option"
+
+echo "$runs runs, $failures failed"
+test $failures -eq 0
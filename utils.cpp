@@ -4,9 +4,7 @@
 //#include <iostream>
 #include "CodeGen.h"
 #include "ASTNodes.h"
-
-extern int yyparse();
-extern NBlock* programBlock;
+#include "Parser.h"
 
 
 #endif